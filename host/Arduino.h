@@ -0,0 +1,71 @@
+#pragma once
+// Minimal Arduino API shim for the host build (env:native).
+// Only what Core, StateMachine, LogBuffer, Hw (simulation) and the BT_LOG*
+// shim use. Time comes from the virtual clock in host_clock.h.
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include "host_clock.h"
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT  0x0
+#define OUTPUT 0x1
+
+#define IRAM_ATTR   // no ISR placement on the host
+
+inline unsigned long millis() { return (unsigned long)(uint32_t)(hostClockNow_us() / 1000ULL); }
+inline unsigned long micros() { return (unsigned long)(uint32_t)hostClockNow_us(); }
+inline void delay(uint32_t ms) { hostClockAdvance_us((uint64_t)ms * 1000ULL); }
+inline void delayMicroseconds(uint32_t us) { hostClockAdvance_us(us); }
+inline void yield() {}
+
+// No GPIO/ADC on the host
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) {}
+inline int analogRead(int) { return 0; }
+
+// Print: byte sink with the formatting overloads used by the firmware
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buf, size_t len) {
+    size_t n = 0;
+    while (len--) n += write(*buf++);
+    return n;
+  }
+
+  size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v) { return printFmt_("%d", v); }
+  size_t print(unsigned int v) { return printFmt_("%u", v); }
+  size_t print(long v) { return printFmt_("%ld", v); }
+  size_t print(unsigned long v) { return printFmt_("%lu", v); }
+  size_t print(long long v) { return printFmt_("%lld", v); }
+  size_t print(unsigned long long v) { return printFmt_("%llu", v); }
+  size_t print(double v, int digits = 2) { return printFmt_("%.*f", digits, v); }
+
+  size_t println() { return print('\n'); }
+  template <typename T> size_t println(T v) { const size_t n = print(v); return n + println(); }
+
+private:
+  template <typename... A> size_t printFmt_(const char* fmt, A... a);
+};
+
+#include <stdio.h>
+template <typename... A> size_t Print::printFmt_(const char* fmt, A... a) {
+  char buf[64];
+  const int n = snprintf(buf, sizeof(buf), fmt, a...);
+  return (n > 0) ? write((const uint8_t*)buf, (size_t)n) : 0;
+}
+
+// Serial -> stdout
+class HostSerial : public Print {
+public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buf, size_t len) override;
+};
+extern HostSerial Serial;
@@ -0,0 +1,170 @@
+// Host benchmark: LogBuffer column scans, RowMajor vs ColumnMajor.
+//
+//   pio run -e native_bench && .pio/build/native_bench/program --kb 64 --reps 2000
+//
+// Both layouts get the same storage size and the same synthetic rows (the
+// ring is wrapped once, so scans cover two runs). Per column it reports the
+// colMinMax() and readCol() throughput, and checks that min/max, readRow()
+// and the printCsv() output are identical for both layouts.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+#include "Arduino.h"
+#include "config.h"
+#include "log_buffer.h"
+
+// Print sink that only hashes the output (FNV-1a)
+class HashPrint : public Print {
+public:
+  size_t write(uint8_t c) override {
+    hash_ = (hash_ ^ c) * 1099511628211ull;
+    bytes_++;
+    return 1;
+  }
+  uint64_t hash() const { return hash_; }
+  size_t bytes() const { return bytes_; }
+private:
+  uint64_t hash_ = 1469598103934665603ull;
+  size_t bytes_ = 0;
+};
+
+// Rows shaped like a discharge log: slow voltage curve, constant current,
+// R_mOhm NaN until the first pulse.
+static void fill(LogBuffer& log, size_t rows) {
+  ColValue v[kLogSchemaCols];
+  for (size_t k = 0; k < rows; ++k) {
+    const float x = (float)k / (float)rows;
+    v[0].u32 = (uint32_t)(k * 5);
+    v[1].u16 = (uint16_t)(1 + k / 4000);
+    v[2].u8  = 2;
+    v[3].u8  = 0;
+    v[4].f32 = 13.2f - 2.0f * x - 0.3f * sinf(x * 40.0f);
+    v[5].f32 = -2.0f + 0.01f * (float)(k % 7);
+    v[6].f32 = 25.0f * x;
+    v[7].f32 = (k < 300) ? NAN : 42.0f + 0.001f * (float)(k % 1000);
+    log.store(v, kLogSchemaCols);
+  }
+}
+
+static double seconds(std::chrono::steady_clock::time_point t0) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static size_t cellBytes(ColType t) {
+  return (t == ColType::U8) ? 1 : (t == ColType::U16) ? 2 : 4;
+}
+
+int main(int argc, char** argv) {
+  size_t kb = kLogRamBytes / 1024;
+  unsigned reps = 2000;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--kb") && i + 1 < argc) {
+      kb = (size_t)atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--reps") && i + 1 < argc) {
+      reps = (unsigned)atoi(argv[++i]);
+    } else {
+      printf("usage: %s [--kb N] [--reps N]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (kb == 0 || reps == 0) return 2;
+
+  std::vector<uint8_t> memRow(kb * 1024), memCol(kb * 1024);
+  LogBuffer rowLog(memRow.data(), memRow.size(), kLogSchema, kLogSchemaCols, LogLayout::RowMajor);
+  LogBuffer colLog(memCol.data(), memCol.size(), kLogSchema, kLogSchemaCols, LogLayout::ColumnMajor);
+
+  // Wrap the ring once plus a bit, so the held rows are split in two runs
+  const size_t rows = rowLog.capacity() * 2 + rowLog.capacity() / 3;
+  fill(rowLog, rows);
+  fill(colLog, rows);
+
+  printf("=== LogBuffer column scan ===\n");
+  printf("storage           : %u KiB per layout, %u rows held (capacity %u)\n",
+         (unsigned)kb, (unsigned)rowLog.size(), (unsigned)rowLog.capacity());
+  printf("repetitions       : %u\n\n", reps);
+  printf("%-10s %-4s | %12s %12s | %12s %12s | %7s\n",
+         "column", "type", "row MB/s", "col MB/s", "row Mrow/s", "col Mrow/s", "speedup");
+
+  LogBuffer* logs[2] = {&rowLog, &colLog};
+  bool same = true;
+  std::vector<float> series(rowLog.size());
+  volatile float sink = 0;
+
+  for (size_t c = 0; c < kLogSchemaCols; ++c) {
+    const ColType t = kLogSchema[c].type;
+    const double mb = (double)rowLog.size() * (double)cellBytes(t) * reps / 1e6;
+    const double mrows = (double)rowLog.size() * reps / 1e6;
+
+    double dt[2];
+    float lo[2] = {}, hi[2] = {};
+    for (int l = 0; l < 2; ++l) {
+      const auto t0 = std::chrono::steady_clock::now();
+      for (unsigned r = 0; r < reps; ++r) {
+        logs[l]->colMinMax(c, lo[l], hi[l]);
+        sink = sink + lo[l];
+      }
+      dt[l] = seconds(t0);
+    }
+    if (lo[0] != lo[1] || hi[0] != hi[1]) same = false;
+
+    printf("%-10s %-4s | %12.1f %12.1f | %12.1f %12.1f | %6.2fx\n",
+           kLogSchema[c].name,
+           (t == ColType::U8) ? "u8" : (t == ColType::U16) ? "u16" : (t == ColType::U32) ? "u32" : "f32",
+           mb / dt[0], mb / dt[1], mrows / dt[0], mrows / dt[1], dt[0] / dt[1]);
+  }
+
+  // Series export of U_V (chart data)
+  const int colU = rowLog.colIndex("U_V");
+  double dtSeries[2];
+  uint64_t seriesHash[2] = {};
+  for (int l = 0; l < 2; ++l) {
+    const auto t0 = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < reps; ++r) {
+      logs[l]->readCol((size_t)colU, logs[l]->oldestSeq(), series.data(), series.size());
+      sink = sink + series[r % series.size()];
+    }
+    dtSeries[l] = seconds(t0);
+    for (float f : series) {
+      uint32_t u;
+      memcpy(&u, &f, sizeof(u));
+      seriesHash[l] = seriesHash[l] * 31 + u;
+    }
+  }
+  if (seriesHash[0] != seriesHash[1]) same = false;
+  const double mrows = (double)series.size() * reps / 1e6;
+  printf("\nreadCol U_V       : row %.1f Mrow/s, col %.1f Mrow/s (%.2fx)\n",
+         mrows / dtSeries[0], mrows / dtSeries[1], dtSeries[0] / dtSeries[1]);
+
+  // Row access must not depend on the layout
+  ColValue a[kLogSchemaCols], b[kLogSchemaCols];
+  memset(a, 0, sizeof(a));   // U8 / U16 cells leave the upper bytes alone
+  memset(b, 0, sizeof(b));
+  for (uint32_t s = rowLog.oldestSeq(); s != rowLog.nextSeq(); ++s) {
+    if (!rowLog.readRow(s, a, kLogSchemaCols) || !colLog.readRow(s, b, kLogSchemaCols) ||
+        memcmp(a, b, sizeof(a)) != 0) {
+      same = false;
+      break;
+    }
+  }
+
+  // Full CSV export (the /download path)
+  HashPrint csv[2];
+  double dtCsv[2];
+  for (int l = 0; l < 2; ++l) {
+    const auto t0 = std::chrono::steady_clock::now();
+    logs[l]->printCsv(csv[l]);
+    dtCsv[l] = seconds(t0);
+  }
+  if (csv[0].hash() != csv[1].hash() || csv[0].bytes() != csv[1].bytes()) same = false;
+  printf("printCsv          : row %.2f ms, col %.2f ms (%u bytes)\n",
+         dtCsv[0] * 1e3, dtCsv[1] * 1e3, (unsigned)csv[0].bytes());
+
+  printf("layouts identical : %s\n", same ? "yes" : "NO");
+  return same ? 0 : 1;
+}
@@ -0,0 +1,22 @@
+#include "Arduino.h"
+#include <stdio.h>
+
+static uint64_t g_now_us = 0;
+
+uint64_t hostClockNow_us() { return g_now_us; }
+
+void hostClockSet_us(uint64_t t_us) {
+  if (t_us > g_now_us) g_now_us = t_us;
+}
+
+void hostClockAdvance_us(uint64_t dt_us) { g_now_us += dt_us; }
+
+HostSerial Serial;
+
+size_t HostSerial::write(uint8_t c) {
+  return (fputc(c, stdout) == EOF) ? 0 : 1;
+}
+
+size_t HostSerial::write(const uint8_t* buf, size_t len) {
+  return fwrite(buf, 1, len, stdout);
+}
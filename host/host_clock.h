@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+
+// Virtual clock of the host build.
+// millis()/micros()/delay() of the Arduino shim read and advance this clock,
+// so firmware code runs against simulated time (as fast as the CPU allows).
+uint64_t hostClockNow_us();
+void hostClockSet_us(uint64_t t_us);      // never moves backwards
+void hostClockAdvance_us(uint64_t dt_us);
@@ -0,0 +1,285 @@
+// Offline replay: feeds recorded CSV logs (format of /download) through an
+// unmodified Core + StateMachine and reports where the stop rules fire.
+//
+//   pio run -e native_replay
+//   .pio/build/native_replay/program --set dischargeStopVoltage_V=12.0 logs/*.csv
+//
+// Every recorded active phase (Phase column 0 = charge, 2 = discharge) is one
+// segment. At the start of a segment the core is (re)started in that mode, so
+// replayed and recorded phases stay aligned even if the replayed rule fires
+// earlier or later than the original one. Output is CSV on stdout:
+//
+//   file,row,time_s,event,phase,wh,ah,reason
+//
+// event: stop        replayed rule fired at this sample
+//        not_reached recorded phase ended before any replayed rule fired
+//        orig_stop   recorded phase ended here (original energies)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "Arduino.h"
+#include "config.h"
+#include "hw.h"
+#include "state_machine.h"
+#include "core.h"
+#include "clock.h"
+
+// ---- CoreConfig overrides (--set key=value) --------------------------------
+
+struct FloatKey { const char* name; float CoreConfig::*field; };
+struct U32Key   { const char* name; uint32_t CoreConfig::*field; };
+struct BoolKey  { const char* name; bool CoreConfig::*field; };
+
+static const FloatKey kFloatKeys[] = {
+  {"chargeStopVoltage_V",    &CoreConfig::chargeStopVoltage_V},
+  {"dischargeStopVoltage_V", &CoreConfig::dischargeStopVoltage_V},
+  {"capacityNominal_Ah",     &CoreConfig::capacityNominal_Ah},
+  {"taperDivisor",           &CoreConfig::taperDivisor},
+  {"termArmVoltage_V",       &CoreConfig::termArmVoltage_V},
+  {"plateauSlope_mVpm",      &CoreConfig::plateauSlope_mVpm},
+  {"negDv_V",                &CoreConfig::negDv_V},
+  {"maxChargeAh",            &CoreConfig::maxChargeAh},
+};
+
+static const U32Key kU32Keys[] = {
+  {"chargeHoldAbove_s", &CoreConfig::chargeHoldAbove_s},
+  {"taperHold_s",       &CoreConfig::taperHold_s},
+  {"plateauHold_s",     &CoreConfig::plateauHold_s},
+  {"maxChargeTime_s",   &CoreConfig::maxChargeTime_s},
+};
+
+static const BoolKey kBoolKeys[] = {
+  {"termHold",    &CoreConfig::termHoldEnabled},
+  {"termTaper",   &CoreConfig::termTaperEnabled},
+  {"termPlateau", &CoreConfig::termPlateauEnabled},
+  {"termNegDv",   &CoreConfig::termNegDvEnabled},
+  {"termMaxTime", &CoreConfig::termMaxTimeEnabled},
+  {"termMaxAh",   &CoreConfig::termMaxAhEnabled},
+};
+
+static bool applySetting(CoreConfig& cfg, const char* kv) {
+  const char* eq = strchr(kv, '=');
+  if (!eq) return false;
+  const size_t n = (size_t)(eq - kv);
+  const char* val = eq + 1;
+
+  for (const auto& k : kFloatKeys) {
+    if (strlen(k.name) == n && !strncmp(kv, k.name, n)) { cfg.*k.field = strtof(val, nullptr); return true; }
+  }
+  for (const auto& k : kU32Keys) {
+    if (strlen(k.name) == n && !strncmp(kv, k.name, n)) { cfg.*k.field = (uint32_t)strtoul(val, nullptr, 10); return true; }
+  }
+  for (const auto& k : kBoolKeys) {
+    if (strlen(k.name) == n && !strncmp(kv, k.name, n)) { cfg.*k.field = atoi(val) != 0; return true; }
+  }
+  return false;
+}
+
+// ---- CSV --------------------------------------------------------------------
+
+// Column indices of the fields we need (-1 = missing)
+struct CsvCols {
+  int time = -1, phase = -1, u = -1, i = -1, e = -1;
+};
+
+static CsvCols parseHeader(char* line) {
+  CsvCols c;
+  int idx = 0;
+  for (char* tok = strtok(line, ",\r\n"); tok; tok = strtok(nullptr, ",\r\n"), ++idx) {
+    if (!strcmp(tok, "Time_s")) c.time = idx;
+    else if (!strcmp(tok, "Phase")) c.phase = idx;
+    else if (!strcmp(tok, "U_V")) c.u = idx;
+    else if (!strcmp(tok, "I_A")) c.i = idx;
+    else if (!strcmp(tok, "Ephase_Wh")) c.e = idx;
+  }
+  return c;
+}
+
+// Split a data line in place; returns number of fields.
+static int splitFields(char* line, char** f, int maxFields) {
+  int n = 0;
+  char* p = line;
+  while (n < maxFields) {
+    f[n++] = p;
+    char* comma = strchr(p, ',');
+    if (!comma) break;
+    *comma = '\0';
+    p = comma + 1;
+  }
+  return n;
+}
+
+static bool isActive(int phase) {
+  return phase == (int)Phase::Charge || phase == (int)Phase::Discharge;
+}
+
+static const char* phaseName(int phase) {
+  return (phase == (int)Phase::Charge) ? "charge" : "discharge";
+}
+
+// ---- Replay -----------------------------------------------------------------
+
+struct ReplayStats {
+  unsigned long rows = 0;
+  unsigned long segments = 0;
+};
+
+static bool replayFile(const char* path, const CoreConfig& cfg, ReplayStats& st) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+
+  char line[512];
+  if (!fgets(line, sizeof(line), f)) {
+    fclose(f);
+    return false;
+  }
+  const CsvCols cols = parseHeader(line);
+  if (cols.time < 0 || cols.phase < 0 || cols.u < 0 || cols.i < 0) {
+    fprintf(stderr, "%s: missing Time_s/Phase/U_V/I_A columns\n", path);
+    fclose(f);
+    return false;
+  }
+
+  // Fresh objects per file (unmodified firmware classes): no core, stop
+  // rule or energy state carries over from the previous file
+  Hw hw;
+  StateMachine sm(hw);
+  Core core(hw, sm);
+  hw.begin();
+  core.setConfig(cfg);
+
+  // The virtual clock never moves backwards: recorded times are replayed
+  // as offsets from a base past the end of the previous file
+  const uint64_t base_us = hostClockNow_us() + 1000000ULL;
+  bool haveT0 = false;
+  uint32_t t0_s = 0;
+
+  int segPhase = -1;          // recorded phase of the open segment (-1 = none)
+  bool segFired = false;      // replayed rule already fired in this segment
+  unsigned long lastRow = 0;
+  uint32_t lastTime_s = 0;
+  float lastRecordedWh = NAN;
+
+  auto closeSegment = [&]() {
+    if (segPhase < 0) return;
+    if (!segFired) {
+      printf("%s,%lu,%lu,not_reached,%s,%.4f,%.4f,\n", path, lastRow, (unsigned long)lastTime_s,
+             phaseName(segPhase), fabsf(core.phaseEnergy_Wh()), fabsf(core.phaseCharge_Ah()));
+    }
+    printf("%s,%lu,%lu,orig_stop,%s,%.4f,,\n", path, lastRow, (unsigned long)lastTime_s,
+           phaseName(segPhase), isnan(lastRecordedWh) ? 0.0f : fabsf(lastRecordedWh));
+    segPhase = -1;
+  };
+
+  unsigned long row = 0;
+  char* fld[32];
+  while (fgets(line, sizeof(line), f)) {
+    ++row;
+    const int n = splitFields(line, fld, 32);
+    if (n <= cols.time || n <= cols.phase || n <= cols.u || n <= cols.i) continue;
+
+    const uint32_t t_s = (uint32_t)strtoul(fld[cols.time], nullptr, 10);
+    const int phase = atoi(fld[cols.phase]);
+    const float u = strtof(fld[cols.u], nullptr);
+    const float i = strtof(fld[cols.i], nullptr);
+
+    // Recorded phase boundary?
+    if (segPhase >= 0 && phase != segPhase) closeSegment();
+
+    if (segPhase < 0 && isActive(phase)) {
+      // Re-anchor: restart the core in the recorded mode
+      sm.command(CommandType::Stop);
+      core.tick(clockNow_ms(), sm.getTelemetry());
+
+      Program p = sm.getProgram();
+      p.cycles = 65535;   // the recording decides when the run ends
+      p.startMode = (phase == (int)Phase::Charge) ? Mode::Charge : Mode::Discharge;
+      sm.setProgram(p);
+      sm.command(CommandType::Start);
+
+      segPhase = phase;
+      segFired = false;
+      st.segments++;
+    }
+
+    if (!haveT0) {
+      t0_s = t_s;
+      haveT0 = true;
+    }
+    const uint32_t rel_s = (t_s > t0_s) ? t_s - t0_s : 0;
+    hostClockSet_us(base_us + (uint64_t)rel_s * 1000000ULL);
+    hw.injectSample(u, i);
+
+    if (segPhase >= 0 && !segFired) {
+      const Phase before = core.phase();
+      const bool wasRunning = core.runState() != RunState::Off;
+      core.tick(clockNow_ms(), sm.getTelemetry());
+
+      if (wasRunning && core.phase() != before &&
+          (before == Phase::Charge || before == Phase::Discharge)) {
+        segFired = true;
+        if (before == Phase::Charge) {
+          printf("%s,%lu,%lu,stop,charge,%.4f,%.4f,%s\n", path, row, (unsigned long)t_s,
+                 core.lastChargeEnergy_Wh(), core.lastChargeCharge_Ah(),
+                 chargeStopReasonName(core.lastChargeStopReason()));
+        } else {
+          printf("%s,%lu,%lu,stop,discharge,%.4f,%.4f,voltage\n", path, row, (unsigned long)t_s,
+                 core.lastDischargeEnergy_Wh(), core.lastDischargeCharge_Ah());
+        }
+      }
+    }
+
+    lastRow = row;
+    lastTime_s = t_s;
+    lastRecordedWh = (cols.e >= 0 && n > cols.e) ? strtof(fld[cols.e], nullptr) : NAN;
+  }
+  closeSegment();
+
+  st.rows += row;
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  CoreConfig cfg;
+  int firstFile = argc;
+
+  for (int a = 1; a < argc; ++a) {
+    if (!strcmp(argv[a], "--set") && a + 1 < argc) {
+      if (!applySetting(cfg, argv[++a])) {
+        fprintf(stderr, "unknown setting: %s\n", argv[a]);
+        return 2;
+      }
+    } else {
+      firstFile = a;
+      break;
+    }
+  }
+
+  if (firstFile >= argc) {
+    fprintf(stderr, "usage: %s [--set key=value]... log.csv [log2.csv ...]\n", argv[0]);
+    return 2;
+  }
+
+  printf("file,row,time_s,event,phase,wh,ah,reason\n");
+
+  ReplayStats st;
+  int failed = 0;
+  const auto wall0 = std::chrono::steady_clock::now();
+  for (int a = firstFile; a < argc; ++a) {
+    if (!replayFile(argv[a], cfg, st)) failed++;
+  }
+  const double wall_s =
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - wall0).count();
+
+  fprintf(stderr, "replayed %d file(s), %lu rows, %lu segments in %.3f ms (%.3g rows/s)\n",
+          argc - firstFile - failed, st.rows, st.segments, wall_s * 1e3,
+          (wall_s > 0) ? st.rows / wall_s : 0.0);
+  return failed ? 1 : 0;
+}
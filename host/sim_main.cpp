@@ -0,0 +1,198 @@
+// Host runner: complete multi-cycle program against the simulated battery,
+// driven by the virtual clock (jumps straight to the next core sample).
+//
+//   pio run -e native && .pio/build/native/program --cycles 20 --csv log.csv
+//
+// Reports wall time, samples per second, speed-up and final Wh / Ah.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "Arduino.h"
+#include "config.h"
+#include "hw.h"
+#include "state_machine.h"
+#include "core.h"
+#include "log_buffer.h"
+#include "sampler.h"
+#include "cycle_table.h"
+#include "sequencer.h"
+#include "clock.h"
+
+// Print sink for the CSV export
+class FilePrint : public Print {
+public:
+  explicit FilePrint(FILE* f) : f_(f) {}
+  size_t write(uint8_t c) override { return (fputc(c, f_) == EOF) ? 0 : 1; }
+  size_t write(const uint8_t* buf, size_t len) override { return fwrite(buf, 1, len, f_); }
+private:
+  FILE* f_;
+};
+
+static void usage(const char* exe) {
+  printf("usage: %s [--cycles N] [--start charge|discharge] [--max-days D] [--csv FILE]\n"
+         "          [--cycle-csv FILE] [--program FILE.json]\n", exe);
+}
+
+int main(int argc, char** argv) {
+  uint16_t cycles = 5;
+  Mode startMode = Mode::Charge;
+  double maxDays = 365.0;   // safety stop for runaway programs
+  const char* csvPath = nullptr;
+  const char* cycleCsvPath = nullptr;
+  const char* programPath = nullptr;
+
+  for (int a = 1; a < argc; ++a) {
+    if (!strcmp(argv[a], "--cycles") && a + 1 < argc) {
+      cycles = (uint16_t)atoi(argv[++a]);
+    } else if (!strcmp(argv[a], "--start") && a + 1 < argc) {
+      startMode = !strcmp(argv[++a], "discharge") ? Mode::Discharge : Mode::Charge;
+    } else if (!strcmp(argv[a], "--max-days") && a + 1 < argc) {
+      maxDays = atof(argv[++a]);
+    } else if (!strcmp(argv[a], "--csv") && a + 1 < argc) {
+      csvPath = argv[++a];
+    } else if (!strcmp(argv[a], "--cycle-csv") && a + 1 < argc) {
+      cycleCsvPath = argv[++a];
+    } else if (!strcmp(argv[a], "--program") && a + 1 < argc) {
+      programPath = argv[++a];
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  // Same wiring as main.cpp
+  static Hw hw;
+  static StateMachine sm(hw);
+  static Core core(hw, sm);
+  static uint8_t logMem[kLogRamBytes];
+  static LogBuffer log(logMem, sizeof(logMem), kLogSchema, kLogSchemaCols);
+  static Sampler sampler(sm, core, log);
+  static CycleTable cycleTable;
+  static CycleRecord cycleMem[kCycleTableSlots];
+  static Sequencer seq;
+
+  hw.begin();
+  core.setConfig(CoreConfig());
+  cycleTable.setStorage(cycleMem, kCycleTableSlots);
+  core.attachCycleTable(&cycleTable);
+  core.attachSequencer(&seq);
+
+  Program p;
+  p.cycles = cycles;
+  p.startMode = startMode;
+  p.stopMode = (startMode == Mode::Charge) ? Mode::Discharge : Mode::Charge;
+
+  // Step table (same JSON as POST /api/program) instead of the classic loop
+  if (programPath) {
+    static char json[8192];
+    FILE* f = fopen(programPath, "r");
+    if (!f) {
+      printf("cannot read %s\n", programPath);
+      return 1;
+    }
+    json[fread(json, 1, sizeof(json) - 1, f)] = '\0';
+    fclose(f);
+
+    static StepProgram prog;
+    char err[96];
+    if (!stepProgramFromJson(json, prog, err, sizeof(err)) || !seq.load(prog, err, sizeof(err))) {
+      printf("%s: %s\n", programPath, err);
+      return 1;
+    }
+    p.stepTable = true;
+  }
+  sm.setProgram(p);
+  sm.command(CommandType::Start);
+
+  // Totals over all completed phases
+  double chargeWh = 0.0, chargeAh = 0.0, dischargeWh = 0.0, dischargeAh = 0.0;
+  uint32_t chargePhases = 0, dischargePhases = 0;
+
+  const uint64_t maxSim_us = (uint64_t)(maxDays * 86400.0 * 1e6);
+  bool started = false;
+  bool timedOut = false;
+
+  const auto wall0 = std::chrono::steady_clock::now();
+
+  for (;;) {
+    hostClockSet_us(sampler.nextDue_ms() * 1000ULL);
+    if (hostClockNow_us() > maxSim_us) {
+      timedOut = true;
+      break;
+    }
+
+    const Phase before = core.phase();
+    const uint16_t phasesBefore = sm.getTelemetry().phaseCount;
+    if (!sampler.service(clockNow_ms())) continue;
+
+    if (core.runState() != RunState::Off) started = true;
+
+    // Phase completed in this sample? (step tables may chain two discharges)
+    if (sm.getTelemetry().phaseCount != phasesBefore) {
+      if (before == Phase::Charge) {
+        chargeWh += core.lastChargeEnergy_Wh();
+        chargeAh += core.lastChargeCharge_Ah();
+        chargePhases++;
+      } else if (before == Phase::Discharge) {
+        dischargeWh += core.lastDischargeEnergy_Wh();
+        dischargeAh += core.lastDischargeCharge_Ah();
+        dischargePhases++;
+      }
+    }
+
+    if (started && core.runState() == RunState::Off) break;
+  }
+
+  const auto wall1 = std::chrono::steady_clock::now();
+  const double wall_s = std::chrono::duration<double>(wall1 - wall0).count();
+  const double sim_s = (double)hostClockNow_us() / 1e6;
+  const Telemetry t = sm.getTelemetry();
+
+  printf("\n=== host simulation ===\n");
+  printf("result            : %s\n", timedOut ? "TIMEOUT (max-days reached)" : "program finished");
+  printf("completed cycles  : %u (phases %u)\n", t.completedCycles, t.phaseCount);
+  printf("simulated time    : %.2f h\n", sim_s / 3600.0);
+  printf("wall time         : %.3f ms\n", wall_s * 1e3);
+  printf("speed-up          : %.3g x real time\n", (wall_s > 0) ? sim_s / wall_s : 0.0);
+  printf("core samples      : %lu (%.3g samples/s wall)\n",
+         (unsigned long)sampler.sampleCount(),
+         (wall_s > 0) ? sampler.sampleCount() / wall_s : 0.0);
+  printf("log rows          : %lu (buffer %u / %u)\n",
+         (unsigned long)sampler.rowCount(), (unsigned)log.size(), (unsigned)log.capacity());
+  printf("last charge       : %.3f Wh  %.3f Ah  (%s)\n",
+         core.lastChargeEnergy_Wh(), core.lastChargeCharge_Ah(),
+         chargeStopReasonName(core.lastChargeStopReason()));
+  printf("last discharge    : %.3f Wh  %.3f Ah\n",
+         core.lastDischargeEnergy_Wh(), core.lastDischargeCharge_Ah());
+  printf("total charge      : %.3f Wh  %.3f Ah  (%u phases)\n", chargeWh, chargeAh, chargePhases);
+  printf("total discharge   : %.3f Wh  %.3f Ah  (%u phases)\n", dischargeWh, dischargeAh, dischargePhases);
+
+  if (csvPath) {
+    FILE* f = fopen(csvPath, "w");
+    if (!f) {
+      printf("cannot write %s\n", csvPath);
+      return 1;
+    }
+    FilePrint fp(f);
+    log.printCsv(fp);
+    fclose(f);
+    printf("csv               : %s\n", csvPath);
+  }
+
+  if (cycleCsvPath) {
+    FILE* f = fopen(cycleCsvPath, "w");
+    if (!f) {
+      printf("cannot write %s\n", cycleCsvPath);
+      return 1;
+    }
+    FilePrint fp(f);
+    cycleTable.printCsv(fp);
+    fclose(f);
+    printf("cycle csv         : %s (%u cycles)\n", cycleCsvPath, (unsigned)cycleTable.size());
+  }
+
+  return timedOut ? 1 : 0;
+}
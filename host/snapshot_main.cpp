@@ -0,0 +1,144 @@
+// Host check: LogBuffer snapshot reads while another thread keeps logging.
+//
+//   pio run -e native_snapshot && .pio/build/native_snapshot/program --exports 3000
+//
+// A writer thread stores rows as fast as it can; every cell of row s is
+// derived from s, so a row mixed from two writes shows up as a mismatch.
+// The main thread exports pinned snapshots with printCsv() and reads them
+// again with readRow(). Expected: no torn or out-of-order rows, rows the
+// ring overwrote in the meantime reported as lost. Exit code 0 if so.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "Arduino.h"
+#include "config.h"
+#include "log_buffer.h"
+
+// Cells of row s (schema order of kLogSchema)
+static void makeRow(uint32_t s, ColValue* v) {
+  v[0].u32 = s;
+  v[1].u16 = (uint16_t)(s & 0xFFFF);
+  v[2].u8  = (uint8_t)(s & 0xFF);
+  v[3].u8  = (uint8_t)((s >> 8) & 0xFF);
+  v[4].f32 = (float)(s % 1000) * 0.5f;
+  v[5].f32 = (float)(s % 777) * 0.25f;
+  v[6].f32 = (float)(s % 333);
+  v[7].f32 = (float)(s % 555);
+}
+
+// Parses the exported CSV and checks each row against makeRow()
+class CheckPrint : public Print {
+public:
+  size_t write(uint8_t c) override {
+    if (c != '\n') {
+      line_ += (char)c;
+      return 1;
+    }
+    if (header_) header_ = false;
+    else checkLine_();
+    line_.clear();
+    return 1;
+  }
+
+  unsigned long rows = 0;
+  unsigned long bad = 0;
+  long last = -1;   // Time_s of the last row
+
+private:
+  std::string line_;
+  bool header_ = true;
+
+  void checkLine_() {
+    rows++;
+    unsigned long t;
+    unsigned cy, ph, st;
+    double f[4];
+    if (sscanf(line_.c_str(), "%lu,%u,%u,%u,%lf,%lf,%lf,%lf",
+               &t, &cy, &ph, &st, &f[0], &f[1], &f[2], &f[3]) != 8) {
+      bad++;
+      return;
+    }
+    ColValue v[kLogSchemaCols];
+    makeRow((uint32_t)t, v);
+    bool ok = cy == v[1].u16 && ph == v[2].u8 && st == v[3].u8 && (long)t > last;
+    for (int k = 0; k < 4; ++k) {
+      if (fabs(f[k] - v[4 + k].f32) > 0.01) ok = false;
+    }
+    if (!ok) bad++;
+    last = (long)t;
+  }
+};
+
+int main(int argc, char** argv) {
+  unsigned long exports = 3000;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--exports") && i + 1 < argc) {
+      exports = strtoul(argv[++i], nullptr, 10);
+    } else {
+      printf("usage: %s [--exports N]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  // Small ring, so it wraps many times during one export
+  static uint8_t mem[4096];
+  LogBuffer log(mem, sizeof(mem), kLogSchema, kLogSchemaCols);
+
+  std::atomic<bool> stop{false};
+  std::thread writer([&] {
+    ColValue v[kLogSchemaCols];
+    for (uint32_t s = 0; !stop.load(std::memory_order_relaxed); ++s) {
+      makeRow(s, v);
+      log.store(v, kLogSchemaCols);
+    }
+  });
+  while (log.nextSeq() < 2 * log.capacity()) std::this_thread::yield();
+
+  unsigned long csvRows = 0, csvBad = 0, lost = 0;
+  unsigned long reads = 0, readsOk = 0, readsBad = 0;
+  for (unsigned long x = 0; x < exports; ++x) {
+    const LogSnapshot snap = log.snapshot();
+    LogQuery q;
+    q.pin(snap);
+
+    CheckPrint csv;
+    lost += log.printCsv(csv, q);
+    csvRows += csv.rows;
+    csvBad += csv.bad;
+    if (csv.last >= (long)snap.end) csvBad++;   // row from after the snapshot
+
+    ColValue v[kLogSchemaCols], want[kLogSchemaCols];
+    for (uint32_t s = snap.first; s != snap.end; ++s) {
+      reads++;
+      if (!log.readRow(s, v, kLogSchemaCols)) continue;
+      readsOk++;
+      makeRow(s, want);
+      bool ok = v[0].u32 == want[0].u32 && v[1].u16 == want[1].u16 &&
+                v[2].u8 == want[2].u8 && v[3].u8 == want[3].u8;
+      for (int k = 4; k < 8; ++k) {
+        if (v[k].f32 != want[k].f32) ok = false;
+      }
+      if (!ok) readsBad++;
+    }
+  }
+
+  stop.store(true);
+  writer.join();
+
+  printf("rows stored       : %lu (capacity %u)\n", (unsigned long)log.nextSeq(),
+         (unsigned)log.capacity());
+  printf("printCsv          : %lu exports, %lu rows, %lu lost, %lu bad\n",
+         exports, csvRows, lost, csvBad);
+  printf("readRow           : %lu reads, %lu ok, %lu bad\n", reads, readsOk, readsBad);
+
+  const bool pass = csvBad == 0 && readsBad == 0;
+  printf("consistent        : %s\n", pass ? "yes" : "NO");
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+// Host check: LogBuffer window statistics against a full scan.
+//
+//   pio run -e native_stats && .pio/build/native_stats/program --rows 2000000
+//
+// Stores random rows (NaN cells, restarts and gaps, phase changes) into
+// small buffers of both layouts and compares count / mean / min / max,
+// window charge / discharge energy and span with a brute-force pass over the
+// held rows after every few stores and at the end. Exit code 0 if all of
+// them agree.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include "Arduino.h"
+#include "config.h"
+#include "log_buffer.h"
+
+// Column numbers of kLogSchema
+enum : size_t { kTime = 0, kCycle = 1, kPhase = 2, kStatus = 3, kU = 4, kI = 5, kE = 6, kR = 7 };
+
+// Phase values of the energy split (as Phase::Charge / Phase::Discharge)
+static constexpr uint8_t kChargePhase = 0, kDischargePhase = 2;
+
+struct Check {
+  unsigned long compares = 0;
+  unsigned long bad = 0;
+};
+
+// Full scan of the held rows, same rules as the running statistics
+static void compare(const LogBuffer& log, Check& ck, unsigned long k) {
+  std::vector<ColValue> rows;
+  ColValue v[kLogSchemaCols];
+  for (uint32_t s = log.oldestSeq(); s != log.nextSeq(); ++s) {
+    if (!log.readRow(s, v, kLogSchemaCols)) continue;
+    rows.insert(rows.end(), v, v + kLogSchemaCols);
+  }
+  const size_t n = rows.size() / kLogSchemaCols;
+  auto at = [&](size_t r, size_t c) -> const ColValue& { return rows[r * kLogSchemaCols + c]; };
+
+  ck.compares++;
+  for (size_t c : {kU, kI, kE, kR}) {
+    double sum = 0;
+    uint32_t cnt = 0;
+    float lo = INFINITY, hi = -INFINITY;
+    for (size_t r = 0; r < n; ++r) {
+      const float x = at(r, c).f32;
+      if (isnan(x)) continue;
+      sum += x;
+      cnt++;
+      if (x < lo) lo = x;
+      if (x > hi) hi = x;
+    }
+
+    ColStats st;
+    log.colStats(c, st);
+    const double mean = cnt ? sum / cnt : 0.0;
+    const bool tracked = (c == kU || c == kR);
+    bool ok = (st.n == cnt);
+    if (cnt && fabs(st.mean - mean) > 1e-4 * fabs(mean) + 1e-5) ok = false;
+    if (tracked && cnt && (st.min != lo || st.max != hi)) ok = false;
+    if (!tracked && !isnan(st.min)) ok = false;
+    if (!ok) {
+      ck.bad++;
+      printf("row %lu col %s: n %lu/%lu mean %g/%g min %g/%g max %g/%g\n", k, kLogSchema[c].name,
+             (unsigned long)st.n, (unsigned long)cnt, st.mean, mean, st.min, lo, st.max, hi);
+    }
+  }
+
+  double e[2] = {0, 0};
+  for (size_t r = 0; r + 1 < n; ++r) {
+    const float e0 = fabsf(at(r, kE).f32), e1 = fabsf(at(r + 1, kE).f32);
+    if (isnan(e1)) continue;
+    const bool newPhase = isnan(e0) || e1 < e0 || at(r, kCycle).u16 != at(r + 1, kCycle).u16 ||
+                          at(r, kPhase).u8 != at(r + 1, kPhase).u8;
+    const double step = newPhase ? e1 : (double)e1 - e0;
+    if (at(r + 1, kPhase).u8 == kChargePhase) e[0] += step;
+    else if (at(r + 1, kPhase).u8 == kDischargePhase) e[1] += step;
+  }
+  const double got[2] = {log.windowChargeEnergy_Wh(), log.windowDischargeEnergy_Wh()};
+  for (int k2 = 0; k2 < 2; ++k2) {
+    if (fabs(got[k2] - e[k2]) > 1e-4 * fabs(e[k2]) + 1e-3) {
+      ck.bad++;
+      printf("row %lu: %s energy %g, scan %g\n", k, k2 ? "discharge" : "charge", got[k2], e[k2]);
+    }
+  }
+
+  const uint32_t span = n ? at(n - 1, kTime).u32 - at(0, kTime).u32 : 0;
+  if (log.windowSpan_s() != span) {
+    ck.bad++;
+    printf("row %lu: span %lu, scan %lu\n", k, (unsigned long)log.windowSpan_s(), (unsigned long)span);
+  }
+}
+
+static void run(LogLayout layout, size_t bytes, unsigned long rows, Check& ck) {
+  // Odd start address: the deques must align themselves
+  std::vector<uint8_t> mem(bytes + 1);
+  LogBuffer log(mem.data() + 1, bytes, kLogSchema, kLogSchemaCols, layout);
+  const size_t rowsPlain = log.capacity();
+  log.trackEnergy(kTime, kE, kPhase, kChargePhase, kDischargePhase, (1u << kCycle) | (1u << kPhase));
+  log.trackMinMax(kU);
+  log.trackMinMax(kR);
+
+  printf("%s %5u B: capacity %u rows (%u without min/max)\n",
+         layout == LogLayout::ColumnMajor ? "column" : "row   ", (unsigned)bytes,
+         (unsigned)log.capacity(), (unsigned)rowsPlain);
+
+  srand((unsigned)bytes);
+  const unsigned long every = (rows / 500) | 1;
+  uint32_t t = 0;
+  float e = 0;
+  ColValue v[kLogSchemaCols];
+  for (unsigned long k = 0; k < rows; ++k) {
+    // Mostly short steps, now and then a gap of a stopped tester
+    t += (rand() % 200 == 0) ? 3600 : 1 + rand() % 10;
+    const uint16_t cycle = (uint16_t)(1 + k / 1000);
+    const uint8_t phase = (uint8_t)((k / 97) % 4);
+    if (k > 0 && (cycle != v[kCycle].u16 || phase != v[kPhase].u8)) e = 0;
+    if (rand() % 300 == 0) e = 0;                                   // stop, start again
+    if (phase == kChargePhase || phase == kDischargePhase) e += (rand() % 100) * 0.002f;
+    v[kTime].u32 = t;
+    v[kCycle].u16 = cycle;
+    v[kPhase].u8 = phase;
+    v[kStatus].u8 = (rand() % 50 == 0) ? 2 : 1;
+    v[kU].f32 = (k % 500 < 250) ? 12.0f - 0.001f * (float)(k % 7000) / 7.0f + (rand() % 100) * 0.001f
+                                : 10.0f + (rand() % 1000) * 0.003f;
+    v[kI].f32 = (rand() % 10 == 0) ? NAN : -2.0f + (rand() % 100) * 0.01f;
+    v[kE].f32 = (rand() % 100 == 0) ? NAN : e;
+    v[kR].f32 = (rand() % 3 == 0) ? NAN : 40.0f + (float)(rand() % 50);
+    log.store(v, kLogSchemaCols);
+
+    if (k % every == 0 || k + 10 >= rows) compare(log, ck, k);
+  }
+}
+
+int main(int argc, char** argv) {
+  unsigned long rows = 20000;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--rows") && i + 1 < argc) {
+      rows = strtoul(argv[++i], nullptr, 10);
+    } else {
+      printf("usage: %s [--rows N]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  Check ck;
+  for (LogLayout layout : {LogLayout::RowMajor, LogLayout::ColumnMajor}) {
+    for (size_t bytes : {1024u, 3072u, 8192u}) run(layout, bytes, rows, ck);
+  }
+
+  printf("%lu comparisons, %lu mismatches\n", ck.compares, ck.bad);
+  return ck.bad ? 1 : 0;
+}
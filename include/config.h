@@ -2,24 +2,33 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "log.h"
-#include "hw.h"
-
-#include "secrets.h" 
+#include "sim_battery.h"   // SimOcvPoint (simulation parameters below)
+#include "adc_cal.h"       // AdcCalPoint (ADC calibration tables below)
+
+// WiFi credentials live in secrets.h (not versioned). Without it the
+// firmware still builds and simply falls back to AP mode.
+#if __has_include("secrets.h")
+  #include "secrets.h"
+#else
+  inline constexpr const char* kWifiStaSsid = "";
+  inline constexpr const char* kWifiStaPass = "";
+#endif
 
 // =======================
 // Logging configuration
 // =======================
 
+#ifndef BT_LOG_LEVEL
 #define BT_LOG_LEVEL 5   // 1=E,2=W,3=I,4=D,5=V
+#endif
 
 
 // =======================
 // Timing (long-running battery tests)
 // =======================
 
-// How often the core logic samples voltage/current
-// (energy integration, stop conditions)
-inline constexpr uint32_t kCoreSampleInterval_s = 15;//15;
+// The core sampling period (energy integration, stop conditions) is adaptive:
+// see CoreConfig::sampleMin_s / sampleMax_s / sampleNearBand_V in core.h.
 
 // How often a row is stored into the log buffer (CSV resolution)
 inline constexpr uint32_t kLogStoreInterval_s = 15*60;//15 * 60; // 15 minutes
@@ -55,6 +64,48 @@ inline constexpr uint8_t kWifiApGateway[4] = {192, 168, 0, 1};
 inline constexpr uint8_t kWifiApSubnet[4]  = {255, 255, 255, 0};
 
 
+// =======================
+// HTTP
+// =======================
+
+// /api/status is served from a snapshot rendered after each core sample or
+// state change, and at least every kHttpStatusMaxAge_ms (idle display). Its
+// version only moves when the rendered content differs.
+inline constexpr size_t   kHttpStatusBytes     = 1536;
+inline constexpr uint32_t kHttpStatusMaxAge_ms = 1000;
+
+
+// =======================
+// MQTT telemetry (mqtt_publisher.h)
+// =======================
+
+// Broker host name or IP (empty = MQTT off). Only used in STA mode.
+inline constexpr const char* kMqttBroker = "";
+inline constexpr uint16_t    kMqttPort   = 1883;
+inline constexpr const char* kMqttUser   = "";   // empty = anonymous
+inline constexpr const char* kMqttPass   = "";
+
+// Topics: <root>/<device id>/{online,schema,samples,cycles}
+// Device id empty = "bt-" + the last 3 MAC bytes (unique per tester)
+inline constexpr const char* kMqttTopicRoot = "batterytester";
+inline constexpr const char* kMqttDeviceId  = "";
+
+// Batching: one samples message per kMqttBatchRows log rows, or with what
+// is there once the oldest unsent row is kMqttBatchMaxAge_ms old.
+inline constexpr uint8_t  kMqttBatchRows      = 10;
+inline constexpr uint32_t kMqttBatchMaxAge_ms = 10000;
+inline constexpr size_t   kMqttPayloadBytes   = 1024;
+// Built messages waiting for the broker (power of two). While the broker
+// is down the rows behind the queue wait in the log buffer.
+inline constexpr size_t   kMqttQueueMsgs      = 8;
+
+// Reconnect backoff (doubles per failed attempt)
+inline constexpr uint32_t kMqttRetryMin_ms    = 2000;
+inline constexpr uint32_t kMqttRetryMax_ms    = 60000;
+inline constexpr uint32_t kMqttTaskStack      = 4096;
+inline constexpr uint8_t  kMqttTaskPriority   = 1;   // same as loop()
+
+
 // =======================
 // measurement buffer
 // =======================
@@ -62,6 +113,12 @@ inline constexpr uint8_t kWifiApSubnet[4]  = {255, 255, 255, 0};
 // Log schema config (names + types define the row layout and CSV header).
 enum class ColType : uint8_t { U8, U16, U32, F32 };
 
+// LogBuffer storage order:
+// - RowMajor:    packed rows one after another (one row = one write)
+// - ColumnMajor: one ring segment per column, so a column scan (min/max,
+//                series for a chart) reads contiguous cells only
+enum class LogLayout : uint8_t { RowMajor, ColumnMajor };
+
 struct ColDef {
   const char* name;
   ColType type;
@@ -76,20 +133,71 @@ inline constexpr ColDef kLogSchema[] = {
   {"U_V",       ColType::F32},
   {"I_A",       ColType::F32},
   {"Ephase_Wh", ColType::F32},
+  {"R_mOhm",    ColType::F32},   // last internal resistance (NaN until measured)
 };
 
 inline constexpr size_t kLogSchemaCols = sizeof(kLogSchema) / sizeof(kLogSchema[0]);
 
-// RAM budget for log buffer (adjust as needed).
+// Log RAM of the host tools (fixed array).
 inline constexpr size_t kLogRamBytes = 64 * 1024;
 
+// Layout of the firmware log (same capacity and CSV output either way)
+inline constexpr LogLayout kLogLayout = LogLayout::RowMajor;
+
+// Window statistics over the held log rows (/api/status "window"): mean of
+// every F32 column and the charge / discharge energy of the window are kept
+// for free. Min/max needs 8 B per log row and column (e.g. {"U_V"}: 1/4
+// fewer log rows), so none by default (nullptr = none).
+inline constexpr const char* kLogStatsMinMaxCols[] = {nullptr};
+
+// Firmware: one arena is allocated at the end of setup() (WiFi, HTTP and the
+// tasks are up by then) from the largest free heap block minus a reserve for
+// what WiFi / HTTP / MQTT allocate at runtime. Cycle table, phase index,
+// capture buffer and MQTT queue are carved from it, the log buffer gets the
+// rest.
+inline constexpr size_t kRamReserveBytes  = 48 * 1024;
+inline constexpr size_t kRamArenaMinBytes = 24 * 1024;    // below: retry smaller, then give up
+inline constexpr size_t kRamArenaMaxBytes = 256 * 1024;
+
+// Per-cycle summaries (CycleTable), kept apart from the raw rows (~56 B each)
+inline constexpr size_t kCycleTableSlots = 128;
+
+// Cycle / phase boundaries of the log rows (PhaseIndex, 12 B each)
+inline constexpr size_t kPhaseIndexSlots = 256;
+
+// What-if stop criteria evaluated next to the active config (ShadowEvaluator)
+inline constexpr uint8_t kShadowSlots = 4;
+
+// Step table programs (Sequencer): max. steps incl. loop steps (~40 B each)
+inline constexpr uint8_t kProgramMaxSteps = 32;
+
+// Persistent settings (ConfigStore, NVS): active CoreConfig + Program and
+// named profiles, e.g. one per chemistry. Bump the version whenever the
+// stored field list (config_store.cpp) changes (older blobs are then ignored).
+inline constexpr uint8_t  kConfigProfiles       = 4;
+inline constexpr size_t   kConfigProfileNameLen = 16;   // incl. terminator
+inline constexpr uint16_t kConfigBlobVersion    = 2;
+
 
 // =======================
 //  HW config
 // =======================
 
+// Switches can be overridden via build_flags (e.g. host build: -DHW_USE_INA219=0)
+#ifndef HW_USE_RELAIS
 #define HW_USE_RELAIS          1  // 0 = off, 1 = on, can be switched off for testing
+#endif
+#ifndef HW_USE_INA219
 #define HW_USE_INA219          1  // 0 = off, 1 = on
+#endif
+
+// Sensor backend, fixed at compile time (see hw_backends.h).
+// Default follows the older switches: replay > simulation > INA219 > ADC.
+#define HW_SENSOR_INA219 1
+#define HW_SENSOR_INA226 2
+#define HW_SENSOR_ADC    3
+#define HW_SENSOR_SIM    4
+#define HW_SENSOR_REPLAY 5
 
 // INA219 -------------------------------------------------------
 inline constexpr uint8_t  kHwIna219Addr       = 0x40;
@@ -99,6 +207,21 @@ inline constexpr int      kHwInaI2cSclPin     = 9;
 // 0 = 32V/2A, 1 = 32V/1A, 2 = 16V/400mA
 inline constexpr uint8_t  kHwInaCalPreset = 0;
 
+// I2C clock for the INA219 / INA226 (both allow 400 kHz fast mode)
+inline constexpr uint32_t kHwI2cClock_Hz      = 400000;
+
+// Triggered conversions (transient capture, acquisition.h): shunt value of
+// the module (current from the shunt register) and the config register used
+// while capturing: 32 V, /8 gain, 9-bit bus + shunt (84 us each), triggered.
+inline constexpr float    kHwIna219Shunt_Ohm  = 0.1f;
+inline constexpr uint16_t kHwIna219AcqConfig  = 0x3803;
+
+// INA226 (HW_SENSOR=HW_SENSOR_INA226, same I2C pins) ----------
+inline constexpr uint8_t  kHwIna226Addr       = 0x40;
+inline constexpr float    kHwIna226Shunt_Ohm  = 0.1f;
+// Config register: 16 averages, 1.1 ms bus + shunt conversion, continuous
+inline constexpr uint16_t kHwIna226Config     = 0x4527;
+
 // Outputs (Relais / MOSFET) -----------------------------------
 inline constexpr int kHwChargePin    = 5;
 inline constexpr int kHwDischargePin = 6;
@@ -107,35 +230,128 @@ inline constexpr bool kHwChargeActiveHigh    = false;
 inline constexpr bool kHwDischargeActiveHigh = false;
 
 // ADC fallback (optional) -------------------------------------
+// ADC1 pins (GPIO0..4 on the ESP32-C3). Both channels are sampled
+// continuously by DMA and decimated by block averaging in the "adc" task,
+// so a read only returns the latest filtered value (no busy-waiting).
 inline constexpr int kHwVoltageAdcPin = -1;
 inline constexpr int kHwCurrentAdcPin = -1;
-
-// Calibration -------------------------------------------------
-inline constexpr float kHwVoltageScale  = 1.0f;
-inline constexpr float kHwVoltageOffset = 0.0f;
-inline constexpr float kHwCurrentScale  = 1.0f;
-inline constexpr float kHwCurrentOffset = 0.0f;
+inline constexpr uint32_t kHwAdcSampleRate_Hz = 20000;   // both channels together
+inline constexpr uint16_t kHwAdcOversample    = 64;      // raw samples per value and channel
+inline constexpr uint32_t kHwAdcTaskStack     = 3072;
+inline constexpr uint8_t  kHwAdcTaskPriority  = 4;       // below the safety task
+
+// Internal resistance pulse (Hw::beginLoadStep/endLoadStep) ---
+// Relay settle time before the post-step samples (Core waits it out across
+// ticks), samples per side and their spacing (>= one INA219 conversion of
+// shunt + bus, ~1.1 ms at 12 bit).
+inline constexpr uint32_t kIrSettle_us        = 100000;
+inline constexpr uint8_t  kIrSamples          = 4;
+inline constexpr uint32_t kIrSampleSpacing_us = 1200;
+// Minimum current step for a valid R = dV/dI
+inline constexpr float    kIrMinDeltaI_A      = 0.05f;
+
+// Safety monitor (safety.h) -----------------------------------
+// Hard limits on raw samples, checked in their own task independent of the
+// adaptive core period. Armed only while the charger or the load is on.
+inline constexpr float    kSafetyMaxVoltage_V    = 15.0f;
+inline constexpr float    kSafetyMinVoltage_V    = 10.5f;
+inline constexpr float    kSafetyMaxCurrent_A    = 2.5f;
+inline constexpr uint8_t  kSafetyDebounceSamples = 3;      // consecutive samples beyond a limit
+inline constexpr uint32_t kSafetyPeriod_ms       = 10;     // 100 Hz
+inline constexpr uint32_t kSafetyTaskStack       = 3072;
+inline constexpr uint8_t  kSafetyTaskPriority    = 6;      // highest of our tasks, nothing starves it
+
+// Transient capture (acquisition.h) ---------------------------
+// A hardware timer starts one sensor conversion per period; the result is
+// read with the trigger timestamp one period later (the conversion is done
+// by then, kAcqMinPeriod_us > 2 x 84 us), independent of loop() load. The capture buffer holds one burst (16 bytes per sample, from
+// the boot arena).
+inline constexpr uint32_t kAcqMinPeriod_us       = 500;
+inline constexpr uint32_t kAcqDefaultPeriod_us   = 1000;   // 1 kHz
+inline constexpr size_t   kAcqCaptureSamples     = 2048;
+inline constexpr uint8_t  kAcqTimer              = 0;      // hardware timer index
+inline constexpr uint32_t kAcqTaskStack          = 3072;
+inline constexpr uint8_t  kAcqTaskPriority       = 5;      // below the safety task
+
+// Calibration (ADC fallback) ----------------------------------
+// Pin voltage in mV (already corrected with the eFuse ADC calibration) ->
+// measured value, piecewise linear, ascending pin_mV. Add points measured
+// against a reference meter to correct divider, shunt amplifier and the
+// remaining ADC nonlinearity. Default: the pin voltage in V / A. Note the
+// old scale/offset path (kHwVoltageScale etc.) multiplied the normalized
+// code raw / 4095 (0..1), not the pin voltage; a former scale s corresponds
+// to the table {0, 0}, {full-scale pin mV, s}.
+inline constexpr AdcCalPoint kHwVoltageCal[] = {
+  {   0.0f, 0.0f},
+  {2500.0f, 2.5f},
+};
+inline constexpr AdcCalPoint kHwCurrentCal[] = {
+  {   0.0f, 0.0f},
+  {2500.0f, 2.5f},
+};
 
 
 // =======================
 //  HW Simulation 
 // =======================
 
+#ifndef HW_SIM_MEASUREMENTS
 #define HW_SIM_MEASUREMENTS    0  // 0 = off, 1 = on
+#endif
+
+// Replay backend (host replay tool): V/I come from Hw::injectSample()
+#ifndef HW_REPLAY_MEASUREMENTS
+#define HW_REPLAY_MEASUREMENTS 0  // 0 = off, 1 = on
+#endif
+
+#ifndef HW_SENSOR
+  #if HW_REPLAY_MEASUREMENTS
+    #define HW_SENSOR HW_SENSOR_REPLAY
+  #elif HW_SIM_MEASUREMENTS
+    #define HW_SENSOR HW_SENSOR_SIM
+  #elif HW_USE_INA219
+    #define HW_SENSOR HW_SENSOR_INA219
+  #else
+    #define HW_SENSOR HW_SENSOR_ADC
+  #endif
+#endif
+
+// Simulation parameters (equivalent-circuit model, see sim_battery.h) ----
+
+// Open-circuit voltage vs. state of charge. 4S LiFePO4-like curve, shaped so
+// the default CoreConfig thresholds (14.5 V charge, 12.2 V discharge) are hit
+// near full / near empty. The last point equals the charger CV voltage, so the
+// charge current tapers towards zero at 100 %.
+inline constexpr SimOcvPoint kSimOcvTable[] = {
+  {0.00f, 10.00f},
+  {0.02f, 11.60f},
+  {0.05f, 12.20f},
+  {0.10f, 12.80f},
+  {0.20f, 13.00f},
+  {0.40f, 13.15f},
+  {0.60f, 13.25f},
+  {0.80f, 13.35f},
+  {0.90f, 13.45f},
+  {0.95f, 13.60f},
+  {0.98f, 13.90f},
+  {1.00f, 14.60f},
+};
 
-// Simulation parameters --------------------------------------
-inline constexpr float SIM_START_V  = 12.0f;   // start at 12 V
-
-// Voltage gradients (V per second)
-inline constexpr float kSimCharge_vps    = 0.01f;
-inline constexpr float kSimDischarge_vps = 0.01f;
+inline constexpr float kSimCapacity_Ah = 2.0f;
+inline constexpr float kSimStartSoc    = 0.5f;
 
-// Voltage limits (clamp)
-inline constexpr float kSimVmin    = 9.0f;
-inline constexpr float kSimVmax    = 14.6f;
+// Thevenin elements (tau = R1 * C1 = 60 s)
+inline constexpr float kSimR0_Ohm = 0.05f;
+inline constexpr float kSimR1_Ohm = 0.03f;
+inline constexpr float kSimC1_F   = 2000.0f;
 
-// Dummy currents (A)
+// Charger (CC/CV) and load (CC)
+inline constexpr float kSimChargerCv_V        = 14.6f;
 inline constexpr float kSimCurrentCharge_A    = 1.5f;
 inline constexpr float kSimCurrentDischarge_A = 1.0f;
-inline constexpr float kSimCurrentIdle_A      = 0.02f;
+inline constexpr float kSimCurrentIdle_A      = 0.0f;   // standby drain, outputs off
 
+// Measurement noise (1 sigma) and PRNG seed
+inline constexpr float    kSimNoise_V = 0.002f;
+inline constexpr float    kSimNoise_A = 0.002f;
+inline constexpr uint32_t kSimSeed    = 12345;
@@ -0,0 +1,208 @@
+#include "acquisition.h"
+#include <Arduino.h>
+#include <stdio.h>
+#include "log.h"
+#include "hw.h"
+#include "metrics.h"
+#include "clock.h"
+
+[[maybe_unused]] static const char* TAG = "ACQ"; // For BT_LOG*
+
+#ifndef BT_HOST
+// Timer ISR -> task (one timer, one instance)
+static Acquisition* g_instance = nullptr;
+#endif
+
+Acquisition::Acquisition(Hw& hw) : hw_(hw) {}
+
+void Acquisition::setStorage(AcqSample* buf, size_t n) {
+  capture_ = buf;
+  capacity_ = buf ? n : 0;
+  size_ = 0;
+}
+
+void Acquisition::begin() {
+#ifndef BT_HOST
+  g_instance = this;
+
+  TaskHandle_t handle = nullptr;
+  if (xTaskCreate(taskMain_, "acq", kAcqTaskStack, this,
+                  kAcqTaskPriority, &handle) != pdPASS) {
+    BT_LOGE(TAG, "acquisition task not started");
+    return;
+  }
+  task_ = handle;
+  metricsRegisterTask("acq", handle);
+
+  // 1 MHz timer tick (80 MHz APB / 80); the alarm is armed by start()
+  hw_timer_t* timer = timerBegin(kAcqTimer, 80, true);
+  timerAttachInterrupt(timer, onTimer_, true);
+  timer_ = timer;
+#endif
+}
+
+void IRAM_ATTR Acquisition::onTimer_() {
+#ifndef BT_HOST
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR((TaskHandle_t)g_instance->task_, &woken);
+  if (woken) portYIELD_FROM_ISR();
+#endif
+}
+
+void Acquisition::taskMain_(void* arg) {
+#ifndef BT_HOST
+  Acquisition* self = static_cast<Acquisition*>(arg);
+
+  for (;;) {
+    // Several pending notifications = periods missed while busy
+    const uint32_t ticks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    self->timerTick(ticks);
+  }
+#else
+  (void)arg;
+#endif
+}
+
+bool Acquisition::start(uint32_t period_us, uint32_t samples, char* err, size_t errLen) {
+  if (active_) {
+    snprintf(err, errLen, "capture already running");
+    return false;
+  }
+  if (period_us < kAcqMinPeriod_us) {
+    snprintf(err, errLen, "period_us must be >= %lu", (unsigned long)kAcqMinPeriod_us);
+    return false;
+  }
+  if (capacity_ == 0) {
+    snprintf(err, errLen, "no capture buffer");
+    return false;
+  }
+  if (samples == 0 || samples > capacity_) {
+    snprintf(err, errLen, "samples must be 1..%u", (unsigned)capacity_);
+    return false;
+  }
+#ifndef BT_HOST
+  if (!task_ || !timer_) {
+    snprintf(err, errLen, "acquisition not available");
+    return false;
+  }
+#endif
+
+  // The task is out of timerTick() (drain() waited for it), so the burst
+  // state is ours
+  ring_.clear();
+  size_ = 0;
+  period_us_ = period_us;
+  requested_ = samples;
+  slot_ = 0;
+  pending_ = false;
+  missed_.store(0);
+  dropped_.store(0);
+
+  hw_.beginTriggered();
+  active_ = true;
+  start_us_ = clockNow_us();
+  running_.store(true);
+
+#ifndef BT_HOST
+  hw_timer_t* timer = (hw_timer_t*)timer_;
+  timerWrite(timer, 0);
+  timerAlarmWrite(timer, period_us, true);
+  timerAlarmEnable(timer);
+#endif
+
+  BT_LOGI(TAG, "capture %lu samples every %lu us",
+          (unsigned long)samples, (unsigned long)period_us);
+  return true;
+}
+
+void Acquisition::stop() {
+  if (!running_.load()) return;
+  finish_();
+}
+
+void Acquisition::finish_() {
+#ifndef BT_HOST
+  if (timer_) timerAlarmDisable((hw_timer_t*)timer_);
+#endif
+  running_.store(false);
+}
+
+void Acquisition::timerTick(uint32_t ticks) {
+  // inTick_ before running_ (both seq_cst): drain() sees either the task
+  // still in here or running_ false before the task touched anything
+  inTick_.store(true);
+  if (!running_.load() || ticks == 0) {
+    inTick_.store(false);
+    return;
+  }
+
+  // Result of the previous trigger, its conversion finished a period ago
+  if (pending_) {
+    collect_();
+    pending_ = false;
+  }
+
+  // Skipped periods count as missed samples
+  if (ticks > 1) {
+    missed_.fetch_add(ticks - 1);
+    slot_ += ticks - 1;
+  }
+  if (slot_ < requested_) {
+    pending_ = trigger_(start_us_ + (uint64_t)(slot_ + 1) * period_us_);
+    slot_++;
+  } else {
+    finish_();   // last result collected above
+  }
+  inTick_.store(false);
+}
+
+bool Acquisition::trigger_(uint64_t sched_us) {
+  // Trigger instant = sample timestamp (conversion starts with the write)
+  const uint64_t t_us = clockNow_us();
+  if (!hw_.trigger()) {
+    missed_.fetch_add(1);
+    return false;
+  }
+  const int64_t late_us = (int64_t)(t_us - sched_us);
+  metricsHistogram(MetricId::AcqJitter).record((uint32_t)(late_us < 0 ? -late_us : late_us));
+  pendingSample_.t_us = t_us;
+  return true;
+}
+
+void Acquisition::collect_() {
+  AcqSample& s = pendingSample_;
+  if (!hw_.readTriggered(s.voltage_V, s.current_A)) {
+    missed_.fetch_add(1);
+    return;
+  }
+  if (!ring_.push(s)) dropped_.fetch_add(1);
+}
+
+void Acquisition::drain() {
+  if (!active_) return;
+
+  AcqSample s;
+  while (ring_.pop(s)) {
+    if (size_ < capacity_) capture_[size_++] = s;
+  }
+
+  // Burst over, the task out of timerTick() and everything collected: back
+  // to normal sensor reads (start() may reset the burst state after this)
+  if (!running_.load() && !inTick_.load() && ring_.size() == 0) {
+    active_ = false;
+    hw_.endTriggered();
+    BT_LOGI(TAG, "capture done: %u samples, %lu missed, %lu dropped",
+            (unsigned)size_, (unsigned long)missed_.load(), (unsigned long)dropped_.load());
+  }
+}
+
+void Acquisition::printCsv(Print& out) const {
+  out.print("t_us,U_V,I_A\n");
+  for (size_t k = 0; k < size_; ++k) {
+    const AcqSample& s = capture_[k];
+    out.print((unsigned long)(s.t_us - start_us_)); out.print(',');
+    out.print(s.voltage_V, 3);                     out.print(',');
+    out.print(s.current_A, 4);
+    out.print('\n');
+  }
+}
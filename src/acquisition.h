@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "config.h"
+#include "spsc_ring.h"
+
+class Hw;
+class Print;
+
+// One triggered conversion.
+struct AcqSample {
+  uint64_t t_us = 0;        // trigger instant (clock.h)
+  float voltage_V = 0.0f;
+  float current_A = 0.0f;
+};
+
+// Timer-driven transient capture at up to kHz rates, independent of loop()
+// load and of the adaptive core period:
+// - a hardware timer ISR wakes the acquisition task once per period
+// - the task triggers one sensor conversion and stamps the trigger instant;
+//   the result is read at the next tick (INA219 CNVR bit set by then), so
+//   the task never waits for the sensor and sleeps between ticks
+// - samples reach loop() through a lock-free SPSC ring; drain() copies them
+//   into the capture buffer served by /api/capture
+// Core sampling is unchanged; a capture runs next to it.
+class Acquisition {
+public:
+  explicit Acquisition(Hw& hw);
+
+  // Capture buffer: n samples (boot arena). start() fails without it.
+  void setStorage(AcqSample* buf, size_t n);
+  size_t capacity() const { return capacity_; }
+
+  // Create the task and the hardware timer (target only).
+  void begin();
+
+  // Start one burst of `samples` conversions, one every period_us (loop()).
+  bool start(uint32_t period_us, uint32_t samples, char* err, size_t errLen);
+  void stop();
+
+  // `ticks` timer periods elapsed (task; host tools call it directly).
+  void timerTick(uint32_t ticks);
+
+  // loop(): move queued samples into the capture buffer, close a finished burst.
+  void drain();
+
+  bool active() const { return active_; }   // started and not yet drained
+  size_t size() const { return size_; }
+  const AcqSample& at(size_t k) const { return capture_[k]; }
+  uint64_t start_us() const { return start_us_; }
+  uint32_t period_us() const { return period_us_; }
+  uint32_t requested() const { return requested_; }
+  uint32_t missed() const { return missed_.load(); }     // no result within the period
+  uint32_t dropped() const { return dropped_.load(); }   // ring full
+
+  // t_us relative to the burst start, U_V, I_A
+  void printCsv(Print& out) const;
+
+private:
+  static constexpr size_t kRingSize = 256;
+
+  Hw& hw_;
+  SpscRing<AcqSample, kRingSize> ring_;
+
+  // Burst parameters (written by loop() while the task is idle)
+  uint32_t period_us_ = kAcqDefaultPeriod_us;
+  uint32_t requested_ = 0;
+  uint64_t start_us_ = 0;
+
+  // Task side
+  std::atomic<bool> running_{false};
+  std::atomic<bool> inTick_{false};       // timerTick() touching the burst state
+  uint32_t slot_ = 0;                     // timer periods since start
+  bool pending_ = false;                  // pendingSample_ triggered, not read yet
+  AcqSample pendingSample_;
+  std::atomic<uint32_t> missed_{0};
+  std::atomic<uint32_t> dropped_{0};
+
+  // loop() side
+  bool active_ = false;
+  AcqSample* capture_ = nullptr;
+  size_t capacity_ = 0;
+  size_t size_ = 0;
+
+  void* task_ = nullptr;    // TaskHandle_t
+  void* timer_ = nullptr;   // hw_timer_t*
+
+  bool trigger_(uint64_t sched_us);
+  void collect_();
+  void finish_();
+
+  static void taskMain_(void* arg);
+  static void onTimer_();
+};
@@ -0,0 +1,26 @@
+#pragma once
+#include <stddef.h>
+
+// One point of an ADC calibration table: pin voltage after the eFuse
+// correction -> measured quantity (battery V, A) at that pin voltage.
+struct AdcCalPoint {
+  float pin_mV;
+  float value;
+};
+
+// Piecewise linear through the table (ascending pin_mV). Outside the table
+// the first / last segment is extended, so a reading past the calibrated
+// range stays visible instead of sticking at the end point.
+inline float adcCalApply(const AdcCalPoint* t, size_t n, float pin_mV) {
+  if (!t || n == 0) return pin_mV;
+  if (n == 1) return t[0].value;
+
+  size_t k = 1;
+  while (k + 1 < n && pin_mV > t[k].pin_mV) ++k;
+
+  const AdcCalPoint& a = t[k - 1];
+  const AdcCalPoint& b = t[k];
+  const float span = b.pin_mV - a.pin_mV;
+  if (span <= 0.0f) return a.value;
+  return a.value + (pin_mV - a.pin_mV) / span * (b.value - a.value);
+}
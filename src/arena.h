@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+
+// Bump allocator over one block that lives for the whole run (taken once at
+// boot, never freed). Buffers are carved in order; the last user can take
+// whatever is left (the log). No per-buffer free, no fragmentation.
+class Arena {
+public:
+  void reset(uint8_t* base, size_t bytes) {
+    base_ = base;
+    size_ = base ? bytes : 0;
+    used_ = 0;
+  }
+
+  // n default-constructed T, nullptr if they do not fit.
+  template <class T>
+  T* alloc(size_t n) {
+    const size_t off = alignUp_(used_, alignof(T));
+    if (off > size_ || n > (size_ - off) / sizeof(T)) return nullptr;
+
+    T* p = reinterpret_cast<T*>(base_ + off);
+    for (size_t k = 0; k < n; ++k) new (&p[k]) T();
+    used_ = off + n * sizeof(T);
+    return p;
+  }
+
+  // Everything still free (4-byte aligned); the arena is full afterwards.
+  uint8_t* takeRest(size_t& bytes) {
+    const size_t off = alignUp_(used_, 4);
+    if (off >= size_) {
+      bytes = 0;
+      return nullptr;
+    }
+    bytes = size_ - off;
+    used_ = size_;
+    return base_ + off;
+  }
+
+  size_t size() const { return size_; }
+  size_t used() const { return used_; }
+
+private:
+  uint8_t* base_ = nullptr;
+  size_t size_ = 0;
+  size_t used_ = 0;
+
+  static size_t alignUp_(size_t v, size_t a) { return (v + a - 1) & ~(a - 1); }
+};
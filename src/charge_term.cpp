@@ -0,0 +1,134 @@
+#include "charge_term.h"
+#include "core.h"
+#include <math.h>
+
+const char* chargeStopReasonName(ChargeStopReason r) {
+  switch (r) {
+    case ChargeStopReason::None:    return "none";
+    case ChargeStopReason::Hold:    return "hold";
+    case ChargeStopReason::Taper:   return "taper";
+    case ChargeStopReason::Plateau: return "plateau";
+    case ChargeStopReason::NegDv:   return "negdv";
+    case ChargeStopReason::MaxTime: return "maxtime";
+    case ChargeStopReason::MaxAh:   return "maxah";
+    case ChargeStopReason::Voltage: return "voltage";
+  }
+  return "?";
+}
+
+void ChargeTerm::reset(uint64_t now_ms) {
+  phaseStartMs_ = now_ms;
+
+  aboveActive_ = false;
+  aboveStartMs_ = 0;
+
+  taperArmed_ = false;
+  taperActive_ = false;
+  taperStartMs_ = 0;
+
+  plateauActive_ = false;
+  plateauStartMs_ = 0;
+
+  peakV_ = 0.0f;
+  peakValid_ = false;
+}
+
+// Helper: "condition true continuously for hold_ms" timer.
+static bool heldFor(bool cond, bool& active, uint64_t& startMs,
+                    uint64_t now_ms, uint64_t hold_ms) {
+  if (!cond) {
+    active = false;
+    return false;
+  }
+  if (!active) {
+    active = true;
+    startMs = now_ms;
+  }
+  return (now_ms - startMs) >= hold_ms;
+}
+
+ChargeStopReason ChargeTerm::update(const CoreConfig& cfg, uint64_t now_ms,
+                                    float voltage_V, float current_A,
+                                    float ah, float dvdt_Vps, bool slopeValid) {
+  const float iAbs = fabsf(current_A);
+
+  // ---- Guards ---------------------------------------------------------------
+  if (cfg.termMaxTimeEnabled &&
+      (now_ms - phaseStartMs_) >= cfg.maxChargeTime_s * 1000ULL) {
+    return ChargeStopReason::MaxTime;
+  }
+
+  if (cfg.termMaxAhEnabled && ah >= cfg.maxChargeAh) {
+    return ChargeStopReason::MaxAh;
+  }
+
+  // Invalid reading: only the guards above may fire
+  if (isnan(voltage_V) || isnan(current_A)) {
+    return ChargeStopReason::None;
+  }
+
+  // ---- Hold above voltage (original rule) ----------------------------------
+  if (cfg.termHoldEnabled &&
+      heldFor(voltage_V >= cfg.chargeStopVoltage_V, aboveActive_, aboveStartMs_,
+              now_ms, cfg.chargeHoldAbove_s * 1000ULL)) {
+    return ChargeStopReason::Hold;
+  }
+
+  // ---- Current taper (I < C/n) ---------------------------------------------
+  if (cfg.termTaperEnabled && cfg.capacityNominal_Ah > 0.0f && cfg.taperDivisor > 0.0f) {
+    const float taper_A = cfg.capacityNominal_Ah / cfg.taperDivisor;
+
+    // Do not stop a charge that never started (charger off / not connected)
+    if (iAbs > taper_A) taperArmed_ = true;
+
+    if (taperArmed_ &&
+        heldFor(iAbs < taper_A, taperActive_, taperStartMs_,
+                now_ms, cfg.taperHold_s * 1000ULL)) {
+      return ChargeStopReason::Taper;
+    }
+  }
+
+  // Plateau and -dV only make sense near the end of charge
+  const bool armed = voltage_V >= cfg.termArmVoltage_V;
+
+  // ---- dV/dt plateau --------------------------------------------------------
+  // An unseeded filter reads 0 V/s, which would look like a plateau.
+  if (cfg.termPlateauEnabled) {
+    const float slope_mVpm = dvdt_Vps * 1000.0f * 60.0f;
+    if (heldFor(armed && slopeValid && slope_mVpm < cfg.plateauSlope_mVpm,
+                plateauActive_, plateauStartMs_,
+                now_ms, cfg.plateauHold_s * 1000ULL)) {
+      return ChargeStopReason::Plateau;
+    }
+  }
+
+  // ---- -dV peak detection ---------------------------------------------------
+  if (cfg.termNegDvEnabled && armed) {
+    if (!peakValid_ || voltage_V > peakV_) {
+      peakV_ = voltage_V;
+      peakValid_ = true;
+    } else if ((peakV_ - voltage_V) >= cfg.negDv_V) {
+      return ChargeStopReason::NegDv;
+    }
+  }
+
+  return ChargeStopReason::None;
+}
+
+uint32_t ChargeTerm::msUntilNextDeadline(const CoreConfig& cfg, uint64_t now_ms) const {
+  uint32_t best = UINT32_MAX;
+
+  auto consider = [&](bool active, uint64_t startMs, uint64_t hold_ms) {
+    if (!active) return;
+    const uint64_t elapsed = now_ms - startMs;
+    const uint64_t left = (elapsed < hold_ms) ? (hold_ms - elapsed) : 0;
+    if (left < best) best = (uint32_t)left;
+  };
+
+  if (cfg.termMaxTimeEnabled) consider(true, phaseStartMs_, cfg.maxChargeTime_s * 1000ULL);
+  if (cfg.termHoldEnabled)    consider(aboveActive_, aboveStartMs_, cfg.chargeHoldAbove_s * 1000ULL);
+  if (cfg.termTaperEnabled)   consider(taperActive_, taperStartMs_, cfg.taperHold_s * 1000ULL);
+  if (cfg.termPlateauEnabled) consider(plateauActive_, plateauStartMs_, cfg.plateauHold_s * 1000ULL);
+
+  return best;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+
+struct CoreConfig; // core.h (rule parameters live there, next to the other stop criteria)
+
+// Why a charge phase ended (None = keep charging).
+enum class ChargeStopReason : uint8_t {
+  None = 0,
+  Hold = 1,     // V >= chargeStopVoltage_V continuously for chargeHoldAbove_s
+  Taper = 2,    // |I| < capacity / taperDivisor for taperHold_s (CV phase done)
+  Plateau = 3,  // dV/dt below plateau threshold for plateauHold_s
+  NegDv = 4,    // voltage dropped negDv_V below its peak (-dV)
+  MaxTime = 5,  // guard: charge time limit
+  MaxAh = 6,    // guard: charged Ah limit
+  Voltage = 7   // step table charge: until_V reached
+};
+
+const char* chargeStopReasonName(ChargeStopReason r);
+
+// Charge termination engine.
+// - Evaluates all rules enabled in CoreConfig on every core sample.
+// - First rule that fires wins (guards first, then the regular rules).
+// - Holds only small timers, so several instances (e.g. shadows) are cheap.
+class ChargeTerm {
+public:
+  // Call when a charge phase starts.
+  void reset(uint64_t now_ms);
+
+  // Evaluate one sample.
+  // ah:       charged Ah in this phase so far (absolute)
+  // dvdt_Vps: filtered voltage slope
+  // slopeValid: dvdt_Vps is settled; the plateau rule ignores it otherwise
+  ChargeStopReason update(const CoreConfig& cfg, uint64_t now_ms,
+                          float voltage_V, float current_A,
+                          float ah, float dvdt_Vps, bool slopeValid);
+
+  // Time until the earliest timer based rule could fire (for adaptive sampling).
+  // Returns UINT32_MAX if no timer is running.
+  uint32_t msUntilNextDeadline(const CoreConfig& cfg, uint64_t now_ms) const;
+
+  bool holdActive() const { return aboveActive_; }
+
+private:
+  uint64_t phaseStartMs_ = 0;
+
+  // Hold rule
+  bool aboveActive_ = false;
+  uint64_t aboveStartMs_ = 0;
+
+  // Taper rule (armed once the charger delivered more than the taper current)
+  bool taperArmed_ = false;
+  bool taperActive_ = false;
+  uint64_t taperStartMs_ = 0;
+
+  // Plateau rule
+  bool plateauActive_ = false;
+  uint64_t plateauStartMs_ = 0;
+
+  // -dV rule
+  float peakV_ = 0.0f;
+  bool peakValid_ = false;
+};
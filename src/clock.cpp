@@ -0,0 +1,37 @@
+#include "clock.h"
+
+#ifdef BT_HOST
+  #include "host_clock.h"
+#else
+  #include <esp_timer.h>
+#endif
+
+static uint64_t g_epochOffset_ms = 0;
+static bool g_epochValid = false;
+
+uint64_t clockNow_us() {
+#ifdef BT_HOST
+  return hostClockNow_us();
+#else
+  return (uint64_t)esp_timer_get_time();
+#endif
+}
+
+void clockSetEpoch_ms(uint64_t epochNow_ms) {
+  const uint64_t now_ms = clockNow_ms();
+  if (epochNow_ms < now_ms) return;   // before boot: not a plausible wall clock
+  g_epochOffset_ms = epochNow_ms - now_ms;
+  g_epochValid = true;
+}
+
+bool clockEpochValid() {
+  return g_epochValid;
+}
+
+uint64_t clockEpochOffset_ms() {
+  return g_epochValid ? g_epochOffset_ms : 0;
+}
+
+uint64_t clockToEpoch_ms(uint64_t monotonic_ms) {
+  return g_epochValid ? g_epochOffset_ms + monotonic_ms : 0;
+}
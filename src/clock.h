@@ -0,0 +1,16 @@
+#pragma once
+#include <stdint.h>
+
+// 64-bit monotonic timebase (esp_timer on the target, virtual clock on the
+// host). Unlike millis() it does not wrap, so month-long tests keep correct
+// phase times, timers and log timestamps.
+uint64_t clockNow_us();
+inline uint64_t clockNow_ms() { return clockNow_us() / 1000ULL; }
+
+// Optional wall-clock anchor (set from the browser via POST /api/time).
+// Monotonic time stays the reference for all timing; the anchor only maps
+// monotonic instants to Unix time for display and export.
+void clockSetEpoch_ms(uint64_t epochNow_ms);
+bool clockEpochValid();
+uint64_t clockEpochOffset_ms();                  // Unix ms at monotonic 0 (0 if not anchored)
+uint64_t clockToEpoch_ms(uint64_t monotonic_ms); // 0 if not anchored
@@ -0,0 +1,227 @@
+#include "config_store.h"
+#include <Arduino.h>
+#include <Preferences.h>
+#include <string.h>
+#include <stdio.h>
+#include "log.h"
+#include "clock.h"
+
+static const char* TAG = "CFG"; // For BT_LOG*
+
+static constexpr const char* kNamespace = "bt_cfg";
+static constexpr const char* kKeyActive = "active";
+static constexpr uint32_t kMagic = 0x46435442;   // "BTCF"
+
+static Preferences g_prefs;
+
+// CRC-32 (IEEE, reflected), bitwise: a blob is ~150 bytes.
+static uint32_t crc32(const uint8_t* data, size_t len) {
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t k = 0; k < len; ++k) {
+    crc ^= data[k];
+    for (uint8_t b = 0; b < 8; ++b) {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+  }
+  return ~crc;
+}
+
+static void profileKey(uint8_t slot, char* out, size_t outLen) {
+  snprintf(out, outLen, "p%u", (unsigned)slot);
+}
+
+bool ConfigStore::begin() {
+  ok_ = g_prefs.begin(kNamespace, false);
+  if (!ok_) BT_LOGE(TAG, "NVS namespace not available, settings stay in RAM");
+  return ok_;
+}
+
+// The stored fields, in blob order; one list for pack and unpack. Program::
+// stepTable is not stored (the step table itself is not part of the blob).
+template <class Io, class S>
+static constexpr void settingsFields(Io& io, S& s) {
+  auto& c = s.core;
+  io(c.chargeStopVoltage_V);
+  io(c.chargeHoldAbove_s);
+  io(c.termHoldEnabled);
+  io(c.termTaperEnabled);
+  io(c.capacityNominal_Ah);
+  io(c.taperDivisor);
+  io(c.taperHold_s);
+  io(c.termArmVoltage_V);
+  io(c.termPlateauEnabled);
+  io(c.plateauSlope_mVpm);
+  io(c.plateauHold_s);
+  io(c.termNegDvEnabled);
+  io(c.negDv_V);
+  io(c.termMaxTimeEnabled);
+  io(c.maxChargeTime_s);
+  io(c.termMaxAhEnabled);
+  io(c.maxChargeAh);
+  io(c.waitChargeToDischarge_s);
+  io(c.dischargeStopVoltage_V);
+  io(c.waitDischargeToCharge_s);
+  io(c.irEnabled);
+  io(c.irInterval_s);
+  io(c.sampleMin_s);
+  io(c.sampleMax_s);
+  io(c.sampleNearBand_V);
+
+  auto& p = s.program;
+  io(p.cycles);
+  io(p.startMode);
+  io(p.stopMode);
+}
+
+struct SizeIo {
+  size_t n = 0;
+  template <class T> constexpr void operator()(const T&) { n += sizeof(T); }
+};
+
+struct PackIo {
+  uint8_t* p;
+  template <class T> void operator()(const T& v) { memcpy(p, &v, sizeof(T)); p += sizeof(T); }
+};
+
+struct UnpackIo {
+  const uint8_t* p;
+  template <class T> void operator()(T& v) { memcpy(&v, p, sizeof(T)); p += sizeof(T); }
+};
+
+static constexpr size_t packedSettingsBytes() {
+  SizeIo io;
+  const StoredSettings s{};
+  settingsFields(io, s);
+  return io.n;
+}
+
+void ConfigStore::build_(Blob& b, const char* name, const StoredSettings& s) {
+  static_assert(packedSettingsBytes() <= kSettingsBytes, "ConfigStore::kSettingsBytes too small");
+
+  memset((void*)&b, 0, sizeof(b));   // header has no padding, the rest is packed
+  b.magic = kMagic;
+  b.version = kConfigBlobVersion;
+  b.size = (uint16_t)sizeof(Blob);
+  if (name) strncpy(b.name, name, sizeof(b.name) - 1);
+  PackIo io{b.settings};
+  settingsFields(io, s);
+  b.crc = crc32((const uint8_t*)&b, offsetof(Blob, crc));
+}
+
+void ConfigStore::unpack_(const Blob& b, StoredSettings& out) {
+  out = StoredSettings{};
+  UnpackIo io{b.settings};
+  settingsFields(io, out);
+}
+
+bool ConfigStore::valid_(const Blob& b) {
+  return b.magic == kMagic && b.version == kConfigBlobVersion &&
+         b.size == sizeof(Blob) &&
+         b.crc == crc32((const uint8_t*)&b, offsetof(Blob, crc));
+}
+
+bool ConfigStore::read_(const char* key, Blob& b) {
+  if (!ok_) return false;
+  if (g_prefs.getBytesLength(key) != sizeof(Blob)) return false;
+  if (g_prefs.getBytes(key, &b, sizeof(Blob)) != sizeof(Blob)) return false;
+  return valid_(b);
+}
+
+bool ConfigStore::write_(const char* key, const Blob& b) {
+  if (!ok_) return false;
+  if (g_prefs.putBytes(key, &b, sizeof(Blob)) != sizeof(Blob)) {
+    BT_LOGE(TAG, "NVS write of '%s' failed", key);
+    return false;
+  }
+  writes_++;
+  return true;
+}
+
+bool ConfigStore::saveActive_(const Blob& b) {
+  // Unchanged content: no flash write
+  if (activeValid_ && memcmp(&active_, &b, sizeof(Blob)) == 0) return true;
+  if (!write_(kKeyActive, b)) return false;
+
+  active_ = b;
+  activeValid_ = true;
+  return true;
+}
+
+bool ConfigStore::load(StoredSettings& out) {
+  const uint64_t t0 = clockNow_us();
+  Blob b;
+  const bool found = read_(kKeyActive, b);
+  lastLoad_us_ = (uint32_t)(clockNow_us() - t0);
+
+  if (!found) {
+    BT_LOGI(TAG, "no valid stored settings, using defaults");
+    return false;
+  }
+
+  active_ = b;
+  activeValid_ = true;
+  unpack_(b, out);
+  BT_LOGI(TAG, "settings restored in %lu us (profile '%s')",
+          (unsigned long)lastLoad_us_, b.name);
+  return true;
+}
+
+bool ConfigStore::save(const StoredSettings& s) {
+  // Edited settings keep the profile name only if nothing changed
+  Blob b;
+  build_(b, activeValid_ ? active_.name : "", s);
+  if (activeValid_ && memcmp(active_.settings, b.settings, sizeof(b.settings)) != 0) {
+    build_(b, "", s);
+  }
+  return saveActive_(b);
+}
+
+bool ConfigStore::saveProfile(uint8_t slot, const char* name, const StoredSettings& s) {
+  if (slot >= kConfigProfiles) return false;
+
+  char key[8];
+  profileKey(slot, key, sizeof(key));
+  Blob b;
+  build_(b, name, s);
+  if (!write_(key, b)) return false;
+
+  BT_LOGI(TAG, "profile %u '%s' saved", (unsigned)slot, b.name);
+  return saveActive_(b);   // the current settings now carry the profile name
+}
+
+bool ConfigStore::loadProfile(uint8_t slot, StoredSettings& out) {
+  if (slot >= kConfigProfiles) return false;
+
+  char key[8];
+  profileKey(slot, key, sizeof(key));
+  Blob b;
+  if (!read_(key, b)) return false;
+
+  unpack_(b, out);
+  BT_LOGI(TAG, "profile %u '%s' loaded", (unsigned)slot, b.name);
+  return saveActive_(b);
+}
+
+bool ConfigStore::eraseProfile(uint8_t slot) {
+  if (!ok_ || slot >= kConfigProfiles) return false;
+
+  char key[8];
+  profileKey(slot, key, sizeof(key));
+  g_prefs.remove(key);   // false if the slot was empty anyway
+  return true;
+}
+
+bool ConfigStore::profileName(uint8_t slot, char* out, size_t outLen) {
+  if (outLen == 0) return false;
+  out[0] = '\0';
+  if (slot >= kConfigProfiles) return false;
+
+  char key[8];
+  profileKey(slot, key, sizeof(key));
+  Blob b;
+  if (!read_(key, b)) return false;
+
+  strncpy(out, b.name, outLen - 1);
+  out[outLen - 1] = '\0';
+  return true;
+}
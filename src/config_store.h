@@ -0,0 +1,66 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+#include "core.h"
+#include "state_machine.h"
+
+// What is persisted: the run settings edited in the UI.
+struct StoredSettings {
+  CoreConfig core;
+  Program program;
+};
+
+// CoreConfig + Program as one binary blob in NVS:
+// - settings packed field by field (no padding bytes, so equal settings
+//   give equal blobs)
+// - header with magic, layout version and size, CRC-32 over the blob;
+//   a blob with a different version / size or a bad CRC is ignored
+// - "active" slot restored at boot, written only if the content changed
+// - kConfigProfiles named profiles (e.g. LiFePO4 4S, lead acid 12 V)
+// The step table itself is not part of it (Program::stepTable is cleared).
+class ConfigStore {
+public:
+  bool begin();   // open the NVS namespace
+
+  // Active settings
+  bool load(StoredSettings& out);           // false: nothing valid stored (keep defaults)
+  bool save(const StoredSettings& s);       // true if stored or unchanged
+
+  // Profiles (slot < kConfigProfiles)
+  bool saveProfile(uint8_t slot, const char* name, const StoredSettings& s);
+  bool loadProfile(uint8_t slot, StoredSettings& out);   // also becomes the active set
+  bool eraseProfile(uint8_t slot);
+  bool profileName(uint8_t slot, char* out, size_t outLen);   // false: slot empty / invalid
+
+  // Name of the profile the active settings came from ("" = edited / defaults)
+  const char* activeName() const { return active_.name; }
+
+  uint32_t writes() const { return writes_; }
+  uint32_t lastLoad_us() const { return lastLoad_us_; }
+
+private:
+  static constexpr size_t kSettingsBytes = 128;   // room for the packed fields
+
+  struct Blob {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    char name[kConfigProfileNameLen];
+    uint8_t settings[kSettingsBytes];   // packed StoredSettings, zero-filled
+    uint32_t crc;           // CRC-32 of all bytes before this field
+  };
+
+  bool ok_ = false;
+  Blob active_ = {};        // last active blob read or written
+  bool activeValid_ = false;
+  uint32_t writes_ = 0;
+  uint32_t lastLoad_us_ = 0;
+
+  static void build_(Blob& b, const char* name, const StoredSettings& s);
+  static void unpack_(const Blob& b, StoredSettings& out);
+  static bool valid_(const Blob& b);
+  bool read_(const char* key, Blob& b);
+  bool write_(const char* key, const Blob& b);
+  bool saveActive_(const Blob& b);
+};
@@ -1,15 +1,27 @@
 #include "core.h"
 #include <math.h>
+#include "log.h"
+#include "config.h"
+#include "cycle_table.h"
+#include "sequencer.h"
+#include "clock.h"
 
 static const char* TAG = "CORE"; // For BT_LOG*
 
 // Keep implementation deliberately flat:
 // - One main tick() with a few small inline blocks
-// - Minimal helper usage (only phaseElapsed_s required by header)
-
-uint32_t Core::phaseElapsed_s(uint32_t now_ms) const {
-  if (phaseStartMs_ == 0) return 0;
-  return (now_ms - phaseStartMs_) / 1000;
+// - Minimal helper usage (phaseElapsed_s + adaptive sampling helpers)
+
+// Adaptive sampling tuning
+// - Slope filter time constant (INA219 bus LSB is 4 mV, so raw dV/dt is noisy)
+// - Fraction of the predicted time-to-threshold used as next period
+//   (0.25 -> at least ~4 samples before the predicted crossing)
+static constexpr float kSlopeTau_s = 30.0f;
+static constexpr float kLookaheadFraction = 0.25f;
+
+uint32_t Core::phaseElapsed_s(uint64_t now_ms) const {
+  if (!phaseClockValid_) return 0;
+  return (uint32_t)((now_ms - phaseStartMs_) / 1000ULL);
 }
 
 Core::Core(Hw& hw, StateMachine& sm)
@@ -30,15 +42,33 @@ void Core::stop() {
 
   phaseStartMs_ = 0;
   lastEnergyMs_ = 0;
+  phaseClockValid_ = false;
   phaseWh_ = 0.0f;
+  phaseAh_ = 0.0f;
+  lastPowerValid_ = false;
 
-  aboveVStartMs_ = 0;
   waitStartMs_ = 0;
+  waitActive_ = false;
+
+  // Run ended: keep a half-filled cycle in the summary table
+  if (cycles_) cycles_->flush();
+
+  if (stepRun_) seq_->abort();
+  stepRun_ = false;
+
+  irLast_mOhm_ = NAN;
+  irCycleSum_mOhm_ = 0.0f;
+  irCycleCount_ = 0;
+  irPending_ = false;   // outputs are off, nothing to restore
+
+  slopeSeeded_ = false;
+  nextIntervalMs_ = cfg_.sampleMin_s * 1000UL;
 }
 
 void Core::pause() {
   if (runState_ != RunState::Running) return;
   hw_.allOff();
+  irPending_ = false;
   runState_ = RunState::Paused;
 }
 
@@ -48,7 +78,9 @@ void Core::resume() {
   // Hardware will be re-enabled in tick() based on current phase.
 }
 
-void Core::tick(uint32_t now_ms, const Telemetry& smTel) {
+void Core::tick(uint64_t now_ms, const Telemetry& smTel) {
+  tickSampled_ = true;
+
   // -------------------------------------------------------------------------
   // 1) Sync run state with StateMachine (Start/Stop detection)
   // -------------------------------------------------------------------------
@@ -61,12 +93,10 @@ void Core::tick(uint32_t now_ms, const Telemetry& smTel) {
     phase_ = (smTel.mode == Mode::Charge) ? Phase::Charge : Phase::Discharge;
 
     // Initialize per-phase accounting
-    phaseStartMs_ = now_ms;
-    lastEnergyMs_ = now_ms;
-    phaseWh_ = 0.0f;
+    resetPhase_(now_ms);
 
-    // Reset charge-hold tracking
-    aboveVStartMs_ = 0;
+    // Reset charge stop rules
+    chargeTerm_.reset(now_ms);
 
     // Cycle tracking: phaseCount comes from SM (counts completed active phases)
     phaseCount_ = smTel.phaseCount;
@@ -74,6 +104,14 @@ void Core::tick(uint32_t now_ms, const Telemetry& smTel) {
 
     // Wait timer not active yet
     waitStartMs_ = 0;
+    waitActive_ = false;
+
+    // Step table: Core drives the outputs from the first step on
+    stepRun_ = sm_.getProgram().stepTable && seq_ && seq_->loaded();
+    if (stepRun_) {
+      seq_->begin(now_ms);
+      enterStep_(now_ms);
+    }
   }
 
   // Stop detected: SM returned to Idle (Done/Stop/Error)
@@ -82,8 +120,23 @@ void Core::tick(uint32_t now_ms, const Telemetry& smTel) {
     return;
   }
 
-  // If not running, do nothing
+  // If not running, do nothing (but keep polling fast to catch a start)
   if (runState_ != RunState::Running) {
+    nextIntervalMs_ = cfg_.sampleMin_s * 1000UL;
+    return;
+  }
+
+  // Internal resistance pulse in progress: this tick only finishes it once
+  // the settle time is over, then resumes the regular sample schedule.
+  if (irPending_) {
+    tickSampled_ = false;
+    const uint64_t off_us = clockNow_us() - irStepUs_;
+    if (off_us < kIrSettle_us) {
+      nextIntervalMs_ = (uint32_t)((kIrSettle_us - off_us + 999) / 1000);
+      return;
+    }
+    finishInternalResistance_();
+    nextIntervalMs_ = (irResumeMs_ > now_ms) ? (uint32_t)(irResumeMs_ - now_ms) : 1;
     return;
   }
 
@@ -93,123 +146,477 @@ void Core::tick(uint32_t now_ms, const Telemetry& smTel) {
   const float v = hw_.readVoltage_V();
   const float i = hw_.readCurrent_A();
 
+  updateSlope_(now_ms, v);
+  lastSampleMs_ = now_ms;
+  lastV_ = v;
+  lastI_ = i;
+
   // -------------------------------------------------------------------------
   // 3) Energy integration (active phases only)
   // -------------------------------------------------------------------------
   if (phase_ == Phase::Charge || phase_ == Phase::Discharge) {
-    if (lastEnergyMs_ == 0) lastEnergyMs_ = now_ms;
+    if (!phaseClockValid_) {
+      phaseStartMs_ = now_ms;
+      lastEnergyMs_ = now_ms;
+      phaseClockValid_ = true;
+    }
 
-    const uint32_t dt_ms = now_ms - lastEnergyMs_;
+    // Trapezoidal rule: sample periods are irregular (adaptive), so use
+    // the mean of both end points instead of holding the newest value.
+    const float p = v * i;
+    const uint64_t dt_ms = now_ms - lastEnergyMs_;
     if (dt_ms > 0) {
-      const float dt_s = (float)dt_ms / 1000.0f;
-      phaseWh_ += (v * i) * (dt_s / 3600.0f);
+      const float dt_h = ((float)dt_ms / 1000.0f) / 3600.0f;
+      const float pAvg = lastPowerValid_ ? 0.5f * (p + lastPower_W_) : p;
+      const float iAvg = lastPowerValid_ ? 0.5f * (i + lastCurrent_A_) : i;
+      phaseWh_ += pAvg * dt_h;
+      phaseAh_ += iAvg * dt_h;
       lastEnergyMs_ = now_ms;
     }
+    lastPower_W_ = p;
+    lastCurrent_A_ = i;
+    lastPowerValid_ = true;
+
+    if (isnan(phaseStartV_)) phaseStartV_ = v;
+    if (fabsf(i) > phasePeakA_) phasePeakA_ = fabsf(i);
   }
 
   // -------------------------------------------------------------------------
   // 4) Phase logic (single switch, linear flow)
   // -------------------------------------------------------------------------
 
-  if (phase_ == Phase::Charge) {
-    // Charge stop condition:
-    // voltage >= threshold continuously for chargeHoldAbove_s
-    if (v >= cfg_.chargeStopVoltage_V) {
-      if (aboveVStartMs_ == 0) aboveVStartMs_ = now_ms;
-      const uint32_t held_ms = now_ms - aboveVStartMs_;
-      if (held_ms >= cfg_.chargeHoldAbove_s * 1000UL) {
-        lastChargeWh_ = fabsf(phaseWh_);
-
-        // Tell SM to switch to the opposite mode
-        sm_.notifyPhaseDone();
-
-        // Update cycle counters (one active phase completed)
-        phaseCount_++;
-        cycle1_ = (phaseCount_ / 2) + 1;
-
-        // Enter wait phase (charge -> discharge)
-        hw_.allOff();
-        phase_ = Phase::WaitChargeToDischarge;
-        waitStartMs_ = now_ms;
-
-        // Reset per-phase energy/timers for the next phase block
-        phaseStartMs_ = now_ms;
-        lastEnergyMs_ = now_ms;
-        phaseWh_ = 0.0f;
-        aboveVStartMs_ = 0;
-      }
-    } else {
-      // Drop below threshold resets hold timer
-      aboveVStartMs_ = 0;
+  if (stepRun_) {
+    // Step table program: the current step decides
+    if (!tickStep_(now_ms, v, i)) {
+      // Program done, SM is Idle: the next tick stops the core
+      nextIntervalMs_ = cfg_.sampleMin_s * 1000UL;
+      return;
     }
+  } else if (phase_ == Phase::Charge) {
+    // Charge stop condition: first enabled rule of the termination engine
+    if (checkChargeDone_(now_ms, v, i)) {
+      lastChargeWh_ = fabsf(phaseWh_);
+      lastChargeAh_ = fabsf(phaseAh_);
+      BT_LOGI(TAG, "charge done: %s, %.3f Wh, %.3f Ah",
+              chargeStopReasonName(lastChargeStop_), lastChargeWh_, lastChargeAh_);
 
-    return;
-  }
+      recordPhase_(now_ms, true, v);
 
-  if (phase_ == Phase::Discharge) {
+      // Tell SM to switch to the opposite mode
+      sm_.notifyPhaseDone();
+
+      // Update cycle counters (one active phase completed)
+      onPhaseCompleted_();
+
+      // Enter wait phase (charge -> discharge)
+      hw_.allOff();
+      phase_ = Phase::WaitChargeToDischarge;
+      waitStartMs_ = now_ms;
+      waitActive_ = true;
+
+      // Reset per-phase energy/timers for the next phase block
+      resetPhase_(now_ms);
+    }
+  } else if (phase_ == Phase::Discharge) {
     // Discharge stop condition:
     // voltage <= dischargeStopVoltage_V
     if (v <= cfg_.dischargeStopVoltage_V) {
       
       lastDischargeWh_ = fabsf(phaseWh_);
+      lastDischargeAh_ = fabsf(phaseAh_);
+      BT_LOGI(TAG, "discharge done: %.3f Wh, %.3f Ah", lastDischargeWh_, lastDischargeAh_);
+
+      recordPhase_(now_ms, false, v);
 
       sm_.notifyPhaseDone();
 
-      phaseCount_++;
-      cycle1_ = (phaseCount_ / 2) + 1;
+      onPhaseCompleted_();
 
       // Enter wait phase (discharge -> charge)
       hw_.allOff();
       phase_ = Phase::WaitDischargeToCharge;
       waitStartMs_ = now_ms;
+      waitActive_ = true;
 
       // Reset per-phase energy/timers
-      phaseStartMs_ = now_ms;
-      lastEnergyMs_ = now_ms;
-      phaseWh_ = 0.0f;
-      aboveVStartMs_ = 0;
+      resetPhase_(now_ms);
+    }
+  } else if (phase_ == Phase::WaitChargeToDischarge) {
+    if (!waitActive_) {
+      waitStartMs_ = now_ms;
+      waitActive_ = true;
     }
 
-    return;
-  }
-
-  if (phase_ == Phase::WaitChargeToDischarge) {
-    if (waitStartMs_ == 0) waitStartMs_ = now_ms;
-
-    const uint32_t wait_ms = cfg_.waitChargeToDischarge_s * 1000UL;
+    const uint64_t wait_ms = cfg_.waitChargeToDischarge_s * 1000ULL;
     if ((now_ms - waitStartMs_) >= wait_ms) {
       // Start discharge after wait
       hw_.startDischarge();
       phase_ = Phase::Discharge;
 
       // Reset per-phase timers/energy for discharge
-      phaseStartMs_ = now_ms;
-      lastEnergyMs_ = now_ms;
-      phaseWh_ = 0.0f;
+      resetPhase_(now_ms);
 
-      // No charge-hold tracking in discharge
-      aboveVStartMs_ = 0;
       waitStartMs_ = 0;
+      waitActive_ = false;
+    }
+  } else {
+    // Phase::WaitDischargeToCharge
+    if (!waitActive_) {
+      waitStartMs_ = now_ms;
+      waitActive_ = true;
+    }
+
+    const uint64_t wait_ms = cfg_.waitDischargeToCharge_s * 1000ULL;
+    if ((now_ms - waitStartMs_) >= wait_ms) {
+      // Start charge after wait
+      hw_.startCharge();
+      phase_ = Phase::Charge;
+
+      // Reset per-phase timers/energy for charge
+      resetPhase_(now_ms);
+
+      chargeTerm_.reset(now_ms);
+      waitStartMs_ = 0;
+      waitActive_ = false;
+    }
+  }
+
+  // -------------------------------------------------------------------------
+  // 5) Internal resistance pulse (after the regular sample, so it is not
+  //    disturbed). The output stays off for kIrSettle_us; a short tick
+  //    finishes the pulse, so loop() is not blocked meanwhile.
+  // -------------------------------------------------------------------------
+  if (cfg_.irEnabled &&
+      (phase_ == Phase::Charge || phase_ == Phase::Discharge) &&
+      !(stepRun_ && seq_->step().type == StepType::Pulse) &&
+      (now_ms - irLastMs_) >= cfg_.irInterval_s * 1000ULL) {
+    beginInternalResistance_(now_ms);
+  }
+
+  // -------------------------------------------------------------------------
+  // 6) Next sample period (adaptive); a pulse first wakes up after the settle
+  //    time and keeps this period for the sample after it
+  // -------------------------------------------------------------------------
+  nextIntervalMs_ = computeNextInterval_ms_(now_ms, v);
+  if (irPending_) {
+    irResumeMs_ = now_ms + nextIntervalMs_;
+    const uint64_t settledMs = (irStepUs_ + kIrSettle_us + 999) / 1000;
+    nextIntervalMs_ = (settledMs > now_ms) ? (uint32_t)(settledMs - now_ms) : 1;
+  }
+}
+
+void Core::resetPhase_(uint64_t now_ms) {
+  phaseStartMs_ = now_ms;
+  irLastMs_ = now_ms;
+  lastEnergyMs_ = now_ms;
+  phaseClockValid_ = true;
+  phaseWh_ = 0.0f;
+  phaseAh_ = 0.0f;
+  lastPowerValid_ = false;
+  slopeSeeded_ = false;
+  phaseStartV_ = NAN;
+  phasePeakA_ = 0.0f;
+}
+
+// ---------------------------------------------------------------------------
+// Step table programs
+// ---------------------------------------------------------------------------
+
+// Charge steps report their end like the charge rules (cycle table, UI).
+static ChargeStopReason chargeStopFor(StepEnd e) {
+  switch (e) {
+    case StepEnd::Time:    return ChargeStopReason::MaxTime;
+    case StepEnd::Voltage: return ChargeStopReason::Voltage;
+    case StepEnd::Current: return ChargeStopReason::Taper;
+    case StepEnd::Ah:      return ChargeStopReason::MaxAh;
+    default:               return ChargeStopReason::None;
+  }
+}
+
+// Outputs, phase and accounting for the sequencer's current step.
+// Pulse steps log as discharge (but are no cycle half, see tickStep_()),
+// rests as the wait after the last phase.
+void Core::enterStep_(uint64_t now_ms) {
+  const Step& s = seq_->step();
+  BT_LOGI(TAG, "step %u: %s", (unsigned)seq_->stepIndex(), stepTypeName(s.type));
+
+  switch (s.type) {
+    case StepType::Charge:
+      hw_.startCharge();
+      phase_ = Phase::Charge;
+      chargeTerm_.reset(now_ms);
+      sm_.notifyStepMode(Mode::Charge);
+      break;
+
+    case StepType::Discharge:
+    case StepType::Pulse:
+      hw_.startDischarge();
+      phase_ = Phase::Discharge;
+      sm_.notifyStepMode(Mode::Discharge);
+      break;
+
+    default:
+      hw_.allOff();
+      phase_ = (phase_ == Phase::Charge || phase_ == Phase::WaitChargeToDischarge)
+                 ? Phase::WaitChargeToDischarge
+                 : Phase::WaitDischargeToCharge;
+      sm_.notifyStepMode(Mode::Rest);
+      break;
+  }
+
+  resetPhase_(now_ms);
+  waitStartMs_ = now_ms;
+  waitActive_ = (s.type == StepType::Rest);
+}
+
+// One sample of a step table program. Returns false once the program is done.
+bool Core::tickStep_(uint64_t now_ms, float voltage_V, float current_A) {
+  const Step& s = seq_->step();
+  const bool rules = s.type == StepType::Charge && s.chargeRules &&
+                     checkChargeDone_(now_ms, voltage_V, current_A);
+  const StepEnd end = seq_->update(now_ms, voltage_V, current_A, fabsf(phaseAh_), rules);
+
+  if (end == StepEnd::None) {
+    if (s.type == StepType::Pulse) {
+      const bool on = seq_->pulseLoadOn(now_ms);
+      if (on != hw_.isDischargeOn()) {
+        if (on) hw_.startDischarge();
+        else hw_.allOff();
+      }
     }
+    return true;
+  }
+
+  if (s.type == StepType::Pulse) {
+    // A test pattern, not a cycle half: no phase count, no cycle table entry
+    BT_LOGI(TAG, "step %u done (%s): pulses %.3f Wh, %.3f Ah", (unsigned)seq_->stepIndex(),
+            stepEndName(end), fabsf(phaseWh_), fabsf(phaseAh_));
+  } else if (phase_ == Phase::Charge || phase_ == Phase::Discharge) {
+    const bool charge = (phase_ == Phase::Charge);
+    if (charge) {
+      lastChargeWh_ = fabsf(phaseWh_);
+      lastChargeAh_ = fabsf(phaseAh_);
+      if (end != StepEnd::Rules) lastChargeStop_ = chargeStopFor(end);
+    } else {
+      lastDischargeWh_ = fabsf(phaseWh_);
+      lastDischargeAh_ = fabsf(phaseAh_);
+    }
+    BT_LOGI(TAG, "step %u done (%s): %.3f Wh, %.3f Ah", (unsigned)seq_->stepIndex(),
+            stepEndName(end), fabsf(phaseWh_), fabsf(phaseAh_));
+
+    recordPhase_(now_ms, charge, voltage_V);
+    sm_.notifyPhaseDone();     // counts only, outputs stay with Core
+    onPhaseCompleted_();
+  }
+
+  if (!seq_->advance(now_ms)) {
+    BT_LOGI(TAG, "step program done");
+    hw_.allOff();
+    sm_.notifyProgramDone();
+    return false;
+  }
+
+  enterStep_(now_ms);
+  return true;
+}
+
+// Stop voltage of the active phase (NaN if the current step has none).
+float Core::activeStopVoltage_V_() const {
+  if (!stepRun_) {
+    return (phase_ == Phase::Discharge) ? cfg_.dischargeStopVoltage_V
+                                        : cfg_.chargeStopVoltage_V;
+  }
+  const Step& s = seq_->step();
+  if (s.until_V > 0.0f) return s.until_V;
+  if (s.type == StepType::Charge && s.chargeRules) return cfg_.chargeStopVoltage_V;
+  return NAN;
+}
+
+uint32_t Core::logInterval_s() const {
+  if (stepRun_ && seq_->step().log_s > 0) return seq_->step().log_s;
+  return kLogStoreInterval_s;
+}
+
+float Core::cycleInternalResistance_mOhm() const {
+  return (irCycleCount_ > 0) ? (irCycleSum_mOhm_ / irCycleCount_) : NAN;
+}
+
+void Core::onPhaseCompleted_() {
+  const uint16_t prevCycle = cycle1_;
+  phaseCount_++;
+  cycle1_ = (phaseCount_ / 2) + 1;
+
+  // Cycle finished: keep its mean resistance, start a new mean
+  if (cycle1_ != prevCycle) {
+    irLastCycle_mOhm_ = cycleInternalResistance_mOhm();
+    irCycleSum_mOhm_ = 0.0f;
+    irCycleCount_ = 0;
+  }
+}
+
+// Before onPhaseCompleted_(): the phase still belongs to cycle1_ and the
+// IR mean still covers this cycle.
+void Core::recordPhase_(uint64_t now_ms, bool charge, float voltage_V) {
+  if (!cycles_) return;
+
+  CyclePhase p;
+  p.valid = true;
+  p.energy_Wh = fabsf(phaseWh_);
+  p.charge_Ah = fabsf(phaseAh_);
+  p.duration_s = phaseElapsed_s(now_ms);
+  p.startVoltage_V = phaseStartV_;
+  p.endVoltage_V = voltage_V;
+  p.peakCurrent_A = phasePeakA_;
+
+  cycles_->addPhase(cycle1_, charge, p, lastChargeStop_,
+                    cycleInternalResistance_mOhm(), (uint32_t)(now_ms / 1000ULL));
+}
+
+void Core::beginInternalResistance_(uint64_t now_ms) {
+  irLastMs_ = now_ms;
+
+  irCap_ = StepCapture();
+  if (!hw_.beginLoadStep(kIrSamples, irCap_)) return;
+
+  irPending_ = true;
+  irStepUs_ = clockNow_us();
+}
 
+void Core::finishInternalResistance_() {
+  irPending_ = false;
+  hw_.endLoadStep(kIrSamples, irCap_);
+  const StepCapture& cap = irCap_;
+
+  const float dV = cap.vAfter_V - cap.vBefore_V;
+  const float dI = cap.iAfter_A - cap.iBefore_A;
+  if (isnan(dV) || isnan(dI) || fabsf(dI) < kIrMinDeltaI_A) {
+    BT_LOGW(TAG, "IR pulse invalid (dV=%.4f V, dI=%.4f A)", dV, dI);
     return;
   }
 
-  // Phase::WaitDischargeToCharge
-  if (waitStartMs_ == 0) waitStartMs_ = now_ms;
+  irLast_mOhm_ = fabsf(dV / dI) * 1000.0f;
+  irCycleSum_mOhm_ += irLast_mOhm_;
+  irCycleCount_++;
 
-  const uint32_t wait_ms = cfg_.waitDischargeToCharge_s * 1000UL;
-  if ((now_ms - waitStartMs_) >= wait_ms) {
-    // Start charge after wait
-    hw_.startCharge();
-    phase_ = Phase::Charge;
+  BT_LOGI(TAG, "IR %.1f mOhm (dV=%.4f V, dI=%.4f A, settle=%lu us, off=%lu us)",
+          irLast_mOhm_, dV, dI,
+          (unsigned long)cap.settleActual_us, (unsigned long)cap.offTime_us);
+}
 
-    // Reset per-phase timers/energy for charge
-    phaseStartMs_ = now_ms;
-    lastEnergyMs_ = now_ms;
-    phaseWh_ = 0.0f;
+bool Core::checkChargeDone_(uint64_t now_ms, float voltage_V, float current_A) {
+  const ChargeStopReason r = chargeTerm_.update(cfg_, now_ms, voltage_V, current_A,
+                                                fabsf(phaseAh_), dvdt_Vps_,
+                                                voltageSlopeValid());
+  if (r == ChargeStopReason::None) return false;
 
-    aboveVStartMs_ = 0;
-    waitStartMs_ = 0;
+  // Kept until the next charge ends (status, cycle table)
+  lastChargeStop_ = r;
+  return true;
+}
+
+void Core::updateSlope_(uint64_t now_ms, float voltage_V) {
+  // First sample of a phase only seeds the filter.
+  if (!slopeSeeded_ || isnan(lastV_) || isnan(voltage_V)) {
+    dvdt_Vps_ = 0.0f;
+    slopeSeeded_ = !isnan(voltage_V);
+    slopeAge_ms_ = 0;
+    return;
+  }
+
+  const uint64_t dt_ms = now_ms - lastSampleMs_;
+  if (dt_ms == 0) return;
+  if (slopeAge_ms_ < UINT32_MAX - dt_ms) slopeAge_ms_ += (uint32_t)dt_ms;
+
+  // First-order low-pass with a time-based weight, so irregular steps
+  // are weighted by their length.
+  const float dt_s = (float)dt_ms / 1000.0f;
+  const float raw = (voltage_V - lastV_) / dt_s;
+  const float a = dt_s / (kSlopeTau_s + dt_s);
+  dvdt_Vps_ += a * (raw - dvdt_Vps_);
+}
+
+bool Core::voltageSlopeValid() const {
+  return slopeSeeded_ && slopeAge_ms_ >= (uint32_t)(kSlopeTau_s * 1000.0f);
+}
+
+uint32_t Core::computeNextInterval_ms_(uint64_t now_ms, float voltage_V) const {
+  const uint32_t minMs = (cfg_.sampleMin_s > 0 ? cfg_.sampleMin_s : 1) * 1000UL;
+  const uint32_t maxMs = (cfg_.sampleMax_s * 1000UL > minMs) ? cfg_.sampleMax_s * 1000UL : minMs;
+
+  float next_s = (float)maxMs / 1000.0f;
+
+  if (phase_ == Phase::Charge || phase_ == Phase::Discharge) {
+    // Distance to the active threshold and the slope towards it
+    const float stopV = activeStopVoltage_V_();
+    float dist_V;
+    float towards_Vps;
+    if (phase_ == Phase::Discharge) {
+      dist_V = voltage_V - stopV;
+      towards_Vps = -dvdt_Vps_;
+    } else {
+      dist_V = stopV - voltage_V;
+      towards_Vps = dvdt_Vps_;
+    }
+
+    if (isnan(stopV)) {
+      // Step without a voltage limit: only the timers below matter
+    } else if (isnan(dist_V)) {
+      next_s = (float)minMs / 1000.0f;
+    } else if (stepRun_ ? (dist_V <= 0.0f)
+                        : (phase_ == Phase::Charge && chargeTerm_.holdActive())) {
+      // Already past the stop voltage: only the rule / hold timers below matter
+    } else {
+      if (dist_V < 0.0f) dist_V = 0.0f;
+
+      // a) Predicted time to threshold
+      if (towards_Vps > 0.0f) {
+        const float t_s = kLookaheadFraction * dist_V / towards_Vps;
+        if (t_s < next_s) next_s = t_s;
+      }
+
+      // b) Proximity band: shrink linearly towards min near the threshold
+      if (cfg_.sampleNearBand_V > 0.0f && dist_V < cfg_.sampleNearBand_V) {
+        const float t_s = ((float)maxMs / 1000.0f) * (dist_V / cfg_.sampleNearBand_V);
+        if (t_s < next_s) next_s = t_s;
+      }
+    }
+
+    // Wake up for the next internal resistance pulse
+    if (cfg_.irEnabled && !(stepRun_ && seq_->step().type == StepType::Pulse)) {
+      const uint64_t since_ms = now_ms - irLastMs_;
+      const uint64_t ir_ms = cfg_.irInterval_s * 1000ULL;
+      const float left_s = (since_ms < ir_ms) ? (float)(ir_ms - since_ms) / 1000.0f : 0.0f;
+      if (left_s < next_s) next_s = left_s;
+    }
+
+    // Never sleep past a running termination timer (hold, taper, plateau, guard)
+    if (phase_ == Phase::Charge && (!stepRun_ || seq_->step().chargeRules)) {
+      const uint32_t left_ms = chargeTerm_.msUntilNextDeadline(cfg_, now_ms);
+      if (left_ms != UINT32_MAX && (float)left_ms / 1000.0f < next_s) {
+        next_s = (float)left_ms / 1000.0f;
+      }
+    }
+  } else if (!stepRun_) {
+    // Wait phases: wake up when the wait ends
+    const uint64_t wait_ms = (phase_ == Phase::WaitChargeToDischarge)
+                               ? cfg_.waitChargeToDischarge_s * 1000ULL
+                               : cfg_.waitDischargeToCharge_s * 1000ULL;
+    const uint64_t waited_ms = waitActive_ ? (now_ms - waitStartMs_) : 0;
+    next_s = (waited_ms < wait_ms) ? (float)(wait_ms - waited_ms) / 1000.0f : 0.0f;
   }
+
+  // Step tables: step end, pulse edges and the step's log rate
+  if (stepRun_) {
+    const uint32_t left_ms = seq_->msUntilNextEvent(now_ms);
+    if (left_ms != UINT32_MAX && (float)left_ms / 1000.0f < next_s) {
+      next_s = (float)left_ms / 1000.0f;
+    }
+    const uint32_t log_s = seq_->step().log_s;
+    if (log_s > 0 && (float)log_s < next_s) next_s = (float)log_s;
+  }
+
+  uint32_t next_ms = (next_s >= (float)maxMs / 1000.0f) ? maxMs : (uint32_t)(next_s * 1000.0f);
+  if (next_ms < minMs) next_ms = minMs;
+  if (next_ms > maxMs) next_ms = maxMs;
+  return next_ms;
 }
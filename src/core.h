@@ -1,7 +1,12 @@
 #pragma once
 #include <stdint.h>
+#include <math.h>
 #include "state_machine.h"
 #include "hw.h"
+#include "charge_term.h"
+
+class CycleTable;
+class Sequencer;
 
 // Runtime run state (what UI shows as On/Off/Pause).
 enum class RunState : uint8_t { Off = 0, Running = 1, Paused = 2 };
@@ -20,9 +25,41 @@ struct CoreConfig {
   float chargeStopVoltage_V = 14.5f;
   uint32_t chargeHoldAbove_s = 3 * 3600;     // time above threshold
 
+  // Charge termination rules (see charge_term.h). Each can be enabled on its
+  // own; the first rule that fires ends the charge phase.
+  bool termHoldEnabled = true;               // V >= chargeStopVoltage_V for chargeHoldAbove_s
+
+  bool termTaperEnabled = false;             // |I| < capacityNominal_Ah / taperDivisor ...
+  float capacityNominal_Ah = 10.0f;
+  float taperDivisor = 20.0f;                // C/20
+  uint32_t taperHold_s = 10 * 60;            // ... continuously for this long
+
+  float termArmVoltage_V = 13.8f;            // plateau / -dV only evaluated above this voltage
+  bool termPlateauEnabled = false;           // dV/dt < plateauSlope_mVpm for plateauHold_s
+  float plateauSlope_mVpm = 1.0f;            // mV per minute
+  uint32_t plateauHold_s = 15 * 60;
+  bool termNegDvEnabled = false;             // V dropped negDv_V below its peak
+  float negDv_V = 0.010f;
+
+  bool termMaxTimeEnabled = true;            // guard
+  uint32_t maxChargeTime_s = 24 * 3600;
+  bool termMaxAhEnabled = false;             // guard
+  float maxChargeAh = 12.0f;
+
   uint32_t waitChargeToDischarge_s = 10;
   float dischargeStopVoltage_V = 12.2f;
   uint32_t waitDischargeToCharge_s = 10;
+
+  // DC internal resistance: periodic load pulse during active phases
+  // (discharge: load briefly opened, charge: charger briefly stopped).
+  bool irEnabled = false;
+  uint32_t irInterval_s = 30 * 60;
+
+  // Adaptive sampling: the core picks its next sample period from dV/dt
+  // and the distance to the active stop threshold, clamped to [min, max].
+  uint32_t sampleMin_s = 1;
+  uint32_t sampleMax_s = 60;
+  float sampleNearBand_V = 0.5f;  // within this distance the period shrinks towards min
 };
 
 // The "compute core":
@@ -36,6 +73,14 @@ public:
 
   void setConfig(const CoreConfig& cfg) { cfg_ = cfg; }
   CoreConfig getConfig() const { return cfg_; }
+
+  // Optional per-cycle summary table, filled when an active phase completes.
+  void attachCycleTable(CycleTable* table) { cycles_ = table; }
+
+  // Step table programs (sequencer.h): used for runs started with
+  // Program::stepTable set, instead of the fixed charge/wait/discharge loop.
+  void attachSequencer(Sequencer* seq) { seq_ = seq; }
+  bool stepRun() const { return stepRun_; }
   
   // Optional direct control (UI can call these later).
   void start();
@@ -43,24 +88,55 @@ public:
   void pause();
   void resume();
 
-  // Must be called regularly.
+  // Must be called regularly (ideally every nextSampleInterval_ms()).
   // Uses telemetry to detect Start/Stop when UI still controls the state machine directly.
-  void tick(uint32_t now_ms, const Telemetry& smTel);
+  void tick(uint64_t now_ms, const Telemetry& smTel);
+
+  // Suggested delay until the next tick() (adaptive, within cfg bounds).
+  uint32_t nextSampleInterval_ms() const { return nextIntervalMs_; }
+
+  // False if the last tick() only finished an internal resistance pulse
+  // (no new sample: shadows and the log skip it).
+  bool tickSampled() const { return tickSampled_; }
+
+  // Log row interval (per step for step tables, else kLogStoreInterval_s).
+  uint32_t logInterval_s() const;
 
   // Outputs for UI/logging
   RunState runState() const { return runState_; }
   Phase phase() const { return phase_; }
   uint16_t cycleIndex1Based() const { return cycle1_; }      // 1..N (0 if Off)
   float phaseEnergy_Wh() const { return phaseWh_; }
-  uint32_t phaseElapsed_s(uint32_t now_ms) const;
+  uint32_t phaseElapsed_s(uint64_t now_ms) const;
   float lastChargeEnergy_Wh() const { return lastChargeWh_; }
   float lastDischargeEnergy_Wh() const { return lastDischargeWh_; }
   float currentEnergy_Wh() const { return phaseWh_; }
+  float phaseCharge_Ah() const { return phaseAh_; }
+  float lastChargeCharge_Ah() const { return lastChargeAh_; }
+  float lastDischargeCharge_Ah() const { return lastDischargeAh_; }
+  ChargeStopReason lastChargeStopReason() const { return lastChargeStop_; }
+
+  // Internal resistance (NaN until measured)
+  float lastInternalResistance_mOhm() const { return irLast_mOhm_; }
+  float cycleInternalResistance_mOhm() const;       // mean within current cycle
+  float lastCycleInternalResistance_mOhm() const { return irLastCycle_mOhm_; }
+
+  // Last sample taken by tick() (for logging with a consistent timestamp)
+  uint64_t lastSampleMs() const { return lastSampleMs_; }
+  float lastVoltage_V() const { return lastV_; }
+  float lastCurrent_A() const { return lastI_; }
+  float voltageSlope_Vps() const { return dvdt_Vps_; }
+  // Slope filter has integrated at least one time constant since it was
+  // seeded (before that dvdt is biased towards 0)
+  bool voltageSlopeValid() const;
 
 private:
   Hw& hw_;
   StateMachine& sm_;
   CoreConfig cfg_;
+  CycleTable* cycles_ = nullptr;
+  Sequencer* seq_ = nullptr;
+  bool stepRun_ = false;     // current run executes seq_
 
   RunState runState_ = RunState::Off;
   Phase phase_ = Phase::Charge;
@@ -69,29 +145,77 @@ private:
   uint16_t phaseCount_ = 0;  // counts Charge/Discharge completions (not waits)
   uint16_t cycle1_ = 0;      // 1-based cycle number for human display
 
-  // Timing/energy integration
-  uint32_t phaseStartMs_ = 0;
-  uint32_t lastEnergyMs_ = 0;
+  // Timing/energy integration (64-bit monotonic ms, see clock.h)
+  uint64_t phaseStartMs_ = 0;
+  uint64_t lastEnergyMs_ = 0;
+  bool phaseClockValid_ = false;   // phaseStartMs_/lastEnergyMs_ set (0 is a valid instant)
   float phaseWh_ = 0.0f;
   float lastChargeWh_ = 0.0f;
   float lastDischargeWh_ = 0.0f;
 
-
-  // Charge stop: hold time above voltage threshold
-  uint32_t aboveVStartMs_ = 0;
+  // Charge (Ah) integration
+  float phaseAh_ = 0.0f;
+  float lastChargeAh_ = 0.0f;
+  float lastDischargeAh_ = 0.0f;
+  float lastCurrent_A_ = 0.0f;
+
+  // Per-phase summary (cycle table)
+  float phaseStartV_ = NAN;
+  float phasePeakA_ = 0.0f;
+
+  // Trapezoidal integration state (power at lastEnergyMs_)
+  float lastPower_W_ = 0.0f;
+  bool lastPowerValid_ = false;
+
+  // Last sample and smoothed slope (adaptive sampling)
+  uint64_t lastSampleMs_ = 0;
+  float lastV_ = NAN;
+  float lastI_ = NAN;
+  float dvdt_Vps_ = 0.0f;
+  bool slopeSeeded_ = false;
+  uint32_t slopeAge_ms_ = 0;  // filtered time since seeding
+  uint32_t nextIntervalMs_ = 1000;
+  bool tickSampled_ = true;
+
+  // Charge stop rules (hold, taper, plateau, -dV, guards)
+  ChargeTerm chargeTerm_;
+  ChargeStopReason lastChargeStop_ = ChargeStopReason::None;
+
+  // Internal resistance pulses
+  uint64_t irLastMs_ = 0;          // last pulse (or phase start)
+  bool irPending_ = false;         // output off, waiting for the settle time
+  StepCapture irCap_;
+  uint64_t irStepUs_ = 0;          // output switched off (clockNow_us)
+  uint64_t irResumeMs_ = 0;        // regular sample that the pulse postponed
+  float irLast_mOhm_ = NAN;
+  float irCycleSum_mOhm_ = 0.0f;
+  uint16_t irCycleCount_ = 0;
+  float irLastCycle_mOhm_ = NAN;
 
   // Wait phase timing
-  uint32_t waitStartMs_ = 0;
+  uint64_t waitStartMs_ = 0;
+  bool waitActive_ = false;
 
   // Internal helpers
-  void syncFromStateMachine_(uint32_t now_ms, const Telemetry& smTel);
-  void enterPhase_(uint32_t now_ms, Phase p);
-
-  void updateEnergy_(uint32_t now_ms);
-  bool checkChargeDone_(uint32_t now_ms, float voltage_V) ;
+  void syncFromStateMachine_(uint64_t now_ms, const Telemetry& smTel);
+  void enterPhase_(uint64_t now_ms, Phase p);
+  void resetPhase_(uint64_t now_ms);
+
+  void enterStep_(uint64_t now_ms);
+  bool tickStep_(uint64_t now_ms, float voltage_V, float current_A);
+  float activeStopVoltage_V_() const;
+
+  void updateEnergy_(uint64_t now_ms);
+  void updateSlope_(uint64_t now_ms, float voltage_V);
+  void beginInternalResistance_(uint64_t now_ms);
+  void finishInternalResistance_();
+  void onPhaseCompleted_();
+  void recordPhase_(uint64_t now_ms, bool charge, float voltage_V);
+  uint32_t computeNextInterval_ms_(uint64_t now_ms, float voltage_V) const;
+  bool checkChargeDone_(uint64_t now_ms, float voltage_V, float current_A);
   bool checkDischargeDone_(float voltage_V) const;
-  bool checkWaitDone_(uint32_t now_ms, uint32_t wait_s) const;
+  bool checkWaitDone_(uint64_t now_ms, uint32_t wait_s) const;
 
-  void finishActiveModeAndEnterWait_(uint32_t now_ms, Phase waitPhase);
+  void finishActiveModeAndEnterWait_(uint64_t now_ms, Phase waitPhase);
   void startNextActiveModeAfterWait_();
 };
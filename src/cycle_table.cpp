@@ -0,0 +1,160 @@
+#include "cycle_table.h"
+#include <Arduino.h>
+
+float CycleRecord::coulombicEfficiency() const {
+  if (!charge.valid || !discharge.valid || charge.charge_Ah <= 0.0f) return NAN;
+  return discharge.charge_Ah / charge.charge_Ah;
+}
+
+float CycleRecord::energyEfficiency() const {
+  if (!charge.valid || !discharge.valid || charge.energy_Wh <= 0.0f) return NAN;
+  return discharge.energy_Wh / charge.energy_Wh;
+}
+
+void CycleTable::setStorage(CycleRecord* ring, size_t slots) {
+  ring_ = ring;
+  slots_ = ring ? slots : 0;
+  head_ = 0;
+  size_ = 0;
+}
+
+void CycleTable::clear() {
+  head_ = 0;
+  size_ = 0;
+  dropped_ = 0;
+  openValid_ = false;
+  hasFirst_ = false;
+}
+
+void CycleTable::addPhase(uint16_t cycle1, bool charge, const CyclePhase& phase,
+                          ChargeStopReason chargeStop, float ir_mOhm, uint32_t end_s) {
+  // A new cycle number closes whatever is still open
+  if (openValid_ && open_.cycle != cycle1) flush();
+
+  if (!openValid_) {
+    open_ = CycleRecord();
+    open_.cycle = cycle1;
+    openValid_ = true;
+  }
+
+  if (charge) {
+    open_.charge = phase;
+    open_.chargeStop = chargeStop;
+  } else {
+    open_.discharge = phase;
+  }
+  if (!isnan(ir_mOhm)) open_.ir_mOhm = ir_mOhm;
+  open_.end_s = end_s;
+
+  if (open_.charge.valid && open_.discharge.valid) flush();
+}
+
+void CycleTable::flush() {
+  if (!openValid_) return;
+  push_(open_);
+  openValid_ = false;
+}
+
+void CycleTable::push_(const CycleRecord& r) {
+  if (r.cycle == 1) {
+    first_ = r;
+    hasFirst_ = true;
+  }
+  if (slots_ == 0) {
+    dropped_++;
+    return;
+  }
+
+  ring_[head_] = r;
+  head_ = (head_ + 1) % slots_;
+  if (size_ < slots_) size_++;
+  else dropped_++;
+}
+
+// ---------------------------------------------------------------------------
+// Export
+// ---------------------------------------------------------------------------
+
+static void printNum(Print& out, float v, int decimals, bool json) {
+  if (isnan(v)) {
+    out.print(json ? "null" : "nan");
+    return;
+  }
+  out.print(v, decimals);
+}
+
+void CycleTable::printCsv(Print& out) const {
+  out.print("Cycle,End_s,"
+            "Chg_Wh,Chg_Ah,Chg_s,Chg_U0_V,Chg_U1_V,Chg_Ipk_A,Chg_Stop,"
+            "Dsg_Wh,Dsg_Ah,Dsg_s,Dsg_U0_V,Dsg_U1_V,Dsg_Ipk_A,"
+            "Eff_Ah,Eff_Wh,R_mOhm\n");
+
+  auto phase = [&](const CyclePhase& p) {
+    if (!p.valid) {
+      out.print(",,,,,,");
+      return;
+    }
+    printNum(out, p.energy_Wh, 3, false);      out.print(',');
+    printNum(out, p.charge_Ah, 3, false);      out.print(',');
+    out.print((unsigned long)p.duration_s);    out.print(',');
+    printNum(out, p.startVoltage_V, 3, false); out.print(',');
+    printNum(out, p.endVoltage_V, 3, false);   out.print(',');
+    printNum(out, p.peakCurrent_A, 3, false);  out.print(',');
+  };
+
+  for (size_t k = 0; k < size_; ++k) {
+    const CycleRecord& r = at(k);
+    out.print((unsigned long)r.cycle);  out.print(',');
+    out.print((unsigned long)r.end_s);  out.print(',');
+    phase(r.charge);
+    out.print(r.charge.valid ? chargeStopReasonName(r.chargeStop) : "");
+    out.print(',');
+    phase(r.discharge);
+    printNum(out, r.coulombicEfficiency(), 4, false); out.print(',');
+    printNum(out, r.energyEfficiency(), 4, false);    out.print(',');
+    printNum(out, r.ir_mOhm, 1, false);
+    out.print('\n');
+  }
+}
+
+static void printPhaseJson(Print& out, const CyclePhase& p) {
+  if (!p.valid) {
+    out.print("null");
+    return;
+  }
+  out.print("{\"Wh\":");          printNum(out, p.energy_Wh, 3, true);
+  out.print(",\"Ah\":");          printNum(out, p.charge_Ah, 3, true);
+  out.print(",\"duration_s\":");  out.print((unsigned long)p.duration_s);
+  out.print(",\"startV\":");      printNum(out, p.startVoltage_V, 3, true);
+  out.print(",\"endV\":");        printNum(out, p.endVoltage_V, 3, true);
+  out.print(",\"peakA\":");       printNum(out, p.peakCurrent_A, 3, true);
+  out.print('}');
+}
+
+void CycleTable::printRecordJson(Print& out, const CycleRecord& r) {
+  out.print("{\"cycle\":");            out.print((unsigned long)r.cycle);
+  out.print(",\"end_s\":");            out.print((unsigned long)r.end_s);
+  out.print(",\"charge\":");           printPhaseJson(out, r.charge);
+  out.print(",\"charge_stop\":\"");    out.print(chargeStopReasonName(r.chargeStop));
+  out.print("\",\"discharge\":");      printPhaseJson(out, r.discharge);
+  out.print(",\"eff_Ah\":");           printNum(out, r.coulombicEfficiency(), 4, true);
+  out.print(",\"eff_Wh\":");           printNum(out, r.energyEfficiency(), 4, true);
+  out.print(",\"ir_mOhm\":");          printNum(out, r.ir_mOhm, 1, true);
+  out.print('}');
+}
+
+void CycleTable::printJson(Print& out) const {
+  out.print("{\"capacity\":");  out.print((unsigned long)slots_);
+  out.print(",\"count\":");     out.print((unsigned long)size_);
+  out.print(",\"dropped\":");   out.print((unsigned long)dropped_);
+  out.print(",\"first\":");
+  if (hasFirst_) printRecordJson(out, first_);
+  else out.print("null");
+
+  out.print(",\"cycles\":[");
+  for (size_t k = 0; k < size_; ++k) {
+    if (k > 0) out.print(',');
+    printRecordJson(out, at(k));
+  }
+  out.print("]}");
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include "config.h"
+#include "charge_term.h"
+
+class Print;
+
+// Summary of one completed active phase (filled by Core).
+struct CyclePhase {
+  bool valid = false;
+  float energy_Wh = 0.0f;
+  float charge_Ah = 0.0f;
+  uint32_t duration_s = 0;
+  float startVoltage_V = NAN;   // first sample of the phase
+  float endVoltage_V = NAN;     // sample that ended the phase
+  float peakCurrent_A = 0.0f;   // max |I|
+};
+
+// One cycle = one charge and one discharge phase (in program order).
+struct CycleRecord {
+  uint16_t cycle = 0;                 // 1-based, as shown in the UI
+  uint32_t end_s = 0;                 // uptime at the last phase end
+  CyclePhase charge;
+  CyclePhase discharge;
+  ChargeStopReason chargeStop = ChargeStopReason::None;
+  float ir_mOhm = NAN;                // mean internal resistance of the cycle
+
+  // discharge / charge (NaN unless both phases completed)
+  float coulombicEfficiency() const;
+  float energyEfficiency() const;
+};
+
+// Small ring of per-cycle summaries, independent of the raw LogBuffer:
+// - one record per cycle, so it covers far more history than the raw rows
+// - cycle 1 of the latest run is kept separately (baseline for fade)
+// - a cycle with only one phase (program ended, stopped) is stored as is
+// Storage comes from outside (boot arena in main.cpp, a static array in the
+// host tools); without it completed cycles are not kept.
+class CycleTable {
+public:
+  void setStorage(CycleRecord* ring, size_t slots);
+  size_t capacity() const { return slots_; }
+
+  void clear();
+
+  // Called by Core whenever an active phase completes.
+  void addPhase(uint16_t cycle1, bool charge, const CyclePhase& phase,
+                ChargeStopReason chargeStop, float ir_mOhm, uint32_t end_s);
+
+  // Close a half-filled cycle (run stopped).
+  void flush();
+
+  size_t size() const { return size_; }
+  uint32_t dropped() const { return dropped_; }
+  uint32_t total() const { return dropped_ + (uint32_t)size_; }   // records ever pushed; at(k) is number dropped() + k
+  bool hasFirst() const { return hasFirst_; }
+  const CycleRecord& first() const { return first_; }
+
+  // k = 0 is the oldest record in the ring.
+  const CycleRecord& at(size_t k) const { return ring_[(oldest_() + k) % slots_]; }
+
+  void printCsv(Print& out) const;
+  void printJson(Print& out) const;
+  static void printRecordJson(Print& out, const CycleRecord& r);
+
+private:
+  CycleRecord* ring_ = nullptr;
+  size_t slots_ = 0;
+  size_t head_ = 0;     // next write slot
+  size_t size_ = 0;
+  uint32_t dropped_ = 0;
+
+  CycleRecord open_;    // cycle in progress
+  bool openValid_ = false;
+
+  CycleRecord first_;
+  bool hasFirst_ = false;
+
+  size_t oldest_() const { return slots_ ? (head_ + slots_ - size_) % slots_ : 0; }
+  void push_(const CycleRecord& r);
+};
@@ -1,175 +1,197 @@
-#include <Arduino.h>
-#include <math.h>
-
-#include "config.h"
 #include "hw.h"
+#include "log.h"
 
-#if HW_USE_INA219
-  #include <Wire.h>
-  #include <Adafruit_INA219.h>
-  static Adafruit_INA219 g_ina(kHwIna219Addr);
-#endif
+// Backend initialisation that needs a driver library (cold path).
+// The sample path is inline in hw_backends.h.
 
-void Hw::begin() {
+#if HW_SENSOR == HW_SENSOR_INA219 || HW_SENSOR == HW_SENSOR_INA226
 
-#if HW_USE_RELAIS
-  if (kHwChargePin >= 0) pinMode(kHwChargePin, OUTPUT);
-  if (kHwDischargePin >= 0) pinMode(kHwDischargePin, OUTPUT);
-#endif
+static void beginI2c() {
+  // allow "Arduino default pins" pattern if you set SDA/SCL to -1
+  if (kHwInaI2cSdaPin >= 0 && kHwInaI2cSclPin >= 0) {
+    Wire.begin(kHwInaI2cSdaPin, kHwInaI2cSclPin);
+  } else {
+    Wire.begin();
+  }
+  Wire.setClock(kHwI2cClock_Hz);
+}
 
-#if HW_USE_INA219
-  initIna219_();
-#else
-  inaOk_ = false;
 #endif
 
-  allOff();
-}
+#if HW_SENSOR == HW_SENSOR_INA219
 
+void Ina219Sensor::begin() {
+  beginI2c();
 
-void Hw::allOff() {
-  writeCharge(false);
-  writeDischarge(false);
-  chargeOn_ = false;
-  dischargeOn_ = false;
-}
+  ok_ = ina_.begin();
+  if (!ok_) return;
 
-void Hw::startCharge() {
-  writeDischarge(false);
-  dischargeOn_ = false;
-
-  writeCharge(true);
-  chargeOn_ = true;
+  endTriggered();
 }
 
-void Hw::stopCharge() {
-  writeCharge(false);
-  chargeOn_ = false;
-}
+void Ina219Sensor::endTriggered() {
+  if (!ok_) return;
 
-void Hw::startDischarge() {
-  writeCharge(false);
-  chargeOn_ = false;
-
-  writeDischarge(true);
-  dischargeOn_ = true;
+  // Also rewrites the config register (continuous bus + shunt, 12 bit)
+  switch (kHwInaCalPreset) {
+    default:
+    case 0: ina_.setCalibration_32V_2A();    break;
+    case 1: ina_.setCalibration_32V_1A();    break;
+    case 2: ina_.setCalibration_16V_400mA(); break;
+  }
 }
 
-void Hw::stopDischarge() {
-  writeDischarge(false);
-  dischargeOn_ = false;
-}
+#endif // HW_SENSOR_INA219
 
-void Hw::writeCharge(bool on) {
+#if HW_SENSOR == HW_SENSOR_INA226
 
-#if HW_USE_RELAIS
-  if (kHwChargePin < 0) return;
-  const bool level = kHwChargeActiveHigh ? on : !on;
-  digitalWrite(kHwChargePin, level ? HIGH : LOW);
-#endif
-}
+void Ina226Sensor::begin() {
+  beginI2c();
 
-void Hw::writeDischarge(bool on) {
-#if HW_USE_RELAIS
-  if (kHwDischargePin < 0) return;
-  const bool level = kHwDischargeActiveHigh ? on : !on;
-  digitalWrite(kHwDischargePin, level ? HIGH : LOW);
-#endif
+  Wire.beginTransmission(kHwIna226Addr);
+  Wire.write(kRegConfig);
+  Wire.write((uint8_t)(kHwIna226Config >> 8));
+  Wire.write((uint8_t)(kHwIna226Config & 0xFF));
+  ok_ = (Wire.endTransmission() == 0);
 }
 
-float Hw::readVoltage_V() const {
-#if HW_SIM_MEASUREMENTS
-  return readVoltageSim_V();
-#else
-#if HW_USE_INA219
-  if (inaOk_) return readVoltageIna_V_();
-#endif
-  if (kHwVoltageAdcPin < 0) return NAN;
-  const float x = readAdcNormalized(kHwVoltageAdcPin);
-  return x * kHwVoltageScale + kHwVoltageOffset;
-#endif
-}
+#endif // HW_SENSOR_INA226
 
-float Hw::readCurrent_A() const {
-#if HW_SIM_MEASUREMENTS
-  return readCurrentSim_A();
-#else
-#if HW_USE_INA219
-  if (inaOk_) return readCurrentIna_A_();
-#endif
-  if (kHwCurrentAdcPin < 0) return NAN;
-  const float x = readAdcNormalized(kHwCurrentAdcPin);
-  return x * kHwCurrentScale + kHwCurrentOffset;
-#endif
-}
+#if HW_SENSOR == HW_SENSOR_ADC
 
-float Hw::readAdcNormalized(int pin) const {
-  const int raw = analogRead(pin);
-  return (float)raw / 4095.0f;
-}
+#include <driver/adc.h>
+#include <esp_adc_cal.h>
 
-#if HW_USE_INA219
+static const char* TAG = "HW"; // For BT_LOG*
 
-void Hw::initIna219_() {
-  // allow "Arduino default pins" pattern if you set SDA/SCL to -1
-#if (INA_I2C_SDA >= 0) && (INA_I2C_SCL >= 0)
-  Wire.begin(kHwInaI2cSdaPin, kHwInaI2cSclPin);
-#else
-  Wire.begin();
-#endif
+// DMA result bytes handled per read (4 bytes per conversion)
+static constexpr uint32_t kAdcFrameBytes = 256;
 
-  inaOk_ = g_ina.begin();
-  if (!inaOk_) return;
+static esp_adc_cal_characteristics_t g_adcChars;
+static int8_t g_adcChV = -1;   // ADC1 channel of kHwVoltageAdcPin
+static int8_t g_adcChI = -1;   // ADC1 channel of kHwCurrentAdcPin
 
-  switch (kHwInaCalPreset) {
-    default:
-    case 0: g_ina.setCalibration_32V_2A();    break;
-    case 1: g_ina.setCalibration_32V_1A();    break;
-    case 2: g_ina.setCalibration_16V_400mA(); break;
+static int8_t adc1Channel(int pin) {
+  if (pin < 0) return -1;
+  const int8_t ch = digitalPinToAnalogChannel(pin);
+  if (ch < 0 || ch >= SOC_ADC_CHANNEL_NUM(0)) {
+    BT_LOGE(TAG, "GPIO %d is not an ADC1 pin", pin);
+    return -1;
+  }
+  return ch;
+}
+
+// Highest 12 bit code; esp_adc_cal_raw_to_voltage() is only defined up to it
+static constexpr uint32_t kAdcMaxRaw = 4095;
+
+// Mean raw code -> pin mV. The eFuse characteristic maps integer codes;
+// interpolate so the extra resolution of the average is kept. The lower
+// index stops one below full scale so r0 + 1 stays a valid code (a mean of
+// 4095 then lands on the end of the last segment).
+static float adcRawToPin_mV(float raw) {
+  if (!(raw > 0.0f)) raw = 0.0f;
+  if (raw > (float)kAdcMaxRaw) raw = (float)kAdcMaxRaw;
+  const uint32_t r0 = (uint32_t)raw < kAdcMaxRaw ? (uint32_t)raw : kAdcMaxRaw - 1;
+  const float mv0 = (float)esp_adc_cal_raw_to_voltage(r0, &g_adcChars);
+  const float mv1 = (float)esp_adc_cal_raw_to_voltage(r0 + 1, &g_adcChars);
+  return mv0 + (raw - (float)r0) * (mv1 - mv0);
+}
+
+// Decimation stage: block mean of kHwAdcOversample raw samples per channel,
+// then eFuse correction and the calibration table. Blocks on the DMA pool,
+// so it costs no CPU between frames.
+static void adcTaskMain(void* arg) {
+  AdcSensor* sensor = static_cast<AdcSensor*>(arg);
+  static uint8_t buf[kAdcFrameBytes];
+  uint32_t sum[2] = {0, 0};
+  uint16_t count[2] = {0, 0};
+
+  for (;;) {
+    uint32_t len = 0;
+    // ESP_ERR_INVALID_STATE: the pool overflowed earlier, this data is valid
+    const esp_err_t r = adc_digi_read_bytes(buf, sizeof(buf), &len, ADC_MAX_DELAY);
+    if (r != ESP_OK && r != ESP_ERR_INVALID_STATE) continue;
+
+    for (uint32_t k = 0; k + sizeof(adc_digi_output_data_t) <= len;
+         k += sizeof(adc_digi_output_data_t)) {
+      const adc_digi_output_data_t* d = (const adc_digi_output_data_t*)&buf[k];
+      if (d->type2.unit != 0) continue;
+
+      int slot = -1;
+      if (d->type2.channel == g_adcChV) slot = 0;
+      else if (d->type2.channel == g_adcChI) slot = 1;
+      if (slot < 0) continue;
+
+      sum[slot] += d->type2.data;
+      if (++count[slot] < kHwAdcOversample) continue;
+
+      const float pin_mV = adcRawToPin_mV((float)sum[slot] / count[slot]);
+      if (slot == 0) {
+        sensor->publish(true, adcCalApply(kHwVoltageCal, sizeof(kHwVoltageCal) / sizeof(kHwVoltageCal[0]), pin_mV));
+      } else {
+        sensor->publish(false, adcCalApply(kHwCurrentCal, sizeof(kHwCurrentCal) / sizeof(kHwCurrentCal[0]), pin_mV));
+      }
+      sum[slot] = 0;
+      count[slot] = 0;
+    }
   }
 }
 
-float Hw::readVoltageIna_V_() const {
-  return g_ina.getBusVoltage_V();
-}
-
-float Hw::readCurrentIna_A_() const {
-  return g_ina.getCurrent_mA() / 1000.0f;
-}
-
-#endif // HW_USE_INA219
-
-// ---------------------------
-// HW_SIM_MEASUREMENTS
-// ---------------------------
-#if HW_SIM_MEASUREMENTS
-
-float Hw::readVoltageSim_V() const {
-  static float v = SIM_START_V;
-  static uint32_t lastMs = 0;
-
-  const uint32_t now = millis();
-  if (lastMs == 0) lastMs = now;
-  const float dt_s = (now - lastMs) / 1000.0f;
-  lastMs = now;
+void AdcSensor::begin() {
+  g_adcChV = adc1Channel(kHwVoltageAdcPin);
+  g_adcChI = adc1Channel(kHwCurrentAdcPin);
+  if (g_adcChV < 0 && g_adcChI < 0) return;
+
+  // Per-chip correction burnt into eFuse (two-point on the C3)
+  const esp_adc_cal_value_t src = esp_adc_cal_characterize(
+      ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 0, &g_adcChars);
+  BT_LOGI(TAG, "ADC calibration: %s",
+          src == ESP_ADC_CAL_VAL_EFUSE_TP   ? "eFuse two-point" :
+          src == ESP_ADC_CAL_VAL_EFUSE_VREF ? "eFuse Vref" : "default Vref");
+
+  adc_digi_pattern_config_t pattern[2] = {};
+  uint32_t patterns = 0;
+  uint32_t mask = 0;
+  const int8_t channels[2] = {g_adcChV, g_adcChI};
+  for (int8_t ch : channels) {
+    if (ch < 0) continue;
+    pattern[patterns].atten = ADC_ATTEN_DB_11;
+    pattern[patterns].channel = (uint8_t)ch;
+    pattern[patterns].unit = 0;   // ADC1
+    pattern[patterns].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    patterns++;
+    mask |= 1u << ch;
+  }
 
-  if (chargeOn_ && !dischargeOn_) {
-    v += SIM_CHG_VPS * dt_s;
-  } else if (dischargeOn_ && !chargeOn_) {
-    v -= SIM_DCHG_VPS * dt_s;
-  } else {
-    // hold
+  adc_digi_init_config_t init = {};
+  init.max_store_buf_size = 4 * kAdcFrameBytes;
+  init.conv_num_each_intr = kAdcFrameBytes;
+  init.adc1_chan_mask = mask;
+  init.adc2_chan_mask = 0;
+
+  adc_digi_configuration_t cfg = {};
+  cfg.conv_limit_en = false;
+  cfg.conv_limit_num = 250;
+  cfg.pattern_num = patterns;
+  cfg.adc_pattern = pattern;
+  cfg.sample_freq_hz = kHwAdcSampleRate_Hz;
+  cfg.conv_mode = ADC_CONV_ALTER_UNIT;   // the C3 DMA path only supports this mode
+  cfg.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2;
+
+  if (adc_digi_initialize(&init) != ESP_OK || adc_digi_controller_configure(&cfg) != ESP_OK) {
+    BT_LOGE(TAG, "ADC DMA setup failed");
+    return;
   }
 
-  if (v < SIM_V_MIN) v = SIM_V_MIN;
-  if (v > SIM_V_MAX) v = SIM_V_MAX;
-  return v;
-}
+  TaskHandle_t handle = nullptr;
+  if (xTaskCreate(adcTaskMain, "adc", kHwAdcTaskStack, this,
+                  kHwAdcTaskPriority, &handle) != pdPASS) {
+    BT_LOGE(TAG, "ADC task not started");
+    return;
+  }
+  metricsRegisterTask("adc", handle);
 
-float Hw::readCurrentSim_A() const {
-  if (chargeOn_ && !dischargeOn_) return SIM_I_CHG_A;
-  if (dischargeOn_ && !chargeOn_) return SIM_I_DCHG_A;
-  return SIM_I_IDLE_A;
+  adc_digi_start();
 }
 
-#endif // HW_SIM_MEASUREMENTS
+#endif // HW_SENSOR_ADC
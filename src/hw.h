@@ -1,39 +1,223 @@
 #pragma once
+#include <stdint.h>
 #include <math.h>
+#include <atomic>
+#include "hw_backends.h"
+#ifndef BT_HOST
+  #include <freertos/FreeRTOS.h>
+  #include <freertos/semphr.h>
+#endif
 
-class Hw {
+// Sensor access is shared by loop() (Core, UI) and the safety task; a
+// register read must not be split by the other task (I2C pointer register).
+#ifndef BT_HOST
+class SensorLock {
 public:
-  void begin();
+  void begin() { if (!m_) m_ = xSemaphoreCreateMutex(); }
+  void lock() const { if (m_) xSemaphoreTake(m_, portMAX_DELAY); }
+  void unlock() const { if (m_) xSemaphoreGive(m_); }
+private:
+  SemaphoreHandle_t m_ = nullptr;
+};
+#else
+class SensorLock {   // host tools are single threaded
+public:
+  void begin() {}
+  void lock() const {}
+  void unlock() const {}
+};
+#endif
+
+// Result of a load step capture (see HwT::beginLoadStep()).
+struct StepCapture {
+  float vBefore_V = NAN;   // mean of the samples before the step
+  float iBefore_A = NAN;
+  float vAfter_V = NAN;    // mean of the samples after the settle time
+  float iAfter_A = NAN;
+  uint32_t settleActual_us = 0;  // step command -> first post-step sample
+  uint32_t offTime_us = 0;       // total time the output was switched off
+
+  // Step state between beginLoadStep() and endLoadStep()
+  bool discharge = false;        // output that was switched off
+  uint32_t stepUs = 0;           // micros() of the step command
+};
+
+// Hardware access with compile-time backends (hw_backends.h):
+// - Sensor: INA219, INA226, ADC, simulator or replay (HW_SENSOR)
+// - Actuator: GPIO relays or none (HW_USE_RELAIS)
+// All members are inline, so a read compiles straight into the backend call
+// without runtime backend checks.
+template <class Sensor, class Actuator>
+class HwT {
+public:
+  void begin() {
+    lock_.begin();
+    actuator_.begin();
+    sensor_.begin();
+    allOff();
+  }
+
+  void allOff()         { setOutputs_(false, false); }
+  void startCharge()    { setOutputs_(true, false); }
+  void stopCharge()     { setOutputs_(false, dischargeOn_.load()); }
+  void startDischarge() { setOutputs_(false, true); }
+  void stopDischarge()  { setOutputs_(chargeOn_.load(), false); }
+
+  // Reads are logically const; backends may keep state (model time, noise).
+  float readVoltage_V() const {
+    lock_.lock();
+    const float v = sensor_.readVoltage_V();
+    lock_.unlock();
+    return v;
+  }
+  float readCurrent_A() const {
+    lock_.lock();
+    const float i = sensor_.readCurrent_A();
+    lock_.unlock();
+    return i;
+  }
+
+  // Triggered conversions for the acquisition task (acquisition.h). Each
+  // call holds the sensor lock on its own, so loop() and the safety task can
+  // read between the trigger and the result.
+  void beginTriggered() { lock_.lock(); sensor_.beginTriggered(); lock_.unlock(); }
+  void endTriggered()   { lock_.lock(); sensor_.endTriggered();   lock_.unlock(); }
+  bool trigger() {
+    lock_.lock();
+    const bool ok = sensor_.trigger();
+    lock_.unlock();
+    return ok;
+  }
+  bool readTriggered(float& v, float& i) {
+    lock_.lock();
+    const bool ready = sensor_.readTriggered(v, i);
+    lock_.unlock();
+    return ready;
+  }
+
+  bool isChargeOn() const { return chargeOn_.load(); }
+  bool isDischargeOn() const { return dischargeOn_.load(); }
 
-  void allOff();
-  void startCharge();
-  void stopCharge();
-  void startDischarge();
-  void stopDischarge();
+  // Safety interlock: trip() switches everything off at once (safety task)
+  // and keeps outputs off until release(), whatever Core or the SM request.
+  void trip() {
+    interlock_.store(true);
+    actuator_.writeCharge(false);
+    actuator_.writeDischarge(false);
+    chargeOn_.store(false);
+    dischargeOn_.store(false);
 
-  float readVoltage_V() const;
-  float readCurrent_A() const;
+    lock_.lock();   // after the outputs: never wait for the bus first
+    sensor_.outputsChanging(false, false);
+    lock_.unlock();
+  }
+  void release() { interlock_.store(false); }
+  bool interlocked() const { return interlock_.load(); }
 
-  bool isChargeOn() const { return chargeOn_; }
-  bool isDischargeOn() const { return dischargeOn_; }
+  // Load step for DC internal resistance, in two halves so the caller can
+  // let the settle time pass without blocking:
+  // - beginLoadStep(): sample V/I with the active output (discharge load or
+  //   charger) on, then switch it off. Returns false if no output is active.
+  // - endLoadStep(): sample V/I with the output off, then restore it (unless
+  //   the safety interlock tripped in between).
+  bool beginLoadStep(uint8_t samples, StepCapture& out);
+  void endLoadStep(uint8_t samples, StepCapture& out);
+
+  // Replay backend: next values returned by the reads.
+  void injectSample(float voltage_V, float current_A) { sensor_.inject(voltage_V, current_A); }
+
+  Sensor& sensor() { return sensor_; }
 
 private:
-  bool chargeOn_ = false;
-  bool dischargeOn_ = false;
+  mutable Sensor sensor_;
+  Actuator actuator_;
+  SensorLock lock_;
+  std::atomic<bool> interlock_{false};
 
-  // INA219 runtime status (exists even if INA is compiled out)
-  bool inaOk_ = false;
+  // Output state (also read, and cleared by trip(), in the safety task)
+  std::atomic<bool> chargeOn_{false};
+  std::atomic<bool> dischargeOn_{false};
 
-  void writeCharge(bool on);
-  void writeDischarge(bool on);
-  float readAdcNormalized(int pin) const;
+  void sampleMean_(uint8_t samples, float& vOut, float& iOut);
 
-  // Declared always, defined only if enabled in hw.cpp
-  void initIna219_();
-  float readVoltageIna_V_() const;
-  float readCurrentIna_A_() const;
+  // Break before make: switch off first, then on. A trip() while we wait
+  // for the lock (acquisition I2C polling) is caught by the second check
+  // after the writes; trip() sets interlock_ before its own writes, so one
+  // of the two sides always switches off last.
+  void setOutputs_(bool chargeOn, bool dischargeOn) {
+    if (interlock_.load()) {
+      chargeOn = false;
+      dischargeOn = false;
+    }
+    lock_.lock();   // the simulator integrates its model here
+    sensor_.outputsChanging(chargeOn, dischargeOn);
+    lock_.unlock();
+    if (!chargeOn) actuator_.writeCharge(false);
+    if (!dischargeOn) actuator_.writeDischarge(false);
+    if (chargeOn) actuator_.writeCharge(true);
+    if (dischargeOn) actuator_.writeDischarge(true);
+    chargeOn_.store(chargeOn);
+    dischargeOn_.store(dischargeOn);
 
-  // Declared always, defined only if HW_SIM_MEASUREMENTS in hw.cpp
-  float readVoltageSim_V() const;
-  float readCurrentSim_A() const;
+    if ((chargeOn || dischargeOn) && interlock_.load()) {
+      actuator_.writeCharge(false);
+      actuator_.writeDischarge(false);
+      chargeOn_.store(false);
+      dischargeOn_.store(false);
+      lock_.lock();
+      sensor_.outputsChanging(false, false);
+      lock_.unlock();
+    }
+  }
 };
+
+// Average n V/I pairs, spaced by the sensor conversion time (a few ms at
+// most, so plain busy-wait timing).
+template <class Sensor, class Actuator>
+void HwT<Sensor, Actuator>::sampleMean_(uint8_t samples, float& vOut, float& iOut) {
+  if (samples == 0) samples = 1;
+  float vs = 0.0f, is = 0.0f;
+  for (uint8_t k = 0; k < samples; ++k) {
+    if (k > 0) delayMicroseconds(kIrSampleSpacing_us);
+    vs += readVoltage_V();
+    is += readCurrent_A();
+  }
+  vOut = vs / samples;
+  iOut = is / samples;
+}
+
+template <class Sensor, class Actuator>
+bool HwT<Sensor, Actuator>::beginLoadStep(uint8_t samples, StepCapture& out) {
+  ScopedTimer t(MetricId::IrPulse);
+
+  const bool dsg = dischargeOn_.load();
+  const bool chg = chargeOn_.load();
+  if (!dsg && !chg) return false;
+
+  // Before step (output on)
+  sampleMean_(samples, out.vBefore_V, out.iBefore_A);
+
+  // Step: output off
+  out.discharge = dsg;
+  out.stepUs = micros();
+  if (dsg) stopDischarge(); else stopCharge();
+  return true;
+}
+
+template <class Sensor, class Actuator>
+void HwT<Sensor, Actuator>::endLoadStep(uint8_t samples, StepCapture& out) {
+  ScopedTimer t(MetricId::IrPulse);
+
+  out.settleActual_us = micros() - out.stepUs;
+
+  // After step (output off)
+  sampleMean_(samples, out.vAfter_V, out.iAfter_A);
+
+  // Restore previous output
+  if (out.discharge) startDischarge(); else startCharge();
+  out.offTime_us = micros() - out.stepUs;
+}
+
+// The backend of this build. A class (not an alias) so other headers can
+// keep forward-declaring `class Hw`.
+class Hw final : public HwT<HwSensor, HwActuator> {};
@@ -0,0 +1,358 @@
+#pragma once
+#include <Arduino.h>
+#include <math.h>
+#include <atomic>
+#include "config.h"
+#include "metrics.h"
+#include "sim_battery.h"
+#include "clock.h"
+
+// Sensor and actuator policies for HwT (hw.h).
+//
+// Sensor policy:
+//   void  begin();
+//   float readVoltage_V();
+//   float readCurrent_A();                 // magnitude, like the INA wiring
+//   void  outputsChanging(bool chargeOn, bool dischargeOn);   // before a switch
+//
+//   Triggered conversions (transient capture, acquisition.h):
+//   void  beginTriggered();                // switch to triggered mode
+//   void  endTriggered();                  // back to normal reads
+//   bool  trigger();                       // start one conversion
+//   bool  readTriggered(float& v, float& i);   // false until the result is ready
+//   Backends without a conversion-ready flag read on the first call.
+//
+// Actuator policy:
+//   void begin();
+//   void writeCharge(bool on);
+//   void writeDischarge(bool on);
+//
+// Everything on the sample path is defined here so it inlines into Core;
+// only library initialisation lives in hw.cpp. Backends that need a driver
+// library are compiled only when selected via HW_SENSOR (config.h).
+
+#if HW_SENSOR == HW_SENSOR_INA219
+  #include <Wire.h>
+  #include <Adafruit_INA219.h>
+#elif HW_SENSOR == HW_SENSOR_INA226
+  #include <Wire.h>
+#endif
+
+// ---------------------------------------------------------------------------
+// Sensors
+// ---------------------------------------------------------------------------
+
+#if HW_SENSOR == HW_SENSOR_INA219
+
+// INA219 via the Adafruit driver. Reads return NaN if the chip did not answer.
+class Ina219Sensor {
+public:
+  void begin();   // hw.cpp
+
+  float readVoltage_V() {
+    if (!ok_) return NAN;
+    ScopedTimer t(MetricId::SensorRead);
+    return ina_.getBusVoltage_V();
+  }
+
+  float readCurrent_A() {
+    if (!ok_) return NAN;
+    ScopedTimer t(MetricId::SensorRead);
+    return ina_.getCurrent_mA() / 1000.0f;
+  }
+
+  void outputsChanging(bool, bool) {}
+
+  // Triggered mode uses raw registers: writing the config register starts
+  // one bus + shunt conversion, CNVR in the bus register flags the result.
+  void beginTriggered() { trigger(); }
+  void endTriggered();   // hw.cpp (continuous mode with the calibration preset)
+
+  bool trigger() {
+    return ok_ && writeReg_(kRegConfig, kHwIna219AcqConfig);
+  }
+
+  bool readTriggered(float& v, float& i) {
+    if (!ok_) return false;
+    ScopedTimer t(MetricId::SensorRead);
+    int16_t bus, shunt;
+    if (!readReg_(kRegBus, bus)) return false;
+    if (!(bus & kBusCnvr)) return false;
+    if (!readReg_(kRegShunt, shunt)) return false;
+    v = ((uint16_t)bus >> 3) * 4e-3f;                       // 4 mV / LSB
+    i = fabsf(shunt * 10e-6f / kHwIna219Shunt_Ohm);         // 10 uV / LSB
+    return true;
+  }
+
+private:
+  static constexpr uint8_t kRegConfig = 0x00;
+  static constexpr uint8_t kRegShunt = 0x01;
+  static constexpr uint8_t kRegBus = 0x02;
+  static constexpr int16_t kBusCnvr = 0x0002;
+
+  Adafruit_INA219 ina_{kHwIna219Addr};
+  bool ok_ = false;
+
+  bool readReg_(uint8_t reg, int16_t& out) {
+    Wire.beginTransmission(kHwIna219Addr);
+    Wire.write(reg);
+    if (Wire.endTransmission(false) != 0) return false;
+    if (Wire.requestFrom(kHwIna219Addr, (size_t)2) != 2) return false;
+    const uint8_t hi = Wire.read();
+    const uint8_t lo = Wire.read();
+    out = (int16_t)(((uint16_t)hi << 8) | lo);
+    return true;
+  }
+
+  bool writeReg_(uint8_t reg, uint16_t value) {
+    Wire.beginTransmission(kHwIna219Addr);
+    Wire.write(reg);
+    Wire.write((uint8_t)(value >> 8));
+    Wire.write((uint8_t)(value & 0xFF));
+    return Wire.endTransmission() == 0;
+  }
+};
+
+#endif
+
+#if HW_SENSOR == HW_SENSOR_INA226
+
+// INA226 with raw register access (no driver library needed).
+// Current is computed from the shunt voltage, so no calibration register.
+class Ina226Sensor {
+public:
+  void begin();   // hw.cpp
+
+  float readVoltage_V() {
+    if (!ok_) return NAN;
+    ScopedTimer t(MetricId::SensorRead);
+    int16_t raw;
+    if (!readReg_(kRegBus, raw)) return NAN;
+    return (uint16_t)raw * 1.25e-3f;                        // 1.25 mV / LSB
+  }
+
+  float readCurrent_A() {
+    if (!ok_) return NAN;
+    ScopedTimer t(MetricId::SensorRead);
+    int16_t raw;
+    if (!readReg_(kRegShunt, raw)) return NAN;
+    return fabsf(raw * 2.5e-6f / kHwIna226Shunt_Ohm);       // 2.5 uV / LSB
+  }
+
+  void outputsChanging(bool, bool) {}
+
+  // Triggered conversions: continuous mode, the latest values are read
+  void beginTriggered() {}
+  void endTriggered() {}
+  bool trigger() { return true; }
+  bool readTriggered(float& v, float& i) {
+    v = readVoltage_V();
+    i = readCurrent_A();
+    return true;
+  }
+
+private:
+  static constexpr uint8_t kRegConfig = 0x00;
+  static constexpr uint8_t kRegShunt = 0x01;
+  static constexpr uint8_t kRegBus = 0x02;
+
+  bool ok_ = false;
+
+  bool readReg_(uint8_t reg, int16_t& out) {
+    Wire.beginTransmission(kHwIna226Addr);
+    Wire.write(reg);
+    if (Wire.endTransmission(false) != 0) return false;
+    if (Wire.requestFrom(kHwIna226Addr, (size_t)2) != 2) return false;
+    const uint8_t hi = Wire.read();
+    const uint8_t lo = Wire.read();
+    out = (int16_t)(((uint16_t)hi << 8) | lo);
+    return true;
+  }
+};
+
+#endif
+
+#if HW_SENSOR == HW_SENSOR_ADC
+
+// ADC1 in continuous (DMA) mode: both channels are oversampled at
+// kHwAdcSampleRate_Hz and decimated by a small task (hw.cpp), which
+// publishes one calibrated value per kHwAdcOversample samples. Reads only
+// load the latest value. Pins < 0 = not wired, reads NaN (also until the
+// first block is complete).
+class AdcSensor {
+public:
+  void begin();   // hw.cpp
+
+  float readVoltage_V() { return voltage_V_.load(std::memory_order_relaxed); }
+  float readCurrent_A() { return current_A_.load(std::memory_order_relaxed); }
+
+  void outputsChanging(bool, bool) {}
+
+  // Triggered conversions: the latest decimated values
+  void beginTriggered() {}
+  void endTriggered() {}
+  bool trigger() { return true; }
+  bool readTriggered(float& v, float& i) {
+    v = readVoltage_V();
+    i = readCurrent_A();
+    return true;
+  }
+
+  // Called by the decimation task only (hw.cpp)
+  void publish(bool voltage, float value) {
+    (voltage ? voltage_V_ : current_A_).store(value, std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<float> voltage_V_{NAN};
+  std::atomic<float> current_A_{NAN};
+};
+
+#endif
+
+// Equivalent-circuit battery model driven by the output states.
+class SimSensor {
+public:
+  void begin() {
+    SimBatteryParams p;
+    p.ocv = kSimOcvTable;
+    p.ocvPoints = sizeof(kSimOcvTable) / sizeof(kSimOcvTable[0]);
+    p.capacity_Ah = kSimCapacity_Ah;
+    p.startSoc = kSimStartSoc;
+    p.r0_Ohm = kSimR0_Ohm;
+    p.r1_Ohm = kSimR1_Ohm;
+    p.c1_F = kSimC1_F;
+    p.chargerCv_V = kSimChargerCv_V;
+    p.chargeCurrent_A = kSimCurrentCharge_A;
+    p.dischargeCurrent_A = kSimCurrentDischarge_A;
+    p.idleCurrent_A = kSimCurrentIdle_A;
+    p.noiseV_V = kSimNoise_V;
+    p.noiseI_A = kSimNoise_A;
+    p.seed = kSimSeed;
+
+    sim_.begin(p);
+    lastMs_ = clockNow_ms();
+  }
+
+  float readVoltage_V() { advance_(); return sim_.readVoltage_V(); }
+  float readCurrent_A() { advance_(); return sim_.readCurrent_A(); }
+
+  // Integrate up to the switching instant with the old state
+  void outputsChanging(bool chargeOn, bool dischargeOn) {
+    advance_();
+    chargeOn_ = chargeOn;
+    dischargeOn_ = dischargeOn;
+  }
+
+  // Triggered conversions: the model state at the read
+  void beginTriggered() {}
+  void endTriggered() {}
+  bool trigger() { return true; }
+  bool readTriggered(float& v, float& i) {
+    v = readVoltage_V();
+    i = readCurrent_A();
+    return true;
+  }
+
+  const SimBattery& model() const { return sim_; }
+
+private:
+  SimBattery sim_;
+  uint64_t lastMs_ = 0;
+  bool chargeOn_ = false;
+  bool dischargeOn_ = false;
+
+  void advance_() {
+    const uint64_t now = clockNow_ms();
+    const float dt_s = (float)(now - lastMs_) / 1000.0f;
+    lastMs_ = now;
+    sim_.step(dt_s, chargeOn_, dischargeOn_);
+  }
+};
+
+// Injected values (host replay tool, host benchmarks as a mock backend).
+class ReplaySensor {
+public:
+  void begin() {}
+
+  float readVoltage_V() { return v_; }
+  float readCurrent_A() { return i_; }
+
+  void outputsChanging(bool, bool) {}
+
+  // Triggered conversions: the injected values
+  void beginTriggered() {}
+  void endTriggered() {}
+  bool trigger() { return true; }
+  bool readTriggered(float& v, float& i) {
+    v = readVoltage_V();
+    i = readCurrent_A();
+    return true;
+  }
+
+  void inject(float voltage_V, float current_A) {
+    v_ = voltage_V;
+    i_ = current_A;
+  }
+
+private:
+  float v_ = NAN;
+  float i_ = NAN;
+};
+
+// ---------------------------------------------------------------------------
+// Actuators
+// ---------------------------------------------------------------------------
+
+// Relays / MOSFETs on GPIOs (pins < 0 = not wired).
+class GpioActuator {
+public:
+  void begin() {
+    if (kHwChargePin >= 0) pinMode(kHwChargePin, OUTPUT);
+    if (kHwDischargePin >= 0) pinMode(kHwDischargePin, OUTPUT);
+  }
+
+  void writeCharge(bool on) {
+    if (kHwChargePin < 0) return;
+    const bool level = kHwChargeActiveHigh ? on : !on;
+    digitalWrite(kHwChargePin, level ? HIGH : LOW);
+  }
+
+  void writeDischarge(bool on) {
+    if (kHwDischargePin < 0) return;
+    const bool level = kHwDischargeActiveHigh ? on : !on;
+    digitalWrite(kHwDischargePin, level ? HIGH : LOW);
+  }
+};
+
+// No outputs (HW_USE_RELAIS=0: testing, simulation, host builds).
+class NullActuator {
+public:
+  void begin() {}
+  void writeCharge(bool) {}
+  void writeDischarge(bool) {}
+};
+
+// ---------------------------------------------------------------------------
+// Selection
+// ---------------------------------------------------------------------------
+
+#if HW_SENSOR == HW_SENSOR_INA219
+  using HwSensor = Ina219Sensor;
+#elif HW_SENSOR == HW_SENSOR_INA226
+  using HwSensor = Ina226Sensor;
+#elif HW_SENSOR == HW_SENSOR_ADC
+  using HwSensor = AdcSensor;
+#elif HW_SENSOR == HW_SENSOR_SIM
+  using HwSensor = SimSensor;
+#elif HW_SENSOR == HW_SENSOR_REPLAY
+  using HwSensor = ReplaySensor;
+#else
+  #error "Unknown HW_SENSOR"
+#endif
+
+#if HW_USE_RELAIS
+  using HwActuator = GpioActuator;
+#else
+  using HwActuator = NullActuator;
+#endif
@@ -1,5 +1,8 @@
 #include "log_buffer.h"
 #include <Arduino.h> // for Print
+#include <string.h>
+#include <math.h>
+#include <atomic>
 
 // ---- Little-endian helpers -----------------------------------------------
 // We store all multi-byte values in little-endian format to keep the layout
@@ -51,31 +54,66 @@ static float readF32LE(const uint8_t* p) {
 LogBuffer::LogBuffer(uint8_t* storage,
                      size_t storageBytes,
                      const ColDef* schema,
-                     size_t schemaCols)
+                     size_t schemaCols,
+                     LogLayout layout)
   : buf_(storage),
     bufBytes_(storageBytes),
     schema_(schema),
-    cols_(schemaCols) {
+    cols_(schemaCols),
+    layout_(layout) {
 
-  // Compute packed row size from schema definition
+  // More columns than a LogQuery mask can address: unusable
+  if (cols_ > kMaxCols) {
+    cols_ = 0;
+  }
+
+  // Compute packed row size and column offsets from schema definition.
+  // ColumnMajor: column i starts at capRows_ * colOff_[i] (see cell_()).
   rowBytes_ = 0;
   for (size_t i = 0; i < cols_; ++i) {
+    colOff_[i] = (uint16_t)rowBytes_;
     rowBytes_ += colSize_(schema_[i].type);
   }
 
-  // Calculate how many rows fit into the provided RAM block
-  capRows_ = (rowBytes_ > 0) ? (bufBytes_ / rowBytes_) : 0;
+  setStorage(storage, storageBytes);
+}
+
+void LogBuffer::setStorage(uint8_t* storage, size_t storageBytes) {
+  buf_ = storage;
+  bufBytes_ = storage ? storageBytes : 0;
+
+  // Calculate how many rows fit into the provided RAM block (same for both
+  // layouts: a column segment is capRows_ cells). Each min/max deque needs
+  // one row index per row; the deques follow the cells, 4-byte aligned.
+  const size_t dequeBytes = trackedCount_ * 2 * sizeof(uint32_t);
+  size_t usable = bufBytes_;
+  if (dequeBytes > 0) usable = (bufBytes_ > 3) ? bufBytes_ - 3 : 0;
+  capRows_ = (rowBytes_ > 0) ? (usable / (rowBytes_ + dequeBytes)) : 0;
+
+  uintptr_t p = ((uintptr_t)(buf_ + capRows_ * rowBytes_) + 3) & ~(uintptr_t)3;
+  for (size_t t = 0; t < trackedCount_; ++t) {
+    tracked_[t].min.q = (uint32_t*)p;
+    p += capRows_ * sizeof(uint32_t);
+    tracked_[t].max.q = (uint32_t*)p;
+    p += capRows_ * sizeof(uint32_t);
+  }
 
+  // Held rows are gone; the sequence numbers keep counting so readers see
+  // them as lost
   clear();
 }
 
 void LogBuffer::clear() {
-  // Reset ring buffer pointers
+  // Rows before the next one are gone for readers; ring row 0 holds it
+  floor_.store(committed_.load(std::memory_order_relaxed), std::memory_order_release);
+
+  // Reset ring buffer pointers (sequence numbers keep counting)
   head_ = 0;
   size_ = 0;
+  statsReset_();
 }
 
-size_t LogBuffer::colSize_(ColType t) const {
+size_t LogBuffer::colSize_(ColType t) {
   // Return storage size per column type
   switch (t) {
     case ColType::U8:  return 1;
@@ -97,105 +135,488 @@ bool LogBuffer::store(const ColValue* values, size_t valuesCount) {
     return false;
   }
 
-  // Compute destination row pointer
-  uint8_t* row = buf_ + (head_ * rowBytes_);
+  // Buffer full: the oldest row (at head_) leaves the window before its
+  // cells are overwritten
+  if (size_ == capRows_) {
+    statsEvict_(head_);
+    size_--;
+  }
+
+  // Announce the write before touching the ring row: a reader copying the
+  // row it replaces sees pending_ moved on and drops its copy
+  const uint32_t seq = committed_.load(std::memory_order_relaxed);
+  pending_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
 
-  // Encode typed values into packed row
-  encodeRow_(row, values);
+  // Encode typed values into the cells of ring row head_
+  encodeRow_(head_, values);
+  statsAdd_(head_);
 
   // Advance ring buffer write pointer
   head_ = (head_ + 1) % capRows_;
+  size_++;
 
-  // Increase valid row count until buffer is full
-  if (size_ < capRows_) {
-    size_++;
-  }
+  // Publish the complete row
+  committed_.store(seq + 1, std::memory_order_release);
   return true;
 }
 
+LogSnapshot LogBuffer::snapshot() const {
+  LogSnapshot snap;
+  const uint32_t floor = floor_.load(std::memory_order_acquire);
+  snap.end = committed_.load(std::memory_order_acquire);
+
+  // Oldest held row: capRows_ back from the newest, not before a clear()
+  const uint32_t since = snap.end - floor;
+  snap.first = (since > capRows_) ? snap.end - (uint32_t)capRows_ : floor;
+  return snap;
+}
+
+// Row seq not cleared and its ring row not (being) reused by a newer row
+bool LogBuffer::intact_(uint32_t seq, uint32_t floor) const {
+  return floor_.load(std::memory_order_relaxed) == floor &&
+         (int32_t)(seq + (uint32_t)capRows_ - pending_.load(std::memory_order_relaxed)) >= 0;
+}
+
+// Seqlock read: check, copy the cells of the columns in `cols`, check again.
+bool LogBuffer::copyRow_(uint32_t seq, ColValue* values, uint32_t cols) const {
+  if (capRows_ == 0) return false;
+
+  const uint32_t floor = floor_.load(std::memory_order_acquire);
+  const uint32_t end = committed_.load(std::memory_order_acquire);
+  if ((int32_t)(seq - floor) < 0 || (int32_t)(end - seq) <= 0) return false;
+  if (!intact_(seq, floor)) return false;
+
+  const size_t row = (seq - floor) % capRows_;
+  for (size_t i = 0; i < cols_; ++i) {
+    if (cols & (1u << i)) decodeCell_(row, i, values[i]);
+  }
+
+  // Cells read before the re-check (pairs with the fence in store())
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return intact_(seq, floor);
+}
+
+bool LogBuffer::readRow(uint32_t seq, ColValue* values, size_t valuesCount) const {
+  if (valuesCount != cols_) return false;
+  return copyRow_(seq, values, 0xFFFFFFFFu);
+}
+
 size_t LogBuffer::oldestRow_() const {
   // Oldest row is head - size (modulo capacity)
   return (head_ + capRows_ - size_) % capRows_;
 }
 
-void LogBuffer::encodeRow_(uint8_t* dst, const ColValue* values) const {
-  // Pack all column values sequentially into the row buffer
-  size_t off = 0;
-
+void LogBuffer::encodeRow_(size_t row, const ColValue* values) {
+  // Pack each column value into its cell
   for (size_t i = 0; i < cols_; ++i) {
-    const ColType t = schema_[i].type;
+    uint8_t* dst = cell_(row, i);
 
-    switch (t) {
+    switch (schema_[i].type) {
       case ColType::U8:
-        dst[off] = values[i].u8;
-        off += 1;
+        dst[0] = values[i].u8;
         break;
 
       case ColType::U16:
-        writeU16LE(dst + off, values[i].u16);
-        off += 2;
+        writeU16LE(dst, values[i].u16);
         break;
 
       case ColType::U32:
-        writeU32LE(dst + off, values[i].u32);
-        off += 4;
+        writeU32LE(dst, values[i].u32);
         break;
 
       case ColType::F32:
-        writeF32LE(dst + off, values[i].f32);
-        off += 4;
+        writeF32LE(dst, values[i].f32);
         break;
     }
   }
 }
 
-void LogBuffer::printCsv(Print& out) const {
+void LogBuffer::decodeCell_(size_t row, size_t col, ColValue& v) const {
+  // Inverse of encodeRow_() for one cell
+  const uint8_t* src = cell_(row, col);
+
+  switch (schema_[col].type) {
+    case ColType::U8:
+      v.u8 = src[0];
+      break;
+
+    case ColType::U16:
+      v.u16 = readU16LE(src);
+      break;
+
+    case ColType::U32:
+      v.u32 = readU32LE(src);
+      break;
+
+    case ColType::F32:
+      v.f32 = readF32LE(src);
+      break;
+  }
+}
+
+int LogBuffer::colIndex(const char* name) const {
+  for (size_t i = 0; i < cols_; ++i) {
+    if (strcmp(schema_[i].name, name) == 0) return (int)i;
+  }
+  return -1;
+}
+
+uint32_t LogBuffer::readUint_(size_t col, size_t row) const {
+  // Unsigned integer cell (F32 columns are not used as filters)
+  const uint8_t* p = cell_(row, col);
+  switch (schema_[col].type) {
+    case ColType::U8:  return p[0];
+    case ColType::U16: return readU16LE(p);
+    case ColType::U32: return readU32LE(p);
+    case ColType::F32: break;
+  }
+  return 0;
+}
+
+// Unsigned integer value (F32 columns are not used as filters)
+static uint32_t valueUint(ColType t, const ColValue& v) {
+  switch (t) {
+    case ColType::U8:  return v.u8;
+    case ColType::U16: return v.u16;
+    case ColType::U32: return v.u32;
+    case ColType::F32: break;
+  }
+  return 0;
+}
+
+bool LogBuffer::matches_(const LogQuery& q, const ColValue* values) const {
+  for (uint8_t r = 0; r < q.rangeCount; ++r) {
+    const LogQuery::Range& f = q.ranges[r];
+    if (f.col >= cols_) continue;
+    const uint32_t v = valueUint(schema_[f.col].type, values[f.col]);
+    if (v < f.lo || v > f.hi) return false;
+  }
+  return true;
+}
+
+uint32_t LogBuffer::printCsv(Print& out, const LogQuery& q) const {
+  // 0 = all columns
+  const uint32_t all = (cols_ >= 32) ? 0xFFFFFFFFu : ((1u << cols_) - 1u);
+  const uint32_t cols = (q.cols & all) ? (q.cols & all) : all;
+
   // Print CSV header using schema names
+  bool first = true;
   for (size_t i = 0; i < cols_; ++i) {
+    if (!(cols & (1u << i))) continue;
+    if (!first) out.print(',');
     out.print(schema_[i].name);
-    out.print((i + 1 < cols_) ? ',' : '\n');
+    first = false;
+  }
+  out.print('\n');
+
+  // Cells to copy per row: output and filter columns
+  uint32_t need = cols;
+  for (uint8_t r = 0; r < q.rangeCount; ++r) {
+    if (q.ranges[r].col < cols_) need |= (1u << q.ranges[r].col);
+  }
+
+  // Rows held now, within the query's range; rows stored from here on
+  // are not part of this export
+  LogQuery pinned = q;
+  pinned.pin(snapshot());
+
+  const uint16_t every = q.every ? q.every : 1;
+  uint32_t matched = 0;
+  uint32_t lost = 0;
+
+  // Print matching rows from oldest to newest
+  ColValue values[kMaxCols];
+  for (uint32_t seq = pinned.seqFirst; seq != pinned.seqEnd; ++seq) {
+    if (!copyRow_(seq, values, need)) {
+      lost++;   // overwritten by the ring in the meantime
+      continue;
+    }
+
+    if (!matches_(q, values)) continue;
+    if (matched++ % every != 0) continue;   // keep the 1st, (every+1)-th, ...
+    printRowCsv_(out, values, cols);
   }
+  return lost;
+}
 
-  // Print stored rows from oldest to newest
-  if (empty()) return;
+void LogBuffer::printRowCsv_(Print& out, const ColValue* values, uint32_t cols) const {
+  // Print the selected cells of one row
+  bool first = true;
 
+  for (size_t i = 0; i < cols_; ++i) {
+    if (!(cols & (1u << i))) continue;
+    if (!first) out.print(',');
+    printCell_(out, schema_[i].type, values[i]);
+    first = false;
+  }
+  out.print('\n');
+}
+
+// ---- Column scans -----------------------------------------------------------
+// The held rows are at most two runs of ring rows: [oldest, capRows_) and
+// [0, head_). Within a run the cells of one column are `stride` bytes
+// apart; with ColumnMajor that is the cell size, i.e. a dense array the
+// compiler turns into plain loads (the LE helpers fold into one load on
+// little-endian targets).
+
+static float cellAsFloat(ColType t, const uint8_t* p) {
+  switch (t) {
+    case ColType::U8:  return (float)p[0];
+    case ColType::U16: return (float)readU16LE(p);
+    case ColType::U32: return (float)readU32LE(p);
+    case ColType::F32: return readF32LE(p);
+  }
+  return NAN;
+}
+
+// Min/max over n cells; F32 and dense runs get their own loops.
+static void scanMinMax(ColType t, const uint8_t* p, size_t stride, size_t n,
+                       float& lo, float& hi, bool& any) {
+  if (t == ColType::F32 && stride == 4) {
+    for (size_t k = 0; k < n; ++k, p += 4) {
+      const float v = readF32LE(p);
+      if (isnan(v)) continue;
+      if (v < lo) lo = v;
+      if (v > hi) hi = v;
+      any = true;
+    }
+    return;
+  }
+  for (size_t k = 0; k < n; ++k, p += stride) {
+    const float v = cellAsFloat(t, p);
+    if (isnan(v)) continue;
+    if (v < lo) lo = v;
+    if (v > hi) hi = v;
+    any = true;
+  }
+}
+
+bool LogBuffer::colMinMax(size_t col, float& lo, float& hi) const {
+  if (col >= cols_ || empty()) return false;
+
+  const ColType t = schema_[col].type;
+  const size_t stride = cellStride_(col);
   const size_t oldest = oldestRow_();
-  for (size_t k = 0; k < size_; ++k) {
-    const size_t rowIndex = (oldest + k) % capRows_;
-    const uint8_t* row = buf_ + (rowIndex * rowBytes_);
-    printRowCsv_(out, row);
+  const size_t run1 = (oldest + size_ <= capRows_) ? size_ : capRows_ - oldest;
+
+  bool any = false;
+  lo = INFINITY;
+  hi = -INFINITY;
+  scanMinMax(t, cell_(oldest, col), stride, run1, lo, hi, any);
+  if (run1 < size_) scanMinMax(t, cell_(0, col), stride, size_ - run1, lo, hi, any);
+  return any;
+}
+
+size_t LogBuffer::readCol(size_t col, uint32_t firstSeq, float* out, size_t n) const {
+  if (col >= cols_ || empty()) return 0;
+
+  // Start row relative to the oldest held one
+  const int32_t d = (int32_t)(firstSeq - oldestSeq());
+  const size_t k0 = (d <= 0) ? 0 : (size_t)d;
+  if (k0 >= size_) return 0;
+  if (n > size_ - k0) n = size_ - k0;
+
+  const ColType t = schema_[col].type;
+  const size_t stride = cellStride_(col);
+  size_t row = (oldestRow_() + k0) % capRows_;
+  size_t done = 0;
+
+  while (done < n) {
+    // Up to the end of the ring, then continue at row 0
+    size_t run = capRows_ - row;
+    if (run > n - done) run = n - done;
+
+    const uint8_t* p = cell_(row, col);
+    if (t == ColType::F32 && stride == 4) {
+      for (size_t k = 0; k < run; ++k, p += 4) out[done + k] = readF32LE(p);
+    } else {
+      for (size_t k = 0; k < run; ++k, p += stride) out[done + k] = cellAsFloat(t, p);
+    }
+    done += run;
+    row = 0;
   }
+  return n;
 }
 
-void LogBuffer::printRowCsv_(Print& out, const uint8_t* row) const {
-  // Print one CSV row by decoding each column
-  size_t off = 0;
+// ---- Window statistics ------------------------------------------------------
+
+float LogBuffer::cellFloat_(size_t row, size_t col) const {
+  return cellAsFloat(schema_[col].type, cell_(row, col));
+}
+
+bool LogBuffer::trackMinMax(size_t col) {
+  if (col >= cols_ || schema_[col].type != ColType::F32) return false;
+  for (size_t t = 0; t < trackedCount_; ++t) {
+    if (tracked_[t].col == col) return true;
+  }
+  if (trackedCount_ >= kMaxTracked) return false;
+
+  tracked_[trackedCount_++].col = (uint8_t)col;
+  setStorage(buf_, bufBytes_);   // deques take their share of the storage
+  return true;
+}
+
+bool LogBuffer::trackEnergy(size_t timeCol, size_t energyCol, size_t phaseCol,
+                            uint8_t chargePhase, uint8_t dischargePhase, uint32_t segmentCols) {
+  if (timeCol >= cols_ || energyCol >= cols_ || phaseCol >= cols_) return false;
+  if (schema_[timeCol].type == ColType::F32 ||
+      schema_[energyCol].type != ColType::F32 ||
+      schema_[phaseCol].type == ColType::F32) {
+    return false;
+  }
+
+  timeCol_ = (uint8_t)timeCol;
+  energyCol_ = (uint8_t)energyCol;
+  phaseCol_ = (uint8_t)phaseCol;
+  chargePhase_ = chargePhase;
+  dischargePhase_ = dischargePhase;
+  segmentCols_ = segmentCols;
+  energyOn_ = true;
+  clear();
+  return true;
+}
+
+void LogBuffer::statsReset_() {
+  for (size_t i = 0; i < kMaxCols; ++i) {
+    sums_[i] = RunningSum();
+    counts_[i] = 0;
+  }
+  for (size_t t = 0; t < trackedCount_; ++t) {
+    tracked_[t].min.head = tracked_[t].min.size = 0;
+    tracked_[t].max.head = tracked_[t].max.size = 0;
+  }
+  energyChg_ = RunningSum();
+  energyDsg_ = RunningSum();
+}
+
+// Energy between ring row `row` and the following row `next`, from the
+// per-phase energy column. Added when `next` is stored, subtracted when
+// `row` is evicted - the same value both times.
+float LogBuffer::energyStep_(size_t row, size_t next) const {
+  const float e1 = fabsf(cellFloat_(next, energyCol_));
+  if (isnan(e1)) return 0.0f;
+  const float e0 = fabsf(cellFloat_(row, energyCol_));
+
+  // New phase in between: everything it integrated so far lies after `row`
+  bool newPhase = isnan(e0) || e1 < e0;
+  for (size_t c = 0; c < cols_ && !newPhase; ++c) {
+    if ((segmentCols_ & (1u << c)) && readUint_(c, row) != readUint_(c, next)) newPhase = true;
+  }
+  return newPhase ? e1 : e1 - e0;
+}
+
+void LogBuffer::energyAdd_(size_t row, size_t next, float sign) {
+  const uint32_t phase = readUint_(phaseCol_, next);
+  if (phase == chargePhase_) energyChg_.add(sign * energyStep_(row, next));
+  else if (phase == dischargePhase_) energyDsg_.add(sign * energyStep_(row, next));
+}
+
+void LogBuffer::dequePush_(MonoDeque& d, size_t col, size_t row, bool isMin) {
+  const float v = cellFloat_(row, col);
+
+  // Older entries that are not below (above) the new value can never be
+  // the minimum (maximum) again
+  while (d.size > 0) {
+    const size_t back = d.q[(d.head + d.size - 1) % capRows_];
+    const float b = cellFloat_(back, col);
+    if (isMin ? (b < v) : (b > v)) break;
+    d.size--;
+  }
+
+  d.q[(d.head + d.size) % capRows_] = (uint32_t)row;
+  d.size++;
+}
+
+// Row `row` was just stored; size_ rows were held before it.
+void LogBuffer::statsAdd_(size_t row) {
+  for (size_t i = 0; i < cols_; ++i) {
+    if (schema_[i].type != ColType::F32) continue;
+    const float v = cellFloat_(row, i);
+    if (isnan(v)) continue;
+    sums_[i].add(v);
+    counts_[i]++;
+  }
+
+  for (size_t t = 0; t < trackedCount_; ++t) {
+    Tracked& tr = tracked_[t];
+    if (isnan(cellFloat_(row, tr.col))) continue;
+    dequePush_(tr.min, tr.col, row, true);
+    dequePush_(tr.max, tr.col, row, false);
+  }
+
+  if (energyOn_ && size_ > 0) energyAdd_((row + capRows_ - 1) % capRows_, row, 1.0f);
+}
+
+// Row `row` is the oldest held row and about to be overwritten.
+void LogBuffer::statsEvict_(size_t row) {
+  if (size_ == 1) {
+    // Window becomes empty: start from exact zeros again
+    statsReset_();
+    return;
+  }
 
   for (size_t i = 0; i < cols_; ++i) {
-    const ColType t = schema_[i].type;
-    printCell_(out, t, row + off);
-    off += colSize_(t);
-    out.print((i + 1 < cols_) ? ',' : '\n');
+    if (schema_[i].type != ColType::F32) continue;
+    const float v = cellFloat_(row, i);
+    if (isnan(v)) continue;
+    sums_[i].add(-v);
+    if (--counts_[i] == 0) sums_[i] = RunningSum();
+  }
+
+  // Deques hold rows oldest first: only the front can be this row
+  for (size_t t = 0; t < trackedCount_; ++t) {
+    MonoDeque* ds[2] = {&tracked_[t].min, &tracked_[t].max};
+    for (MonoDeque* d : ds) {
+      if (d->size > 0 && d->q[d->head] == row) {
+        d->head = (d->head + 1) % capRows_;
+        d->size--;
+      }
+    }
+  }
+
+  if (energyOn_) energyAdd_(row, (row + 1) % capRows_, -1.0f);
+}
+
+bool LogBuffer::colStats(size_t col, ColStats& out) const {
+  if (col >= cols_ || schema_[col].type != ColType::F32 || empty()) return false;
+
+  out = ColStats();
+  out.n = counts_[col];
+  if (out.n > 0) out.mean = sums_[col].value() / (float)out.n;
+
+  for (size_t t = 0; t < trackedCount_; ++t) {
+    const Tracked& tr = tracked_[t];
+    if (tr.col != col) continue;
+    if (tr.min.size > 0) out.min = cellFloat_(tr.min.q[tr.min.head], col);
+    if (tr.max.size > 0) out.max = cellFloat_(tr.max.q[tr.max.head], col);
   }
+  return true;
+}
+
+uint32_t LogBuffer::windowSpan_s() const {
+  if (!energyOn_ || empty()) return 0;
+  const size_t newest = (head_ + capRows_ - 1) % capRows_;
+  return readUint_(timeCol_, newest) - readUint_(timeCol_, oldestRow_());
 }
 
-void LogBuffer::printCell_(Print& out, ColType t, const uint8_t* p) const {
-  // Convert one packed cell into CSV text
+void LogBuffer::printCell_(Print& out, ColType t, const ColValue& v) const {
+  // Convert one decoded cell into CSV text
   switch (t) {
     case ColType::U8:
-      out.print((uint32_t)p[0]);
+      out.print((uint32_t)v.u8);
       break;
 
     case ColType::U16:
-      out.print((uint32_t)readU16LE(p));
+      out.print((uint32_t)v.u16);
       break;
 
     case ColType::U32:
-      out.print((uint32_t)readU32LE(p));
+      out.print(v.u32);
       break;
 
     case ColType::F32:
-      out.print(readF32LE(p), 3); // 3 decimal places
+      out.print(v.f32, 3); // 3 decimal places
       break;
   }
 }
@@ -1,6 +1,8 @@
 #pragma once
 #include <stdint.h>
 #include <stddef.h>
+#include <math.h>
+#include <atomic>
 #include "config.h"
 
 class Print;
@@ -14,15 +16,90 @@ union ColValue {
   float    f32;
 };
 
+// Rows first .. end - 1 as held at one instant (LogBuffer::snapshot()).
+// Rows stored later are not part of it; rows the ring overwrites before a
+// reader gets to them are reported as lost, never torn.
+struct LogSnapshot {
+  uint32_t first = 0;
+  uint32_t end = 0;
+};
+
+// Row filter and column projection for printCsv() (/download?cols=...).
+// Filters compare unsigned integer columns (U8/U16/U32) against [lo, hi];
+// a row is printed if it passes all of them.
+struct LogQuery {
+  static constexpr size_t kMaxRanges = 4;
+
+  struct Range {
+    uint8_t col;
+    uint32_t lo;
+    uint32_t hi;
+  };
+
+  uint32_t cols = 0;          // bit k = schema column k, 0 = all columns
+  Range ranges[kMaxRanges];
+  uint8_t rangeCount = 0;
+  uint16_t every = 1;         // decimation: every n-th matching row
+
+  // Only rows seqFirst .. seqEnd - 1 (e.g. from PhaseIndex::find())
+  bool seqRange = false;
+  uint32_t seqFirst = 0;
+  uint32_t seqEnd = 0;
+
+  bool addRange(uint8_t col, uint32_t lo, uint32_t hi) {
+    if (rangeCount >= kMaxRanges) return false;
+    ranges[rangeCount++] = Range{col, lo, hi};
+    return true;
+  }
+
+  // Restrict the row range to a snapshot, so several passes (count, then
+  // stream) see the same rows while logging goes on.
+  void pin(const LogSnapshot& snap) {
+    if (!seqRange) {
+      seqRange = true;
+      seqFirst = snap.first;
+      seqEnd = snap.end;
+      return;
+    }
+    if ((int32_t)(seqFirst - snap.first) < 0) seqFirst = snap.first;
+    if ((int32_t)(seqEnd - snap.end) > 0) seqEnd = snap.end;
+    if ((int32_t)(seqEnd - seqFirst) < 0) seqEnd = seqFirst;
+  }
+};
+
+// Running statistics of one column over the held rows (LogBuffer::colStats()).
+struct ColStats {
+  uint32_t n = 0;       // rows with a value (NaN cells are not counted)
+  float mean = NAN;
+  float min = NAN;      // NaN unless the column is tracked (trackMinMax())
+  float max = NAN;
+};
+
 // Typed, schema-driven ring buffer.
 // - No downsampling, no aggregation.
-// - Stores packed bytes per row (u8/u16/u32/f32) to save RAM.
+// - Stores packed bytes per cell (u8/u16/u32/f32) to save RAM.
+// - RowMajor: rows one after another. ColumnMajor: the storage is split into
+//   one segment per column (capacity() cells each), row k of every column
+//   at the same ring position. Capacity, sequence numbers and all outputs
+//   are the same for both layouts.
+// - Readers (readRow(), snapshot(), printCsv()) may run in another task
+//   than store(): a seqlock on the row sequence numbers detects rows that
+//   were overwritten or cleared while they were copied, without blocking
+//   the writer. Everything else (stats, column scans, clear(),
+//   setStorage()) belongs to the writer's task.
 class LogBuffer {
 public:
+  static constexpr size_t kMaxCols = 32;   // LogQuery::cols is a bit mask
+
   LogBuffer(uint8_t* storage,
             size_t storageBytes,
             const ColDef* schema,
-            size_t schemaCols);
+            size_t schemaCols,
+            LogLayout layout = LogLayout::RowMajor);
+
+  // (Re)place the row storage, e.g. once it is sized at boot. Drops all rows.
+  void setStorage(uint8_t* storage, size_t storageBytes);
+  size_t storageBytes() const { return bufBytes_; }
 
   void clear();
 
@@ -33,26 +110,153 @@ public:
   size_t capacity() const { return capRows_; }
   bool empty() const { return size_ == 0; }
 
+  // Row sequence numbers: every stored row gets the next number, also
+  // across clear() and the ring wrap, so a reader (MQTT) can resume from
+  // the last row it handled. Rows oldestSeq() .. nextSeq() - 1 are held.
+  uint32_t nextSeq() const { return committed_.load(std::memory_order_acquire); }
+  uint32_t oldestSeq() const { return snapshot().first; }
+  LogSnapshot snapshot() const;
+
+  // Decode one held row into values[schemaCols]; false if not held, or
+  // overwritten while it was read.
+  bool readRow(uint32_t seq, ColValue* values, size_t valuesCount) const;
+
   // Print CSV (header + rows) using schema names.
-  void printCsv(Print& out) const;
+  uint32_t printCsv(Print& out) const { return printCsv(out, LogQuery()); }
+
+  // Selected columns of the matching rows, oldest first, in one pass over
+  // the packed rows; only the filter and output columns are decoded. The
+  // rows are those held when the call starts (within q's seq range);
+  // returns how many of them the ring overwrote before they were printed.
+  uint32_t printCsv(Print& out, const LogQuery& q) const;
+
+  // Window statistics, updated by store() as rows enter and leave the ring
+  // and read in O(1):
+  // - count / mean of every F32 column (compensated running sums)
+  // - min / max of up to kMaxTracked F32 columns (monotonic deques of row
+  //   indices; 2 x 4 B per row and column, taken from the log storage)
+  // - charge and discharge energy over the window from the per-phase
+  //   energy column (integrated by the core, restarts at every phase):
+  //   per pair of consecutive rows the growth of |E|, or |E| of the newer
+  //   row if a new phase began in between (a column of segmentCols changed,
+  //   e.g. Cycle and Phase, or |E| fell). Counted for the phase of the newer
+  //   row: chargePhase / dischargePhase, other phases add nothing.
+  // Configure before rows are stored: both calls drop the held rows.
+  static constexpr size_t kMaxTracked = 4;
+  bool trackMinMax(size_t col);
+  bool trackEnergy(size_t timeCol, size_t energyCol, size_t phaseCol,
+                   uint8_t chargePhase, uint8_t dischargePhase, uint32_t segmentCols);
+
+  // false: not an F32 column or no rows
+  bool colStats(size_t col, ColStats& out) const;
+  float windowChargeEnergy_Wh() const { return energyChg_.value(); }
+  float windowDischargeEnergy_Wh() const { return energyDsg_.value(); }
+  uint32_t windowSpan_s() const;   // time column: newest - oldest row (0 without trackEnergy())
+
+  // Schema lookup (-1 if there is no such column)
+  int colIndex(const char* name) const;
+  size_t colCount() const { return cols_; }
+  ColType colType(size_t col) const { return schema_[col].type; }
+  const char* colName(size_t col) const { return schema_[col].name; }
+  LogLayout layout() const { return layout_; }
+
+  // Column scans over all held rows (any column type, as float). NaN cells
+  // are skipped; false if no row has a value. ColumnMajor walks contiguous
+  // cells, RowMajor strides over whole rows.
+  bool colMinMax(size_t col, float& lo, float& hi) const;
+
+  // Up to n cells of `col` as float, starting at row firstSeq (clamped to
+  // the oldest held row), e.g. a chart series. Returns the count written.
+  size_t readCol(size_t col, uint32_t firstSeq, float* out, size_t n) const;
 
 private:
+  // Kahan-compensated running sum (rows are added and removed again)
+  struct RunningSum {
+    float sum = 0.0f;
+    float comp = 0.0f;
+    void add(float x) {
+      const float y = x - comp;
+      const float t = sum + y;
+      comp = (t - sum) - y;
+      sum = t;
+    }
+    float value() const { return sum; }
+  };
+
+  // Ring of row indices; values along it rise (min) or fall (max)
+  struct MonoDeque {
+    uint32_t* q = nullptr;
+    size_t head = 0;    // front slot
+    size_t size = 0;
+  };
+
+  struct Tracked {
+    uint8_t col;
+    MonoDeque min;
+    MonoDeque max;
+  };
+
   uint8_t* buf_ = nullptr;
   size_t bufBytes_ = 0;
 
   const ColDef* schema_ = nullptr;
   size_t cols_ = 0;
 
+  LogLayout layout_ = LogLayout::RowMajor;
   size_t rowBytes_ = 0;
+  uint16_t colOff_[kMaxCols] = {};   // byte offset of each column in a row
   size_t capRows_ = 0;
 
   size_t head_ = 0; // next write row index
   size_t size_ = 0; // number of valid rows
 
+  // Seqlock: store() sets pending_ = seq + 1 before it overwrites a ring
+  // row and committed_ = seq + 1 once the row is complete. Row s is intact
+  // while s + capRows_ >= pending_ (its ring row not reused yet) and
+  // s >= floor_ (not cleared). floor_ is also the row in ring row 0.
+  std::atomic<uint32_t> pending_{0};
+  std::atomic<uint32_t> committed_{0};   // sequence number of the next row
+  std::atomic<uint32_t> floor_{0};
+
+  // Window statistics
+  RunningSum sums_[kMaxCols];
+  uint32_t counts_[kMaxCols] = {};
+  Tracked tracked_[kMaxTracked];
+  size_t trackedCount_ = 0;
+  bool energyOn_ = false;
+  uint8_t timeCol_ = 0, energyCol_ = 0, phaseCol_ = 0;
+  uint8_t chargePhase_ = 0, dischargePhase_ = 0;
+  uint32_t segmentCols_ = 0;
+  RunningSum energyChg_, energyDsg_;
+
   size_t oldestRow_() const;
+  bool   intact_(uint32_t seq, uint32_t floor) const;
+  bool   copyRow_(uint32_t seq, ColValue* values, uint32_t cols) const;
+
+  // Cell of ring row `row` in column `col` (both layouts)
+  uint8_t* cell_(size_t row, size_t col) const {
+    return (layout_ == LogLayout::ColumnMajor)
+      ? buf_ + capRows_ * colOff_[col] + row * colSize_(schema_[col].type)
+      : buf_ + row * rowBytes_ + colOff_[col];
+  }
+  // Distance between the cells of consecutive rows in one column
+  size_t cellStride_(size_t col) const {
+    return (layout_ == LogLayout::ColumnMajor) ? colSize_(schema_[col].type) : rowBytes_;
+  }
+
+  float cellFloat_(size_t row, size_t col) const;
+  float energyStep_(size_t row, size_t next) const;
+  void  energyAdd_(size_t row, size_t next, float sign);
+  void  statsAdd_(size_t row);
+  void  statsEvict_(size_t row);
+  void  statsReset_();
+  void  dequePush_(MonoDeque& d, size_t col, size_t row, bool isMin);
 
-  size_t colSize_(ColType t) const;
-  void   encodeRow_(uint8_t* dst, const ColValue* values) const;
-  void   printRowCsv_(Print& out, const uint8_t* row) const;
-  void   printCell_(Print& out, ColType t, const uint8_t* p) const;
+  static size_t colSize_(ColType t);
+  void   encodeRow_(size_t row, const ColValue* values);
+  void   decodeCell_(size_t row, size_t col, ColValue& v) const;
+  uint32_t readUint_(size_t col, size_t row) const;
+  bool   matches_(const LogQuery& q, const ColValue* values) const;
+  void   printRowCsv_(Print& out, const ColValue* values, uint32_t cols) const;
+  void   printCell_(Print& out, ColType t, const ColValue& v) const;
 };
@@ -1,8 +1,7 @@
 #include <Arduino.h>
-#include <WiFi.h>
 #include <WebServer.h>
+#include <esp_heap_caps.h>
 #include "log.h"
-#include <ESPmDNS.h>
 
 
 #include "config.h"
@@ -11,110 +10,144 @@
 #include "ui_http.h"
 #include "log_buffer.h"
 #include "core.h"
+#include "sampler.h"
+#include "shadow.h"
+#include "cycle_table.h"
+#include "phase_index.h"
+#include "sequencer.h"
+#include "safety.h"
+#include "acquisition.h"
+#include "wifi_manager.h"
+#include "config_store.h"
+#include "mqtt_publisher.h"
+#include "arena.h"
+#include "metrics.h"
+#include "clock.h"
 
 static const char* TAG = "Main"; // For BT_LOG*
-static const char* TAG_WIFI = "WIFI";
 
 // ---------------------------------------------------------------------------
-// WiFi start (STA first, AP fallback)
-static void startWifi() {
-  if (!kWifiEnabled) {
-    BT_LOGI(TAG_WIFI, "WiFi disabled");
-    return;
-  }
-
-  // --- STA ---
-  if (kWifiUseSta && kWifiStaSsid[0] != '\0') {
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(kWifiStaSsid, kWifiStaPass);
-
-    BT_LOGI(TAG_WIFI, "Connecting to WiFi (STA)");
-    Serial.println("#Connecting to WiFi (STA)");
-    const uint32_t t0 = millis();
-    while (WiFi.status() != WL_CONNECTED &&
-           (uint32_t)(millis() - t0) < kWifiStaTimeoutMs) {
-      delay(300);
-    }
+// Global objects (explicit wiring)
 
-    if (WiFi.status() == WL_CONNECTED) {
-      BT_LOGI(TAG_WIFI, "STA connected, IP: %s",
-               WiFi.localIP().toString().c_str());
-      Serial.print("#STA connected, IP: ");      
-      Serial.println(WiFi.localIP().toString());
-
-      if (MDNS.begin("batterytester")) {
-        BT_LOGI(TAG_WIFI, "mDNS started: http://batterytester.local");
-        Serial.println("#mDNS started: http://batterytester.local");
-      } else {
-        BT_LOGE(TAG_WIFI, "mDNS setup failed");
-        Serial.println("#mDNS setup failed");
-      }
-      return;
-    }
+// Hardware
+static Hw g_hw;
 
-    BT_LOGW(TAG_WIFI, "STA failed");
-    Serial.println("#STA failed");
+// State machine
+static StateMachine g_sm(g_hw);
 
-  }
+// Compute core
+static CoreConfig g_coreCfg;
+static Core g_core(g_hw, g_sm);
 
-  // --- AP fallback ---
-  WiFi.mode(WIFI_AP);
+// Boot arena for the buffers below, sized from free heap (allocateStorage())
+static Arena g_arena;
 
-  IPAddress ip(kWifiApIp[0], kWifiApIp[1], kWifiApIp[2], kWifiApIp[3]);
-  IPAddress gw(kWifiApGateway[0], kWifiApGateway[1],
-               kWifiApGateway[2], kWifiApGateway[3]);
-  IPAddress sn(kWifiApSubnet[0], kWifiApSubnet[1],
-               kWifiApSubnet[2], kWifiApSubnet[3]);
+// Log buffer (schema-driven, typed); storage from the arena
+static LogBuffer g_log(nullptr, 0, kLogSchema, kLogSchemaCols, kLogLayout);
 
-  if (!WiFi.softAPConfig(ip, gw, sn)) {
-    BT_LOGE(TAG_WIFI, "AP IP config failed");
-  }
+// Per-cycle summaries (survive raw log wrap)
+static CycleTable g_cycles;
 
-  WiFi.softAP(kWifiApSsid, kWifiApPass, kWifiApChannel);
+// Cycle / phase boundaries of the log rows (seek without scanning)
+static PhaseIndex g_index;
 
-  BT_LOGI(TAG_WIFI, "AP started, IP: %s",
-           WiFi.softAPIP().toString().c_str());
+// What-if stop criteria on the live samples
+static ShadowEvaluator g_shadows;
 
-  if (MDNS.begin("batterytester")) {
-    BT_LOGI(TAG_WIFI, "mDNS started (AP): http://batterytester.local");
-  }
-}
+// Uploaded step table program (/api/program)
+static Sequencer g_seq;
 
+// Hard limits on raw samples (own task, 100 Hz)
+static SafetyMonitor g_safety(g_hw, g_sm);
 
-// ---------------------------------------------------------------------------
-// Global objects (explicit wiring)
+// Timer-triggered transient capture (/api/capture)
+static Acquisition g_acq(g_hw);
 
-// Hardware
-static Hw g_hw;
+// Core sampling + log rows
+static Sampler g_sampler(g_sm, g_core, g_log);
 
-// State machine
-static StateMachine g_sm(g_hw);
+// CoreConfig + Program in NVS (active set and profiles)
+static ConfigStore g_store;
 
-// Compute core
-static CoreConfig g_coreCfg;
-static Core g_core(g_hw, g_sm);
+// Log rows and cycle summaries to an MQTT broker (store-and-forward)
+static MqttPublisher g_mqtt(g_log, g_cycles);
 
-// Log buffer (schema-driven, typed)
-static uint8_t g_logMem[kLogRamBytes];
-static LogBuffer g_log(g_logMem, sizeof(g_logMem), kLogSchema, kLogSchemaCols);
+// STA / AP / mDNS in the background
+static WifiManager g_wifi;
 
 // HTTP UI
 static WebServer g_server(80);
-static UiHttp g_ui(g_server, g_sm, g_core, g_hw, g_log);
+static UiHttp g_ui(g_server, g_sm, g_core, g_hw, g_log, g_shadows, g_cycles, g_seq, g_safety, g_acq, g_store, g_mqtt, g_index);
+
+
+// ---------------------------------------------------------------------------
 
-// // Sampling interval for log rows (fast sampling)
-// static const uint32_t kSampleIntervalMs = 5000;
-// static uint32_t g_lastSampleMs = 0;
-static uint32_t lastCoreSampleMs = 0;
-static uint32_t lastLogStoreMs  = 0;
+// Window statistics of the log (before its storage is set: the min/max
+// deques share it)
+static void configureLogStats() {
+  for (const char* name : kLogStatsMinMaxCols) {
+    if (!name) continue;
+    const int col = g_log.colIndex(name);
+    if (col < 0 || !g_log.trackMinMax((size_t)col)) {
+      BT_LOGW(TAG, "no window min/max for log column '%s'", name);
+    }
+  }
+  // Energy from the core's per-phase integral; a new cycle or phase
+  // restarts it
+  const uint32_t segmentCols = (1u << g_log.colIndex("Cycle")) | (1u << g_log.colIndex("Phase"));
+  g_log.trackEnergy((size_t)g_log.colIndex("Time_s"), (size_t)g_log.colIndex("Ephase_Wh"),
+                    (size_t)g_log.colIndex("Phase"), (uint8_t)Phase::Charge,
+                    (uint8_t)Phase::Discharge, segmentCols);
+}
+
+// Log history as large as the heap allows: one block from what is left once
+// WiFi, HTTP and the tasks are up, minus kRamReserveBytes for their runtime
+// allocations. Cycle table, phase index, capture buffer and MQTT queue
+// first, the log takes the rest.
+static void allocateStorage() {
+  const size_t freeHeap = ESP.getFreeHeap();
+  const size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+  size_t budget = (freeHeap > kRamReserveBytes) ? freeHeap - kRamReserveBytes : 0;
+  if (budget > largest) budget = largest;
+  if (budget > kRamArenaMaxBytes) budget = kRamArenaMaxBytes;
+
+  uint8_t* mem = nullptr;
+  while (budget >= kRamArenaMinBytes) {
+    mem = (uint8_t*)malloc(budget);
+    if (mem) break;
+    budget -= budget / 8;
+  }
+  if (!mem) {
+    BT_LOGE(TAG, "no RAM for the log (free %u, largest block %u)",
+            (unsigned)freeHeap, (unsigned)largest);
+    return;
+  }
 
+  g_arena.reset(mem, budget);
+  g_cycles.setStorage(g_arena.alloc<CycleRecord>(kCycleTableSlots), kCycleTableSlots);
+  g_index.setStorage(g_arena.alloc<PhaseMark>(kPhaseIndexSlots), kPhaseIndexSlots);
+  g_acq.setStorage(g_arena.alloc<AcqSample>(kAcqCaptureSamples), kAcqCaptureSamples);
+  g_mqtt.setStorage(g_arena.alloc<MqttPublisher::Msg>(kMqttQueueMsgs));
 
+  size_t logBytes = 0;
+  uint8_t* logMem = g_arena.takeRest(logBytes);
+  g_log.setStorage(logMem, logBytes);
 
-// ---------------------------------------------------------------------------
+  BT_LOGI(TAG, "RAM arena %u bytes (free heap was %u): log %u rows, %u cycles, %u phase marks, "
+          "%u capture samples",
+          (unsigned)budget, (unsigned)freeHeap, (unsigned)g_log.capacity(),
+          (unsigned)g_cycles.capacity(), (unsigned)g_index.capacity(), (unsigned)g_acq.capacity());
+}
 
 void setup() {
+  // Outputs into a defined state (all off) before anything else; a brownout
+  // restart in the middle of a test must not leave the relays floating.
+  g_hw.begin();
+  metricsMarkBoot(BootMark::HwReady);
+
+  // USB CDC: no wait for the host, output before it attaches is dropped
   Serial.begin(115200);
-  delay(4000);   // important for USB CDC stability
   Serial.println("#System starting...");
 
   // set log levels
@@ -124,7 +157,7 @@ void setup() {
   //esp_log_level_set("*", BT_LOG_VERBOSE);
 
   // Project modules: global level
-  // esp_log_level_set("WIFI", LOG_LEVEL_GLOBAL);   // TAG_WIFI in main.cpp :contentReference[oaicite:2]{index=2}
+  // esp_log_level_set("WIFI", LOG_LEVEL_GLOBAL);   // TAG in wifi_manager.cpp
   // esp_log_level_set("HTTP", LOG_LEVEL_GLOBAL);   // TAG in ui_http.cpp is "HTTP" :contentReference[oaicite:3]{index=3}
   // esp_log_level_set("SM",   LOG_LEVEL_GLOBAL);
   // esp_log_level_set("CORE", LOG_LEVEL_GLOBAL);
@@ -146,60 +179,66 @@ void setup() {
 
   ESP_EARLY_LOGI(TAG, "System Starting");
 
-  g_hw.begin();
+  g_safety.begin();
+  g_acq.begin();
 
-  // Apply core config (later this will come from UI)
+  // Settings of the last session (compiled-in defaults if none are stored)
+  StoredSettings stored;
+  if (g_store.begin() && g_store.load(stored)) {
+    g_coreCfg = stored.core;
+    g_sm.setProgram(stored.program);
+  }
   g_core.setConfig(g_coreCfg);
+  g_core.attachCycleTable(&g_cycles);
+  g_core.attachSequencer(&g_seq);
+  g_sampler.attachShadows(&g_shadows);
+  g_sampler.attachIndex(&g_index);
 
-  startWifi();
+  // Only starts the join; STA timeout, AP fallback and mDNS run in loop()
+  g_wifi.begin(clockNow_ms());
+  g_mqtt.begin();
 
   g_ui.begin();
+  metricsMarkBoot(BootMark::HttpReady);
+
+  // Last: everything else has taken its heap by now
+  configureLogStats();
+  allocateStorage();
 
   Serial.println("#System ready");
 }
 
-void loop() {
-
-  const uint32_t now = millis();
-
-  // Serve HTTP
-  g_ui.tick();
-
-  // Core sampling (e.g. 15 s)
-  if (now - lastCoreSampleMs >= kCoreSampleInterval_s * 1000UL) {
-    lastCoreSampleMs = now;
-    //BT_LOGV(TAG, "Core tick at %lu ms", lastCoreSampleMs);
+// One loop() iteration without the trailing yield (timed as MetricId::Loop).
+static void loopOnce() {
+  const uint64_t now = clockNow_ms();
 
-    // SM orchestration
-    g_sm.tick();
+  // Safety trip from the monitor task -> StateMachine (Error)
+  g_safety.service();
 
-    // Compute core (stop rules, waits, energy integration)
-    const auto tel = g_sm.getTelemetry();
-    g_core.tick(now, tel);  
-  }
+  // Captured samples from the acquisition task
+  g_acq.drain();
 
+  // WiFi bring-up (non-blocking)
+  g_wifi.service(now);
 
-  if (g_core.runState() != RunState::Off) {
+  // Serve HTTP
+  g_ui.tick();
 
-    // Periodic data log row (content-free buffer: we push already computed values)
-    if (now - lastLogStoreMs >= kLogStoreInterval_s * 1000UL) {
-      lastLogStoreMs = now;
-      //BT_LOGV(TAG, "Log store at %lu ms", lastLogStoreMs);
+  // Core sampling (adaptive period) and periodic log rows
+  const bool sampled = g_sampler.service(now);
 
-      // Map runtime values to schema order (config.h).
-      ColValue row[kLogSchemaCols];
+  // /api/status snapshot
+  g_ui.updateStatus(now, sampled);
 
-      row[0].u32 = (now + 500) / 1000;                     // Time_s
-      row[1].u16 = g_core.cycleIndex1Based();              // Cycle
-      row[2].u8  = (uint8_t)g_core.phase();                // Phase
-      row[3].u8  = (uint8_t)g_core.runState();             // Status
-      row[4].f32 = g_hw.readVoltage_V();                   // U_V
-      row[5].f32 = g_hw.readCurrent_A();                   // I_A
-      row[6].f32 = g_core.phaseEnergy_Wh();                // Ephase_Wh
+  // New log rows / cycles -> MQTT queue
+  g_mqtt.service(now);
+}
 
-      g_log.store(row, kLogSchemaCols);
-    }
+void loop() {
+  {
+    ScopedTimer loopTimer(MetricId::Loop);
+    loopOnce();
   }
-  
+
   delay(1); // yield to background tasks
 }
@@ -0,0 +1,234 @@
+#include "metrics.h"
+#include "clock.h"
+#include <Arduino.h>
+#ifndef BT_HOST
+  #include <WiFi.h>
+#endif
+
+// Upper bucket bounds in microseconds (last entry = +Inf).
+static const uint32_t kBucketBound_us[LatencyHistogram::kBuckets] = {
+  10, 20, 50, 100, 200, 500,
+  1000, 2000, 5000, 10000, 20000, 50000,
+  100000, 200000, 500000, UINT32_MAX
+};
+
+// Label values for the "op" label, indexed by MetricId.
+static const char* kMetricNames[(size_t)MetricId::Count] = {
+  "loop",
+  "core_tick",
+  "sensor_read",
+  "sample_jitter",
+  "http_status",
+  "http_download",
+  "ir_pulse",
+  "shadow",
+  "safety_check",
+  "fault_latency",
+  "acq_jitter",
+};
+
+static LatencyHistogram g_hist[(size_t)MetricId::Count];
+
+// Boot milestones in us since boot (0 = not reached), indexed by BootMark.
+static const char* kBootMarkNames[(size_t)BootMark::Count] = {
+  "hw_ready",
+  "first_sample",
+  "http_ready",
+  "wifi_up",
+};
+static uint64_t g_bootMark_us[(size_t)BootMark::Count] = {};
+
+// Extra tasks for stack high-water marks (small fixed table).
+struct TaskEntry {
+  const char* name;
+  void* handle;
+};
+static constexpr size_t kMaxTasks = 4;
+static TaskEntry g_tasks[kMaxTasks];
+static size_t g_taskCount = 0;
+
+// --------------------------------------------------------------------------
+
+void LatencyHistogram::record(uint32_t us) {
+  size_t b = 0;
+  while (b + 1 < kBuckets && us > kBucketBound_us[b]) b++;
+
+  buckets_[b]++;
+  count_++;
+  sum_us_ += us;
+  if (us > max_us_) max_us_ = us;
+}
+
+void LatencyHistogram::clear() {
+  for (size_t b = 0; b < kBuckets; ++b) buckets_[b] = 0;
+  count_ = 0;
+  sum_us_ = 0;
+  max_us_ = 0;
+}
+
+uint32_t LatencyHistogram::percentile_us(float q) const {
+  if (count_ == 0) return 0;
+
+  // Rank of the requested quantile (1-based, rounded up)
+  uint32_t rank = (uint32_t)ceilf(q * (float)count_);
+  if (rank < 1) rank = 1;
+
+  uint32_t cum = 0;
+  for (size_t b = 0; b < kBuckets; ++b) {
+    cum += buckets_[b];
+    if (cum >= rank) {
+      const uint32_t bound = kBucketBound_us[b];
+      return (bound < max_us_) ? bound : max_us_;
+    }
+  }
+  return max_us_;
+}
+
+uint32_t LatencyHistogram::bucketBound_us(size_t b) {
+  return (b < kBuckets) ? kBucketBound_us[b] : UINT32_MAX;
+}
+
+// --------------------------------------------------------------------------
+
+LatencyHistogram& metricsHistogram(MetricId id) {
+  return g_hist[(size_t)id];
+}
+
+#ifndef BT_HOST
+
+uint32_t metricsCycles() {
+  return ESP.getCycleCount();
+}
+
+uint32_t metricsCyclesToUs(uint32_t cycles) {
+  const uint32_t mhz = ESP.getCpuFreqMHz();
+  return (mhz > 0) ? (cycles / mhz) : cycles;
+}
+
+#else
+
+// Host build: no cycle counter, micros() is the (virtual) clock.
+uint32_t metricsCycles() {
+  return micros();
+}
+
+uint32_t metricsCyclesToUs(uint32_t cycles) {
+  return cycles;
+}
+
+#endif
+
+void metricsMarkBoot(BootMark m) {
+  uint64_t& slot = g_bootMark_us[(size_t)m];
+  if (slot == 0) slot = clockNow_us() | 1;   // | 1: reached even at t = 0
+}
+
+int64_t metricsBootMark_ms(BootMark m) {
+  const uint64_t us = g_bootMark_us[(size_t)m];
+  return us ? (int64_t)(us / 1000ULL) : -1;
+}
+
+void metricsRegisterTask(const char* name, void* taskHandle) {
+  if (g_taskCount >= kMaxTasks || !taskHandle) return;
+  g_tasks[g_taskCount++] = {name, taskHandle};
+}
+
+// ---- Prometheus text format ------------------------------------------------
+
+static void printGauge(Print& out, const char* name, const char* help, int64_t v) {
+  out.print("# HELP "); out.print(name); out.print(' '); out.println(help);
+  out.print("# TYPE "); out.print(name); out.println(" gauge");
+  out.print(name); out.print(' '); out.println((long long)v);
+}
+
+void metricsPrintGauge(Print& out, const char* name, const char* help, int64_t v) {
+  printGauge(out, name, help, v);
+}
+
+void metricsPrintGauge(Print& out, const char* name, const char* help, float v, int decimals) {
+  out.print("# HELP "); out.print(name); out.print(' '); out.println(help);
+  out.print("# TYPE "); out.print(name); out.println(" gauge");
+  out.print(name); out.print(' '); out.print((double)v, decimals); out.println();
+}
+
+static void printQuantileGauge(Print& out, const char* name, const char* help, int which) {
+  out.print("# HELP "); out.print(name); out.print(' '); out.println(help);
+  out.print("# TYPE "); out.print(name); out.println(" gauge");
+
+  for (size_t m = 0; m < (size_t)MetricId::Count; ++m) {
+    const LatencyHistogram& h = g_hist[m];
+    uint32_t v = 0;
+    switch (which) {
+      case 0: v = h.percentile_us(0.50f); break;
+      case 1: v = h.percentile_us(0.99f); break;
+      default: v = h.max_us(); break;
+    }
+    out.print(name); out.print("{op=\""); out.print(kMetricNames[m]); out.print("\"} ");
+    out.println((unsigned long)v);
+  }
+}
+
+void metricsPrintPrometheus(Print& out) {
+  // Latency histograms (cumulative buckets as required by Prometheus)
+  out.println("# HELP bt_latency_us Latency of instrumented hot paths in microseconds.");
+  out.println("# TYPE bt_latency_us histogram");
+
+  for (size_t m = 0; m < (size_t)MetricId::Count; ++m) {
+    const LatencyHistogram& h = g_hist[m];
+    const char* op = kMetricNames[m];
+
+    uint32_t cum = 0;
+    for (size_t b = 0; b < LatencyHistogram::kBuckets; ++b) {
+      cum += h.bucketCount(b);
+      out.print("bt_latency_us_bucket{op=\""); out.print(op); out.print("\",le=\"");
+      if (b + 1 < LatencyHistogram::kBuckets) {
+        out.print((unsigned long)LatencyHistogram::bucketBound_us(b));
+      } else {
+        out.print("+Inf");
+      }
+      out.print("\"} ");
+      out.println((unsigned long)cum);
+    }
+
+    out.print("bt_latency_us_sum{op=\""); out.print(op); out.print("\"} ");
+    out.println((unsigned long long)h.sum_us());
+    out.print("bt_latency_us_count{op=\""); out.print(op); out.print("\"} ");
+    out.println((unsigned long)h.count());
+  }
+
+  printQuantileGauge(out, "bt_latency_p50_us", "Estimated median latency (bucket upper bound).", 0);
+  printQuantileGauge(out, "bt_latency_p99_us", "Estimated 99th percentile latency (bucket upper bound).", 1);
+  printQuantileGauge(out, "bt_latency_max_us", "Maximum observed latency.", 2);
+
+#ifndef BT_HOST
+
+  // Heap
+  printGauge(out, "bt_heap_free_bytes", "Currently free heap.", ESP.getFreeHeap());
+  printGauge(out, "bt_heap_min_free_bytes", "Lowest free heap since boot (low watermark).", ESP.getMinFreeHeap());
+
+  // Stack high-water marks (bytes on ESP-IDF)
+  out.println("# HELP bt_task_stack_hwm_bytes Minimum remaining stack per task since start.");
+  out.println("# TYPE bt_task_stack_hwm_bytes gauge");
+  out.print("bt_task_stack_hwm_bytes{task=\"loop\"} ");
+  out.println((unsigned long)uxTaskGetStackHighWaterMark(nullptr));
+  for (size_t k = 0; k < g_taskCount; ++k) {
+    out.print("bt_task_stack_hwm_bytes{task=\""); out.print(g_tasks[k].name); out.print("\"} ");
+    out.println((unsigned long)uxTaskGetStackHighWaterMark((TaskHandle_t)g_tasks[k].handle));
+  }
+
+  // WiFi (RSSI only meaningful as STA)
+  const bool sta = (WiFi.status() == WL_CONNECTED);
+  printGauge(out, "bt_wifi_connected", "1 if connected as station.", sta ? 1 : 0);
+  printGauge(out, "bt_wifi_rssi_dbm", "Station RSSI (0 if not connected).", sta ? WiFi.RSSI() : 0);
+
+#endif // BT_HOST
+
+  printGauge(out, "bt_uptime_ms", "Milliseconds since boot.", (int64_t)clockNow_ms());
+
+  out.println("# HELP bt_boot_ms Uptime when a boot stage was first reached (-1 = not yet).");
+  out.println("# TYPE bt_boot_ms gauge");
+  for (size_t k = 0; k < (size_t)BootMark::Count; ++k) {
+    out.print("bt_boot_ms{stage=\""); out.print(kBootMarkNames[k]); out.print("\"} ");
+    out.println((long long)metricsBootMark_ms((BootMark)k));
+  }
+}
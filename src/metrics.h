@@ -0,0 +1,96 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+class Print;
+
+// Instrumented hot paths (one latency histogram each).
+enum class MetricId : uint8_t {
+  Loop = 0,       // one loop() iteration (without the trailing yield)
+  CoreTick,       // Core::tick()
+  SensorRead,     // one INA219 register read
+  SampleJitter,   // core sample lateness vs. scheduled instant
+  HttpStatus,     // UiHttp::handleStatus()
+  HttpDownload,   // UiHttp::handleDownload()
+  IrPulse,        // Hw::beginLoadStep() / endLoadStep() (one IR pulse half)
+  Shadow,         // ShadowEvaluator::observe() (all what-if variants)
+  SafetyCheck,    // SafetyMonitor::check() (one raw sample against the limits)
+  FaultLatency,   // first sample beyond a limit -> outputs off (debounce included)
+  AcqJitter,      // triggered conversion: |trigger instant - timer schedule|
+  Count
+};
+
+// Fixed-bucket latency histogram in microseconds.
+// - Bucket bounds are shared by all histograms (see kBucketBound_us in metrics.cpp).
+// - No allocation, O(buckets) record, good enough for p50/p99 estimates.
+class LatencyHistogram {
+public:
+  static constexpr size_t kBuckets = 16; // last bucket is +Inf
+
+  void record(uint32_t us);
+  void clear();
+
+  uint32_t count() const { return count_; }
+  uint64_t sum_us() const { return sum_us_; }
+  uint32_t max_us() const { return max_us_; }
+  uint32_t bucketCount(size_t b) const { return (b < kBuckets) ? buckets_[b] : 0; }
+
+  // Upper bucket bound containing quantile q (0..1), capped by the observed max.
+  uint32_t percentile_us(float q) const;
+
+  // Upper bound of bucket b in us (UINT32_MAX for the +Inf bucket).
+  static uint32_t bucketBound_us(size_t b);
+
+private:
+  uint32_t buckets_[kBuckets] = {};
+  uint32_t count_ = 0;
+  uint64_t sum_us_ = 0;
+  uint32_t max_us_ = 0;
+};
+
+// Global registry (one histogram per MetricId).
+LatencyHistogram& metricsHistogram(MetricId id);
+
+// Raw CPU cycle counter and conversion. Cycle deltas wrap after 2^32 cycles
+// (~26 s at 160 MHz), which is far above any instrumented path.
+uint32_t metricsCycles();
+uint32_t metricsCyclesToUs(uint32_t cycles);
+
+// Boot milestones: uptime when first reached (one gauge per stage).
+enum class BootMark : uint8_t {
+  HwReady = 0,    // outputs in a defined state (all off)
+  FirstSample,    // first core sample
+  HttpReady,      // web server listening
+  WifiUp,         // STA connected or AP fallback running
+  Count
+};
+
+void metricsMarkBoot(BootMark m);           // later calls for the same stage are ignored
+int64_t metricsBootMark_ms(BootMark m);     // -1 if not reached yet
+
+// Optional extra tasks whose stack high-water mark should be exported.
+// The calling task (loop) is always reported.
+void metricsRegisterTask(const char* name, void* taskHandle);
+
+// Prometheus text exposition of all histograms plus system gauges.
+void metricsPrintPrometheus(Print& out);
+
+// One extra gauge in the same format (values owned by other modules).
+void metricsPrintGauge(Print& out, const char* name, const char* help, int64_t v);
+void metricsPrintGauge(Print& out, const char* name, const char* help, float v, int decimals);
+
+// Measures the enclosing scope and records it into the given histogram.
+class ScopedTimer {
+public:
+  explicit ScopedTimer(MetricId id) : id_(id), t0_(metricsCycles()) {}
+  ~ScopedTimer() {
+    metricsHistogram(id_).record(metricsCyclesToUs(metricsCycles() - t0_));
+  }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+  MetricId id_;
+  uint32_t t0_;
+};
@@ -0,0 +1,311 @@
+#include "mqtt_publisher.h"
+#include <Arduino.h>
+#include <WiFi.h>
+#include <PubSubClient.h>
+#include <math.h>
+#include <stdio.h>
+#include "log.h"
+#include "log_buffer.h"
+#include "cycle_table.h"
+#include "metrics.h"
+#include "clock.h"
+
+static const char* TAG = "MQTT"; // For BT_LOG*
+
+// Room one row needs in a samples message (8 columns, worst case)
+static constexpr size_t kRowMaxChars = 160;
+
+static WiFiClient g_net;
+static PubSubClient g_client(g_net);
+
+const char* mqttStateName(MqttState s) {
+  switch (s) {
+    case MqttState::Off:        return "off";
+    case MqttState::Waiting:    return "waiting";
+    case MqttState::Connecting: return "connecting";
+    case MqttState::Connected:  return "connected";
+  }
+  return "?";
+}
+
+// Print into a fixed buffer; output past the end is dropped and flagged.
+struct BufPrint : public Print {
+  char* buf;
+  size_t cap;
+  size_t len = 0;
+  bool overflow = false;
+
+  BufPrint(char* b, size_t c) : buf(b), cap(c) {}
+
+  size_t write(uint8_t c) override {
+    if (len >= cap) {
+      overflow = true;
+      return 0;
+    }
+    buf[len++] = (char)c;
+    return 1;
+  }
+  size_t write(const uint8_t* p, size_t n) override {
+    size_t k = 0;
+    while (k < n && write(p[k])) ++k;
+    return k;
+  }
+  size_t room() const { return cap - len; }
+};
+
+MqttPublisher::MqttPublisher(LogBuffer& log, CycleTable& cycles)
+  : log_(log), cycles_(cycles) {}
+
+void MqttPublisher::begin() {
+  if (!kWifiEnabled || kMqttBroker[0] == '\0') {
+    BT_LOGI(TAG, "MQTT off (no broker configured)");
+    return;
+  }
+
+  if (kMqttDeviceId[0] != '\0') {
+    snprintf(deviceId_, sizeof(deviceId_), "%s", kMqttDeviceId);
+  } else {
+    const uint64_t mac = ESP.getEfuseMac();   // byte 0 = first MAC byte
+    snprintf(deviceId_, sizeof(deviceId_), "bt-%02x%02x%02x",
+             (unsigned)((mac >> 24) & 0xFF), (unsigned)((mac >> 32) & 0xFF),
+             (unsigned)((mac >> 40) & 0xFF));
+  }
+  snprintf(topicBase_, sizeof(topicBase_), "%s/%s", kMqttTopicRoot, deviceId_);
+
+  // Start with what the log already holds (rows of this boot)
+  rowSeq_ = log_.oldestSeq();
+  cycleSeq_ = cycles_.dropped();
+
+  g_client.setServer(kMqttBroker, kMqttPort);
+  g_client.setBufferSize((uint16_t)(kMqttPayloadBytes + sizeof(topicBase_) + 32));
+
+  state_.store(MqttState::Waiting);
+  enabled_ = true;
+
+#ifndef BT_HOST
+  TaskHandle_t handle = nullptr;
+  if (xTaskCreate(taskMain_, "mqtt", kMqttTaskStack, this,
+                  kMqttTaskPriority, &handle) != pdPASS) {
+    BT_LOGE(TAG, "MQTT task not started");
+    state_.store(MqttState::Off);
+    enabled_ = false;
+    return;
+  }
+  metricsRegisterTask("mqtt", handle);
+#endif
+
+  BT_LOGI(TAG, "publishing to %s:%u as %s", kMqttBroker, (unsigned)kMqttPort, topicBase_);
+}
+
+uint32_t MqttPublisher::backlogRows() const {
+  if (!enabled_) return 0;
+  const uint32_t held = log_.nextSeq() - log_.oldestSeq();
+  const uint32_t behind = log_.nextSeq() - rowSeq_;
+  return behind < held ? behind : held;
+}
+
+// ---------------------------------------------------------------------------
+// loop() side: build messages
+// ---------------------------------------------------------------------------
+
+void MqttPublisher::service(uint64_t now_ms) {
+  if (!enabled_ || !queue_.hasStorage()) return;
+
+  // Rows the log ring dropped before we got to them
+  const uint32_t oldest = log_.oldestSeq();
+  if ((int32_t)(oldest - rowSeq_) > 0) {
+    lost_ += oldest - rowSeq_;
+    BT_LOGW(TAG, "%lu log rows overwritten before sending",
+            (unsigned long)(oldest - rowSeq_));
+    rowSeq_ = oldest;
+  }
+
+  // Rows: full batches at once (backlog after a reconnect), a partial
+  // batch once its oldest row has waited kMqttBatchMaxAge_ms
+  uint32_t pending = log_.nextSeq() - rowSeq_;
+  if (pending > 0 && !rowsPending_) {
+    rowsPending_ = true;
+    pendingSinceMs_ = now_ms;
+  }
+  while (pending > 0 && queue_.size() < kMqttQueueMsgs) {
+    const bool full = pending >= kMqttBatchRows;
+    if (!full && now_ms - pendingSinceMs_ < kMqttBatchMaxAge_ms) break;
+    if (!buildRows_(kMqttBatchRows)) break;
+    pending = log_.nextSeq() - rowSeq_;
+    pendingSinceMs_ = now_ms;
+  }
+  if (pending == 0) rowsPending_ = false;
+
+  // Cycles: one message per completed cycle
+  if ((int32_t)(cycles_.dropped() - cycleSeq_) > 0) {
+    lost_ += cycles_.dropped() - cycleSeq_;
+    cycleSeq_ = cycles_.dropped();
+  }
+  while (cycleSeq_ != cycles_.total() && queue_.size() < kMqttQueueMsgs) {
+    if (!buildCycle_(cycleSeq_)) break;
+    cycleSeq_++;
+  }
+}
+
+bool MqttPublisher::buildRows_(uint32_t maxRows) {
+  scratch_.topic = Topic::Samples;
+  BufPrint out(scratch_.payload, sizeof(scratch_.payload));
+
+  out.print("{\"seq\":");
+  out.print((unsigned long)rowSeq_);
+  out.print(",\"rows\":[");
+
+  ColValue v[kLogSchemaCols];
+  const uint32_t first = rowSeq_;
+  uint32_t rows = 0;
+  while (rows < maxRows && rowSeq_ != log_.nextSeq() && out.room() > kRowMaxChars) {
+    if (!log_.readRow(rowSeq_, v, kLogSchemaCols)) break;
+
+    if (rows > 0) out.print(',');
+    out.print('[');
+    for (size_t i = 0; i < kLogSchemaCols; ++i) {
+      if (i > 0) out.print(',');
+      switch (kLogSchema[i].type) {
+        case ColType::U8:  out.print((unsigned long)v[i].u8);  break;
+        case ColType::U16: out.print((unsigned long)v[i].u16); break;
+        case ColType::U32: out.print((unsigned long)v[i].u32); break;
+        case ColType::F32:
+          if (isnan(v[i].f32)) out.print("null");   // e.g. R_mOhm before the first pulse
+          else out.print(v[i].f32, 3);
+          break;
+      }
+    }
+    out.print(']');
+
+    rowSeq_++;
+    rows++;
+  }
+  out.print("]}");
+
+  scratch_.len = (uint16_t)out.len;
+  if (rows == 0 || out.overflow || !queue_.push(scratch_)) {
+    rowSeq_ = first;   // not consumed, next service() tries again
+    return false;
+  }
+  return true;
+}
+
+// false: queue full, the cycle stays pending
+bool MqttPublisher::buildCycle_(uint32_t seq) {
+  scratch_.topic = Topic::Cycles;
+  BufPrint out(scratch_.payload, sizeof(scratch_.payload));
+
+  out.print("{\"seq\":");
+  out.print((unsigned long)seq);
+  out.print(",\"cycle\":");
+  CycleTable::printRecordJson(out, cycles_.at(seq - cycles_.dropped()));
+  out.print('}');
+
+  if (out.overflow) {
+    // Cannot happen with the default kMqttPayloadBytes; skip, do not stall
+    BT_LOGE(TAG, "cycle %lu does not fit into one message", (unsigned long)seq);
+    lost_++;
+    return true;
+  }
+  scratch_.len = (uint16_t)out.len;
+  return queue_.push(scratch_);
+}
+
+void MqttPublisher::topic_(char* out, size_t outLen, const char* leaf) const {
+  snprintf(out, outLen, "%s/%s", topicBase_, leaf);
+}
+
+// ---------------------------------------------------------------------------
+// Network task: connect and publish the queue
+// ---------------------------------------------------------------------------
+
+void MqttPublisher::taskMain_(void* arg) {
+#ifndef BT_HOST
+  MqttPublisher* self = static_cast<MqttPublisher*>(arg);
+  for (;;) self->step_();
+#else
+  (void)arg;
+#endif
+}
+
+void MqttPublisher::step_() {
+  // Broker only over the STA link (the AP has no route to it)
+  if (WiFi.status() != WL_CONNECTED) {
+    if (state_.load() == MqttState::Connected) g_client.disconnect();
+    state_.store(MqttState::Waiting);
+    delay(500);
+    return;
+  }
+
+  if (!g_client.connected()) {
+    if (state_.load() == MqttState::Connected) {
+      BT_LOGW(TAG, "broker connection lost, %u messages queued", (unsigned)queue_.size());
+      nextAttemptMs_ = 0;
+    }
+    state_.store(MqttState::Connecting);
+
+    const uint64_t now = clockNow_ms();
+    if (now < nextAttemptMs_) {
+      delay(100);
+      return;
+    }
+    if (!connect_()) {
+      BT_LOGW(TAG, "connect to %s failed (state %d), retry in %lu ms",
+              kMqttBroker, g_client.state(), (unsigned long)backoffMs_);
+      nextAttemptMs_ = now + backoffMs_;
+      backoffMs_ = (backoffMs_ * 2 < kMqttRetryMax_ms) ? backoffMs_ * 2 : kMqttRetryMax_ms;
+      return;
+    }
+    backoffMs_ = kMqttRetryMin_ms;
+    connects_++;
+    state_.store(MqttState::Connected);
+    BT_LOGI(TAG, "connected, %u messages queued", (unsigned)queue_.size());
+  }
+
+  g_client.loop();   // keepalive
+
+  const Msg* m = queue_.front();
+  if (!m) {
+    delay(20);
+    return;
+  }
+
+  char topic[80];
+  topic_(topic, sizeof(topic), m->topic == Topic::Samples ? "samples" : "cycles");
+  if (g_client.publish(topic, (const uint8_t*)m->payload, m->len, false)) {
+    queue_.drop();
+    sent_++;
+  } else {
+    // Keep the message; it goes out first after the reconnect
+    BT_LOGW(TAG, "publish failed, reconnecting");
+    g_client.disconnect();
+  }
+}
+
+bool MqttPublisher::connect_() {
+  char willTopic[80];
+  topic_(willTopic, sizeof(willTopic), "online");
+
+  const char* user = (kMqttUser[0] != '\0') ? kMqttUser : nullptr;
+  const char* pass = (kMqttUser[0] != '\0') ? kMqttPass : nullptr;
+  if (!g_client.connect(deviceId_, user, pass, willTopic, 0, true, "0")) return false;
+
+  g_client.publish(willTopic, "1", true);
+
+  // Column names of the sample rows
+  char schema[256];
+  BufPrint out(schema, sizeof(schema));
+  out.print('[');
+  for (size_t i = 0; i < kLogSchemaCols; ++i) {
+    if (i > 0) out.print(',');
+    out.print('"');
+    out.print(kLogSchema[i].name);
+    out.print('"');
+  }
+  out.print(']');
+
+  char topic[80];
+  topic_(topic, sizeof(topic), "schema");
+  g_client.publish(topic, (const uint8_t*)schema, out.len, true);
+  return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "config.h"
+#include "spsc_ring.h"
+
+class LogBuffer;
+class CycleTable;
+
+// Broker connection state, see MqttPublisher.
+enum class MqttState : uint8_t {
+  Off = 0,          // no broker configured / WiFi disabled
+  Waiting = 1,      // no STA link (AP mode or WiFi down)
+  Connecting = 2,   // broker unreachable, retrying with backoff
+  Connected = 3
+};
+
+const char* mqttStateName(MqttState s);
+
+// Pushes the log rows and the cycle summaries to an MQTT broker, so a
+// central dashboard gets every row of every tester without polling:
+// - loop() side (service): batches new log rows (kMqttBatchRows per message,
+//   or fewer after kMqttBatchMaxAge_ms) and each completed cycle into JSON
+//   messages on a small queue
+// - network task: connects with backoff and publishes the queue in order;
+//   a message leaves the queue only after publish() succeeded
+// - store-and-forward: while the broker or WiFi is down the queue fills and
+//   service() stops building; the rows behind it wait in the LogBuffer (row
+//   sequence numbers) and go out in order after the reconnect. Rows the log
+//   ring overwrote before they were sent are counted as lost.
+//
+// Topics under <kMqttTopicRoot>/<device id>/:
+//   online   "1" (retained), "0" as last will
+//   schema   ["Time_s","Cycle",...] column names of the rows (retained)
+//   samples  {"seq":120,"rows":[[...],...]}  seq = number of the first row
+//   cycles   {"seq":3,"cycle":{...}}         record as in /api/cycles
+class MqttPublisher {
+public:
+  enum class Topic : uint8_t { Samples, Cycles };
+
+  // One queued message (~1 KiB)
+  struct Msg {
+    Topic topic;
+    uint16_t len;
+    char payload[kMqttPayloadBytes];
+  };
+
+  MqttPublisher(LogBuffer& log, CycleTable& cycles);
+
+  // Queue storage: kMqttQueueMsgs messages (boot arena). Nothing is built
+  // without it.
+  void setStorage(Msg* msgs) { queue_.setStorage(msgs); }
+
+  // Create the network task (nothing happens without kMqttBroker).
+  void begin();
+
+  // loop(): build messages from new rows / cycles while the queue has room.
+  void service(uint64_t now_ms);
+
+  MqttState state() const { return state_.load(); }
+  const char* deviceId() const { return deviceId_; }
+  size_t queued() const { return queue_.size(); }
+  uint32_t backlogRows() const;                      // held rows not yet built
+  uint32_t sent() const { return sent_.load(); }     // messages published
+  uint32_t lost() const { return lost_; }            // rows / cycles overwritten unsent
+  uint32_t connects() const { return connects_.load(); }
+
+private:
+  LogBuffer& log_;
+  CycleTable& cycles_;
+  bool enabled_ = false;
+
+  SpscRing<Msg, kMqttQueueMsgs, true> queue_;
+
+  // loop() side
+  Msg scratch_;                   // message being built
+  uint32_t rowSeq_ = 0;           // next log row to build
+  uint32_t cycleSeq_ = 0;         // next cycle record to build
+  bool rowsPending_ = false;      // rowSeq_ behind the log since pendingSinceMs_
+  uint64_t pendingSinceMs_ = 0;
+  uint32_t lost_ = 0;
+
+  // Task side
+  std::atomic<MqttState> state_{MqttState::Off};
+  std::atomic<uint32_t> sent_{0};
+  std::atomic<uint32_t> connects_{0};
+  uint64_t nextAttemptMs_ = 0;
+  uint32_t backoffMs_ = kMqttRetryMin_ms;
+
+  char deviceId_[24] = {};
+  char topicBase_[64] = {};
+
+  bool buildRows_(uint32_t maxRows);
+  bool buildCycle_(uint32_t seq);
+  void topic_(char* out, size_t outLen, const char* leaf) const;
+
+  static void taskMain_(void* arg);
+  void step_();
+  bool connect_();
+};
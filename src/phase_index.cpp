@@ -0,0 +1,103 @@
+#include "phase_index.h"
+#include <Arduino.h>
+
+void PhaseIndex::setStorage(PhaseMark* ring, size_t slots) {
+  ring_ = ring;
+  slots_ = ring ? slots : 0;
+  clear();
+}
+
+void PhaseIndex::clear() {
+  head_ = 0;
+  size_ = 0;
+  truncated_ = false;
+  coveredFrom_ = 0;
+}
+
+void PhaseIndex::onRow(uint32_t seq, uint32_t time_s, uint16_t cycle, uint8_t phase,
+                       uint32_t oldestSeq) {
+  // Same segment as the previous row: nothing to record
+  if (size_ > 0) {
+    const PhaseMark& last = at(size_ - 1);
+    if (last.cycle == cycle && last.phase == phase) {
+      evict_(oldestSeq);
+      return;
+    }
+  }
+
+  if (slots_ == 0) {
+    // No storage: nothing is covered, lookups scan all held rows
+    truncated_ = true;
+    coveredFrom_ = seq + 1;
+    return;
+  }
+
+  if (size_ == slots_) {
+    // Index full: its oldest segment loses its mark
+    size_--;
+    truncated_ = true;
+    coveredFrom_ = at(0).seq;
+  }
+
+  PhaseMark& m = ring_[head_];
+  m.seq = seq;
+  m.time_s = time_s;
+  m.cycle = cycle;
+  m.phase = phase;
+  head_ = (head_ + 1) % slots_;
+  size_++;
+
+  evict_(oldestSeq);
+}
+
+void PhaseIndex::evict_(uint32_t oldestSeq) {
+  // Mark 0 is gone once the next segment starts at or before the oldest row
+  while (size_ >= 2 && (int32_t)(at(1).seq - oldestSeq) <= 0) size_--;
+
+  if (truncated_ && (int32_t)(coveredFrom_ - oldestSeq) <= 0) truncated_ = false;
+}
+
+bool PhaseIndex::find(uint16_t cycle, int phase, uint32_t oldestSeq, uint32_t nextSeq,
+                      uint32_t& first, uint32_t& end) const {
+  bool found = false;
+
+  for (size_t k = 0; k < size_; ++k) {
+    const PhaseMark& m = at(k);
+    if (m.cycle != cycle || (phase >= 0 && m.phase != (uint8_t)phase)) continue;
+
+    const uint32_t segEnd = (k + 1 < size_) ? at(k + 1).seq : nextSeq;
+    if (!found) first = m.seq;
+    end = segEnd;
+    found = true;
+  }
+
+  // Rows before the first mark are not indexed: they may match as well
+  if (truncated_) {
+    if (!found) end = coveredFrom_;
+    first = oldestSeq;
+    found = true;
+  }
+  if (!found) return false;
+
+  // The oldest segment may be partly overwritten already
+  if ((int32_t)(first - oldestSeq) < 0) first = oldestSeq;
+  return (int32_t)(end - first) > 0;
+}
+
+void PhaseIndex::printJson(Print& out, uint32_t oldestSeq, uint32_t nextSeq) const {
+  out.print("{\"marks\":[");
+  for (size_t k = 0; k < size_; ++k) {
+    const PhaseMark& m = at(k);
+    const uint32_t first = ((int32_t)(m.seq - oldestSeq) < 0) ? oldestSeq : m.seq;
+    const uint32_t end = (k + 1 < size_) ? at(k + 1).seq : nextSeq;
+
+    if (k > 0) out.print(',');
+    out.print("{\"seq\":");     out.print((unsigned long)first);
+    out.print(",\"t_s\":");     out.print((unsigned long)m.time_s);
+    out.print(",\"cycle\":");   out.print((unsigned long)m.cycle);
+    out.print(",\"phase\":");   out.print((unsigned long)m.phase);
+    out.print(",\"rows\":");    out.print((unsigned long)(end - first));
+    out.print('}');
+  }
+  out.print("]}");
+}
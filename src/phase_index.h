@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+class Print;
+
+// One cycle / phase boundary in the log: the first row of a new
+// (cycle, phase) pair.
+struct PhaseMark {
+  uint32_t seq = 0;       // LogBuffer row sequence number
+  uint32_t time_s = 0;    // Time_s of that row
+  uint16_t cycle = 0;
+  uint8_t phase = 0;
+};
+
+// Secondary index over the LogBuffer rows, so per-cycle / per-phase reads
+// jump to the right rows instead of scanning the whole ring:
+// - Sampler reports every stored row; a mark is added whenever cycle or
+//   phase differ from the previous row
+// - mark k covers rows [seq_k, seq_k+1); marks whose rows the log ring has
+//   overwritten are evicted together with them
+// - full index: the oldest mark is dropped and lookups fall back to the
+//   oldest held row for the part no longer covered
+// Storage comes from outside like for CycleTable.
+class PhaseIndex {
+public:
+  void setStorage(PhaseMark* ring, size_t slots);
+  size_t capacity() const { return slots_; }
+
+  void clear();
+
+  // After LogBuffer::store(); oldestSeq = LogBuffer::oldestSeq() afterwards.
+  void onRow(uint32_t seq, uint32_t time_s, uint16_t cycle, uint8_t phase,
+             uint32_t oldestSeq);
+
+  // Row range [first, end) holding every row of `cycle` (and `phase` unless
+  // phase < 0). Rows in between may belong to other phases (a filter still
+  // applies). false: no such rows held.
+  bool find(uint16_t cycle, int phase, uint32_t oldestSeq, uint32_t nextSeq,
+            uint32_t& first, uint32_t& end) const;
+
+  size_t size() const { return size_; }
+  const PhaseMark& at(size_t k) const { return ring_[(oldest_() + k) % slots_]; }   // k = 0 oldest
+
+  // {"marks":[{"seq":..,"t_s":..,"cycle":..,"phase":..,"rows":..},...]}
+  void printJson(Print& out, uint32_t oldestSeq, uint32_t nextSeq) const;
+
+private:
+  PhaseMark* ring_ = nullptr;
+  size_t slots_ = 0;
+  size_t head_ = 0;             // next write slot
+  size_t size_ = 0;
+  bool truncated_ = false;      // marks dropped while their rows were still held
+  uint32_t coveredFrom_ = 0;    // first seq covered by a mark (if truncated_)
+
+  size_t oldest_() const { return slots_ ? (head_ + slots_ - size_) % slots_ : 0; }
+  void evict_(uint32_t oldestSeq);
+};
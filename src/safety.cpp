@@ -0,0 +1,153 @@
+#include "safety.h"
+#include <Arduino.h>
+#include "log.h"
+#include "hw.h"
+#include "state_machine.h"
+#include "metrics.h"
+#include "clock.h"
+
+static const char* TAG = "SAFETY"; // For BT_LOG*
+
+const char* safetyFaultName(SafetyFault f) {
+  switch (f) {
+    case SafetyFault::None:         return "none";
+    case SafetyFault::OverVoltage:  return "over_voltage";
+    case SafetyFault::UnderVoltage: return "under_voltage";
+    case SafetyFault::OverCurrent:  return "over_current";
+    case SafetyFault::SensorLost:   return "sensor_lost";
+  }
+  return "?";
+}
+
+SafetyMonitor::SafetyMonitor(Hw& hw, StateMachine& sm)
+  : hw_(hw), sm_(sm) {}
+
+void SafetyMonitor::setLimits(const SafetyLimits& l) {
+  const uint32_t seq = limitsSeq_.load(std::memory_order_relaxed);
+  limitsSeq_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  limits_ = l;
+  limitsSeq_.store(seq + 2, std::memory_order_release);
+}
+
+// Never waits: the task runs above loop(), so it could preempt setLimits()
+// halfway and spin forever. A torn read keeps the previous set for this check.
+const SafetyLimits& SafetyMonitor::activeLimits_() {
+  const uint32_t seq = limitsSeq_.load(std::memory_order_acquire);
+  if (seq & 1u) return active_;
+  const SafetyLimits copy = limits_;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (limitsSeq_.load(std::memory_order_relaxed) == seq) active_ = copy;
+  return active_;
+}
+
+void SafetyMonitor::begin() {
+#ifndef BT_HOST
+  TaskHandle_t handle = nullptr;
+  if (xTaskCreate(taskMain_, "safety", kSafetyTaskStack, this,
+                  kSafetyTaskPriority, &handle) != pdPASS) {
+    BT_LOGE(TAG, "safety task not started");
+    return;
+  }
+  metricsRegisterTask("safety", handle);
+  BT_LOGI(TAG, "monitor running every %lu ms", (unsigned long)kSafetyPeriod_ms);
+#endif
+}
+
+void SafetyMonitor::taskMain_(void* arg) {
+#ifndef BT_HOST
+  SafetyMonitor* self = static_cast<SafetyMonitor*>(arg);
+
+  // Fixed rate, independent of how long a check took
+  TickType_t last = xTaskGetTickCount();
+  for (;;) {
+    vTaskDelayUntil(&last, pdMS_TO_TICKS(kSafetyPeriod_ms));
+    self->check(clockNow_us());
+  }
+#else
+  (void)arg;
+#endif
+}
+
+bool SafetyMonitor::check(uint64_t now_us) {
+  ScopedTimer timer(MetricId::SafetyCheck);
+  checks_++;
+
+  // Latched: keep everything off (a switch request racing with the trip
+  // in loop() may have slipped through the interlock check)
+  if (faulted()) {
+    if (hw_.isChargeOn() || hw_.isDischargeOn()) hw_.trip();
+    return false;
+  }
+
+  // Armed only while the tester drives the battery (idle terminals may float)
+  const bool charging = hw_.isChargeOn();
+  const bool discharging = hw_.isDischargeOn();
+  if (!charging && !discharging) {
+    pendingCount_ = 0;
+    return false;
+  }
+
+  const SafetyLimits& lim = activeLimits_();
+  const float v = hw_.readVoltage_V();
+  const float i = hw_.readCurrent_A();
+
+  SafetyFault f = SafetyFault::None;
+  float value = NAN;
+  if (isnan(v) || isnan(i)) {
+    f = SafetyFault::SensorLost;
+  } else if (v > lim.maxVoltage_V) {
+    f = SafetyFault::OverVoltage;
+    value = v;
+  } else if (discharging && v < lim.minVoltage_V) {
+    f = SafetyFault::UnderVoltage;
+    value = v;
+  } else if (fabsf(i) > lim.maxCurrent_A) {
+    f = SafetyFault::OverCurrent;
+    value = i;
+  }
+
+  if (f == SafetyFault::None) {
+    pendingCount_ = 0;
+    return false;
+  }
+
+  if (pendingCount_ == 0 || f != pending_) {
+    pending_ = f;
+    pendingCount_ = 0;
+    pendingSince_us_ = now_us;
+  }
+  const uint8_t needed = (lim.debounce > 0) ? lim.debounce : 1;
+  if (++pendingCount_ < needed) return false;
+
+  // Trip: outputs off first, bookkeeping after
+  hw_.trip();
+  const uint64_t off_us = clockNow_us();
+
+  faultLatency_us_ = (uint32_t)(off_us - pendingSince_us_);
+  faultValue_ = value;
+  faultTime_ms_ = off_us / 1000ULL;
+  metricsHistogram(MetricId::FaultLatency).record(faultLatency_us_);
+
+  pendingCount_ = 0;
+  fault_.store(f);
+  notifyPending_.store(true);
+  return true;
+}
+
+void SafetyMonitor::service() {
+  if (!notifyPending_.exchange(false)) return;
+
+  BT_LOGE(TAG, "%s (%.3f), outputs off %lu us after the first bad sample",
+          safetyFaultName(fault()), faultValue_, (unsigned long)faultLatency_us_);
+  sm_.notifyError();
+}
+
+void SafetyMonitor::clearFault() {
+  if (!faulted()) return;
+  BT_LOGI(TAG, "fault %s cleared", safetyFaultName(fault()));
+
+  notifyPending_.store(false);
+  fault_.store(SafetyFault::None);
+  hw_.release();
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <stdint.h>
+#include <math.h>
+#include <atomic>
+#include "config.h"
+
+class Hw;
+class StateMachine;
+
+// Latched fault codes (cleared only by an explicit reset).
+enum class SafetyFault : uint8_t {
+  None = 0,
+  OverVoltage = 1,    // V > maxVoltage_V
+  UnderVoltage = 2,   // V < minVoltage_V while discharging
+  OverCurrent = 3,    // |I| > maxCurrent_A
+  SensorLost = 4      // no reading while an output is on
+};
+
+const char* safetyFaultName(SafetyFault f);
+
+struct SafetyLimits {
+  float maxVoltage_V = kSafetyMaxVoltage_V;
+  float minVoltage_V = kSafetyMinVoltage_V;
+  float maxCurrent_A = kSafetyMaxCurrent_A;
+  uint8_t debounce = kSafetyDebounceSamples;   // consecutive samples beyond a limit
+};
+
+// Hard-limit watchdog on raw samples, independent of the adaptive core period:
+// - runs in its own task every kSafetyPeriod_ms, above loop() priority
+// - trips the Hw interlock (outputs off) directly from that task, so the
+//   reaction does not wait for loop() (HTTP download, IR pulse, ...)
+// - the StateMachine is not thread safe: loop() forwards the trip through
+//   service() (notifyError()) on its next iteration
+// - the fault stays latched until clearFault()
+class SafetyMonitor {
+public:
+  SafetyMonitor(Hw& hw, StateMachine& sm);
+
+  // loop() only. The task picks a new set up as a whole (seqlock, see
+  // activeLimits_()); a check racing with the update keeps the old set.
+  void setLimits(const SafetyLimits& l);
+  SafetyLimits limits() const { return limits_; }
+
+  // Start the monitor task (target only; host tools call check() directly).
+  void begin();
+
+  // Check one raw sample taken at now_us. Returns true if it tripped.
+  bool check(uint64_t now_us);
+
+  // Call from loop(): reports a new trip to the StateMachine.
+  void service();
+
+  // Reset from the UI: releases the interlock (trips again if a limit is
+  // still exceeded once an output is switched on).
+  void clearFault();
+
+  bool faulted() const { return fault_.load() != SafetyFault::None; }
+  SafetyFault fault() const { return fault_.load(); }
+  float faultValue() const { return faultValue_; }
+  uint64_t faultTime_ms() const { return faultTime_ms_; }
+  uint32_t faultLatency_us() const { return faultLatency_us_; }   // first bad sample -> outputs off
+  uint32_t checks() const { return checks_; }
+
+private:
+  Hw& hw_;
+  StateMachine& sm_;
+  // Written by loop() between two limitsSeq_ increments (odd = writing)
+  SafetyLimits limits_;
+  std::atomic<uint32_t> limitsSeq_{0};
+  SafetyLimits active_;              // task: last complete copy
+
+  // Published by the task after the details below are written
+  std::atomic<SafetyFault> fault_{SafetyFault::None};
+  std::atomic<bool> notifyPending_{false};
+  float faultValue_ = NAN;
+  uint64_t faultTime_ms_ = 0;
+  uint32_t faultLatency_us_ = 0;
+
+  // Debounce: run of consecutive violations and when it started
+  SafetyFault pending_ = SafetyFault::None;
+  uint8_t pendingCount_ = 0;
+  uint64_t pendingSince_us_ = 0;
+
+  uint32_t checks_ = 0;
+
+  const SafetyLimits& activeLimits_();
+
+  static void taskMain_(void* arg);
+};
@@ -0,0 +1,83 @@
+#include "sampler.h"
+#include <Arduino.h>
+
+#include "config.h"
+#include "state_machine.h"
+#include "core.h"
+#include "log_buffer.h"
+#include "shadow.h"
+#include "phase_index.h"
+#include "metrics.h"
+#include "clock.h"
+
+Sampler::Sampler(StateMachine& sm, Core& core, LogBuffer& log)
+  : sm_(sm), core_(core), log_(log) {}
+
+bool Sampler::service(uint64_t now_ms) {
+  // Core sampling (adaptive period, see CoreConfig::sampleMin_s/sampleMax_s),
+  // the first one right after boot
+  if (samples_ > 0 && now_ms - lastCoreMs_ < intervalMs_) return false;
+
+  // Lateness vs. the scheduled instant (sampling jitter)
+  const uint64_t nowUs = clockNow_us();
+  if (samples_ > 0) {
+    const int64_t late_us = (int64_t)(nowUs - lastCoreUs_) - (int64_t)intervalMs_ * 1000;
+    metricsHistogram(MetricId::SampleJitter).record(late_us > 0 ? (uint32_t)late_us : 0);
+  } else {
+    metricsMarkBoot(BootMark::FirstSample);
+  }
+  lastCoreUs_ = nowUs;
+  lastCoreMs_ = now_ms;
+  samples_++;
+
+  // SM orchestration
+  sm_.tick();
+
+  // Compute core (stop rules, waits, energy integration)
+  const auto tel = sm_.getTelemetry();
+  const bool wasRunning = core_.runState() != RunState::Off;
+  const Phase phaseBefore = core_.phase();
+  {
+    ScopedTimer coreTimer(MetricId::CoreTick);
+    core_.tick(now_ms, tel);
+  }
+  intervalMs_ = core_.nextSampleInterval_ms();
+
+  // Only an internal resistance pulse was finished: nothing new to evaluate
+  if (!core_.tickSampled()) return true;
+
+  // Alternative stop criteria see exactly the same sample
+  if (shadows_) shadows_->observe(core_, wasRunning, phaseBefore);
+
+  if (core_.runState() == RunState::Off) return true;
+
+  // Periodic data log row (content-free buffer: we push already computed values).
+  // Rows are taken right after a core sample so time, U/I and energy belong
+  // to the same instant even though the sample period varies.
+  if (now_ms - lastLogMs_ >= core_.logInterval_s() * 1000ULL) {
+    lastLogMs_ = now_ms;
+    storeRow_();
+  }
+  return true;
+}
+
+void Sampler::storeRow_() {
+  // Map runtime values to schema order (config.h).
+  ColValue row[kLogSchemaCols];
+
+  row[0].u32 = (uint32_t)((core_.lastSampleMs() + 500) / 1000);   // Time_s
+  row[1].u16 = core_.cycleIndex1Based();               // Cycle
+  row[2].u8  = (uint8_t)core_.phase();                 // Phase
+  row[3].u8  = (uint8_t)core_.runState();              // Status
+  row[4].f32 = core_.lastVoltage_V();                  // U_V
+  row[5].f32 = core_.lastCurrent_A();                  // I_A
+  row[6].f32 = core_.phaseEnergy_Wh();                 // Ephase_Wh
+  row[7].f32 = core_.lastInternalResistance_mOhm();    // R_mOhm
+
+  if (!log_.store(row, kLogSchemaCols)) return;
+  rows_++;
+
+  if (index_) {
+    index_->onRow(log_.nextSeq() - 1, row[0].u32, row[1].u16, row[2].u8, log_.oldestSeq());
+  }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+
+class StateMachine;
+class Core;
+class LogBuffer;
+class ShadowEvaluator;
+class PhaseIndex;
+
+// Drives the periodic work shared by the firmware loop and host tools:
+// - one core sample whenever the adaptive period has elapsed
+// - one log row right after a core sample once the log interval has elapsed
+class Sampler {
+public:
+  Sampler(StateMachine& sm, Core& core, LogBuffer& log);
+
+  // Optional what-if evaluation, fed after every core sample.
+  void attachShadows(ShadowEvaluator* shadows) { shadows_ = shadows; }
+
+  // Optional cycle / phase boundary index over the stored log rows.
+  void attachIndex(PhaseIndex* index) { index_ = index; }
+
+  // Call as often as possible. Returns true if a core sample was taken.
+  bool service(uint64_t now_ms);
+
+  // Time of the next scheduled core sample (host tools jump straight there).
+  // The first sample is due at once.
+  uint64_t nextDue_ms() const { return samples_ ? lastCoreMs_ + intervalMs_ : 0; }
+
+  uint32_t sampleCount() const { return samples_; }
+  uint32_t rowCount() const { return rows_; }
+
+private:
+  StateMachine& sm_;
+  Core& core_;
+  LogBuffer& log_;
+  ShadowEvaluator* shadows_ = nullptr;
+  PhaseIndex* index_ = nullptr;
+
+  // 64-bit monotonic time (clock.h)
+  uint64_t lastCoreMs_ = 0;
+  uint64_t lastCoreUs_ = 0;
+  uint32_t intervalMs_ = 1000;
+  uint64_t lastLogMs_ = 0;
+
+  uint32_t samples_ = 0;
+  uint32_t rows_ = 0;
+
+  void storeRow_();
+};
@@ -0,0 +1,373 @@
+#include "sequencer.h"
+#include <Arduino.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* kTypeNames[] = { "rest", "charge", "discharge", "pulse", "loop" };
+
+const char* stepTypeName(StepType t) {
+  const uint8_t k = (uint8_t)t;
+  return (k < sizeof(kTypeNames) / sizeof(kTypeNames[0])) ? kTypeNames[k] : "?";
+}
+
+static bool stepTypeFromName(const char* name, StepType& out) {
+  for (uint8_t k = 0; k < sizeof(kTypeNames) / sizeof(kTypeNames[0]); ++k) {
+    if (!strcmp(name, kTypeNames[k])) {
+      out = (StepType)k;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* stepEndName(StepEnd e) {
+  switch (e) {
+    case StepEnd::None:    return "none";
+    case StepEnd::Time:    return "time";
+    case StepEnd::Voltage: return "voltage";
+    case StepEnd::Current: return "current";
+    case StepEnd::Ah:      return "ah";
+    case StepEnd::Rules:   return "rules";
+  }
+  return "?";
+}
+
+// ---------------------------------------------------------------------------
+// JSON (same "tiny extractor" approach as UiHttp, on plain C strings so the
+// host tools can load programs too)
+// ---------------------------------------------------------------------------
+
+// Start of the value of "key" inside [begin, end), nullptr if missing.
+static const char* findValue(const char* begin, const char* end, const char* key) {
+  const size_t n = strlen(key);
+  for (const char* p = begin; p + n + 2 < end; ++p) {
+    if (p[0] != '"' || strncmp(p + 1, key, n) != 0 || p[n + 1] != '"') continue;
+    const char* q = p + n + 2;
+    while (q < end && *q == ' ') q++;
+    if (q >= end || *q != ':') continue;
+    q++;
+    while (q < end && *q == ' ') q++;
+    return (q < end) ? q : nullptr;
+  }
+  return nullptr;
+}
+
+static bool readNumber(const char* begin, const char* end, const char* key, double& out) {
+  const char* v = findValue(begin, end, key);
+  if (!v) return false;
+  char* stop = nullptr;
+  out = strtod(v, &stop);
+  return stop != v;
+}
+
+static bool readString(const char* begin, const char* end, const char* key,
+                       char* out, size_t outLen) {
+  const char* v = findValue(begin, end, key);
+  if (!v || *v != '"') return false;
+  v++;
+  size_t n = 0;
+  while (v < end && *v != '"' && n + 1 < outLen) out[n++] = *v++;
+  out[n] = '\0';
+  return v < end && *v == '"';
+}
+
+static uint32_t toU32(double d) {
+  if (!(d > 0.0)) return 0;
+  return (d >= 4294967295.0) ? UINT32_MAX : (uint32_t)d;
+}
+
+bool stepProgramFromJson(const char* json, StepProgram& out, char* err, size_t errLen) {
+  out.count = 0;
+
+  const char* p = strstr(json, "\"steps\"");
+  if (p) p = strchr(p, '[');
+  if (!p) {
+    snprintf(err, errLen, "missing \"steps\" array");
+    return false;
+  }
+  p++;
+
+  for (;;) {
+    while (*p == ' ' || *p == ',' || *p == '\n' || *p == '\r' || *p == '\t') p++;
+    if (*p == ']') break;
+
+    const char* e = (*p == '{') ? strchr(p, '}') : nullptr;
+    if (!e) {
+      snprintf(err, errLen, "malformed step %u", (unsigned)out.count);
+      return false;
+    }
+    if (out.count >= kProgramMaxSteps) {
+      snprintf(err, errLen, "too many steps (max %u)", (unsigned)kProgramMaxSteps);
+      return false;
+    }
+
+    Step& s = out.steps[out.count];
+    s = Step();
+
+    char type[16];
+    if (!readString(p, e, "type", type, sizeof(type)) || !stepTypeFromName(type, s.type)) {
+      snprintf(err, errLen, "step %u: unknown type", (unsigned)out.count);
+      return false;
+    }
+
+    double d;
+    if (readNumber(p, e, "max_s", d))   s.max_s = toU32(d);
+    if (readNumber(p, e, "until_V", d)) s.until_V = (float)d;
+    if (readNumber(p, e, "until_A", d)) s.until_A = (float)d;
+    if (readNumber(p, e, "hold_s", d))  s.hold_s = toU32(d);
+    if (readNumber(p, e, "max_Ah", d))  s.max_Ah = (float)d;
+    if (readNumber(p, e, "rules", d))   s.chargeRules = (d != 0.0);
+    if (readNumber(p, e, "on_s", d))    s.on_s = toU32(d);
+    if (readNumber(p, e, "off_s", d))   s.off_s = toU32(d);
+    if (readNumber(p, e, "to", d))      s.to = (d > 0.0 && d < 255.0) ? (uint8_t)d : 0;
+    if (readNumber(p, e, "count", d))   s.count = (d > 0.0 && d < 65535.0) ? (uint16_t)d : 0;
+    if (readNumber(p, e, "log_s", d))   s.log_s = toU32(d);
+
+    out.count++;
+    p = e + 1;
+  }
+
+  return stepProgramValidate(out, err, errLen);
+}
+
+bool stepProgramValidate(const StepProgram& p, char* err, size_t errLen) {
+  if (p.count == 0 || p.count > kProgramMaxSteps) {
+    snprintf(err, errLen, "program needs 1..%u steps", (unsigned)kProgramMaxSteps);
+    return false;
+  }
+  if (p.steps[0].type == StepType::Loop) {
+    snprintf(err, errLen, "step 0: program cannot start with a loop");
+    return false;
+  }
+
+  for (uint8_t k = 0; k < p.count; ++k) {
+    const Step& s = p.steps[k];
+    const char* msg = nullptr;
+
+    if (s.until_V < 0.0f || s.until_A < 0.0f || s.max_Ah < 0.0f) {
+      msg = "negative limit";
+    } else {
+      switch (s.type) {
+        case StepType::Rest:
+          if (s.max_s == 0) msg = "rest needs max_s";
+          break;
+        case StepType::Charge:
+          if (s.max_s == 0 && s.until_V == 0.0f && s.until_A == 0.0f &&
+              s.max_Ah == 0.0f && !s.chargeRules) msg = "no end condition";
+          break;
+        case StepType::Discharge:
+        case StepType::Pulse:
+          if (s.type == StepType::Pulse && (s.on_s == 0 || s.off_s == 0)) msg = "pulse needs on_s and off_s";
+          else if (s.until_A > 0.0f) msg = "until_A only applies to charge steps";
+          else if (s.max_s == 0 && s.until_V == 0.0f && s.max_Ah == 0.0f) msg = "no end condition";
+          break;
+        case StepType::Loop:
+          if (s.to >= k) msg = "loop target must be an earlier step";
+          else if (p.steps[s.to].type == StepType::Loop) msg = "loop target must not be a loop";
+          else if (s.count == 0) msg = "loop count must be >= 1";
+          break;
+        default:
+          msg = "unknown type";
+          break;
+      }
+    }
+
+    if (msg) {
+      snprintf(err, errLen, "step %u: %s", (unsigned)k, msg);
+      return false;
+    }
+  }
+  return true;
+}
+
+void stepProgramPrintJson(Print& out, const StepProgram& p) {
+  out.print("[");
+  for (uint8_t k = 0; k < p.count; ++k) {
+    const Step& s = p.steps[k];
+    if (k > 0) out.print(',');
+    out.print("{\"type\":\"");
+    out.print(stepTypeName(s.type));
+    out.print('"');
+
+    // Only what is set, so the output can be posted back as is
+    if (s.type == StepType::Loop) {
+      out.print(",\"to\":");    out.print((unsigned long)s.to);
+      out.print(",\"count\":"); out.print((unsigned long)s.count);
+      out.print('}');
+      continue;
+    }
+    if (s.max_s)             { out.print(",\"max_s\":");   out.print((unsigned long)s.max_s); }
+    if (s.until_V > 0.0f)    { out.print(",\"until_V\":"); out.print(s.until_V, 3); }
+    if (s.until_A > 0.0f)    { out.print(",\"until_A\":"); out.print(s.until_A, 3); }
+    if (s.hold_s)            { out.print(",\"hold_s\":");  out.print((unsigned long)s.hold_s); }
+    if (s.max_Ah > 0.0f)     { out.print(",\"max_Ah\":");  out.print(s.max_Ah, 3); }
+    if (s.chargeRules)       { out.print(",\"rules\":1"); }
+    if (s.type == StepType::Pulse) {
+      out.print(",\"on_s\":");  out.print((unsigned long)s.on_s);
+      out.print(",\"off_s\":"); out.print((unsigned long)s.off_s);
+    }
+    if (s.log_s)             { out.print(",\"log_s\":");   out.print((unsigned long)s.log_s); }
+    out.print('}');
+  }
+  out.print("]");
+}
+
+// ---------------------------------------------------------------------------
+// Interpreter
+// ---------------------------------------------------------------------------
+
+bool Sequencer::load(const StepProgram& p, char* err, size_t errLen) {
+  if (running_) {
+    snprintf(err, errLen, "program running");
+    return false;
+  }
+  if (!stepProgramValidate(p, err, errLen)) return false;
+
+  program_ = p;
+  memset(loopPass_, 0, sizeof(loopPass_));
+  idx_ = 0;
+  lastEnd_ = StepEnd::None;
+  return true;
+}
+
+void Sequencer::unload() {
+  running_ = false;
+  program_.count = 0;
+  idx_ = 0;
+}
+
+void Sequencer::begin(uint64_t now_ms) {
+  memset(loopPass_, 0, sizeof(loopPass_));
+  lastEnd_ = StepEnd::None;
+  running_ = loaded();
+  if (running_) enter_(0, now_ms);
+}
+
+void Sequencer::enter_(uint8_t idx, uint64_t now_ms) {
+  idx_ = idx;
+  stepStartMs_ = now_ms;
+  vActive_ = false;
+  aActive_ = false;
+  aArmed_ = false;
+}
+
+// "Condition true continuously for hold_ms" (as in charge_term.cpp).
+static bool heldFor(bool cond, bool& active, uint64_t& startMs,
+                    uint64_t now_ms, uint64_t hold_ms) {
+  if (!cond) {
+    active = false;
+    return false;
+  }
+  if (!active) {
+    active = true;
+    startMs = now_ms;
+  }
+  return (now_ms - startMs) >= hold_ms;
+}
+
+StepEnd Sequencer::update(uint64_t now_ms, float voltage_V, float current_A,
+                          float ah, bool rulesFired) {
+  if (!running_) return StepEnd::None;
+
+  const Step& s = step();
+  const uint64_t hold_ms = s.hold_s * 1000ULL;
+  const bool charge = (s.type == StepType::Charge);
+  StepEnd end = StepEnd::None;
+
+  if (s.max_s > 0 && (now_ms - stepStartMs_) >= s.max_s * 1000ULL) {
+    end = StepEnd::Time;
+  } else if (s.type == StepType::Rest) {
+    // Rest ends by time only
+  } else if (s.max_Ah > 0.0f && ah >= s.max_Ah) {
+    end = StepEnd::Ah;
+  } else if (rulesFired) {
+    end = StepEnd::Rules;
+  } else if (charge && s.until_A > 0.0f) {
+    // CV taper. With until_V the voltage does not end the step, it arms the
+    // current condition (the charger holds its CV level from there on);
+    // without, armed once the charger delivered more than the limit (no
+    // false stop on the first sample before the current rises)
+    const float iAbs = fabsf(current_A);
+    if (s.until_V > 0.0f) {
+      if (!aArmed_ && heldFor(voltage_V >= s.until_V, vActive_, vStartMs_, now_ms, hold_ms)) {
+        aArmed_ = true;
+        vActive_ = false;
+      }
+    } else if (iAbs >= s.until_A) {
+      aArmed_ = true;
+    }
+    if (aArmed_ && heldFor(iAbs < s.until_A, aActive_, aStartMs_, now_ms, hold_ms)) {
+      end = StepEnd::Current;
+    }
+  } else if (s.until_V > 0.0f &&
+             heldFor(charge ? (voltage_V >= s.until_V) : (voltage_V <= s.until_V),
+                     vActive_, vStartMs_, now_ms, hold_ms)) {
+    end = StepEnd::Voltage;
+  }
+
+  if (end != StepEnd::None) lastEnd_ = end;
+  return end;
+}
+
+bool Sequencer::advance(uint64_t now_ms) {
+  if (!running_) return false;
+
+  uint8_t k = idx_ + 1;
+  while (k < program_.count) {
+    const Step& s = program_.steps[k];
+    if (s.type != StepType::Loop) {
+      enter_(k, now_ms);
+      return true;
+    }
+    if (loopPass_[k] < s.count) {
+      loopPass_[k]++;
+      enter_(s.to, now_ms);        // validated: earlier, not a loop
+      return true;
+    }
+    loopPass_[k] = 0;              // done: re-arm for an enclosing loop
+    k++;
+  }
+
+  running_ = false;
+  return false;
+}
+
+bool Sequencer::pulseLoadOn(uint64_t now_ms) const {
+  const Step& s = step();
+  if (s.type != StepType::Pulse) return false;
+  const uint64_t period_ms = (uint64_t)(s.on_s + s.off_s) * 1000ULL;
+  return ((now_ms - stepStartMs_) % period_ms) < s.on_s * 1000ULL;
+}
+
+uint32_t Sequencer::msUntilNextEvent(uint64_t now_ms) const {
+  if (!running_) return UINT32_MAX;
+
+  const Step& s = step();
+  const uint64_t elapsed = now_ms - stepStartMs_;
+  const uint64_t hold_ms = s.hold_s * 1000ULL;
+  uint64_t best = UINT32_MAX;
+
+  auto consider = [&](uint64_t left) { if (left < best) best = left; };
+
+  if (s.max_s > 0) {
+    const uint64_t max_ms = s.max_s * 1000ULL;
+    consider(elapsed < max_ms ? max_ms - elapsed : 0);
+  }
+  if (vActive_) {
+    const uint64_t held = now_ms - vStartMs_;
+    consider(held < hold_ms ? hold_ms - held : 0);
+  }
+  if (aActive_) {
+    const uint64_t held = now_ms - aStartMs_;
+    consider(held < hold_ms ? hold_ms - held : 0);
+  }
+  if (s.type == StepType::Pulse) {
+    const uint64_t on_ms = s.on_s * 1000ULL;
+    const uint64_t period_ms = on_ms + s.off_s * 1000ULL;
+    const uint64_t pos = elapsed % period_ms;
+    consider(pos < on_ms ? on_ms - pos : period_ms - pos);
+  }
+  return (uint32_t)best;
+}
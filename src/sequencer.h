@@ -0,0 +1,123 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+class Print;
+
+// Step table programs: a short list of steps executed in order, e.g.
+//   charge (until 14.4 V, then until I < 0.5 A) / rest 30 min / discharge
+//   to 12.0 V / rest / loop to step 0 four more times
+// Each step carries its own end conditions and log rate. Core evaluates the
+// current step on every sample; Sequencer only holds the program and the
+// small step state (no hardware access).
+enum class StepType : uint8_t {
+  Rest = 0,        // outputs off for max_s
+  Charge = 1,
+  Discharge = 2,
+  Pulse = 3,       // load on for on_s, off for off_s, repeated
+  Loop = 4         // jump back to step `to`, `count` more times (takes no time)
+};
+
+const char* stepTypeName(StepType t);
+
+// Why a step ended (None = keep going).
+enum class StepEnd : uint8_t {
+  None = 0,
+  Time = 1,        // max_s elapsed
+  Voltage = 2,     // until_V reached (held for hold_s)
+  Current = 3,     // |I| < until_A (held for hold_s)
+  Ah = 4,          // max_Ah reached
+  Rules = 5        // CoreConfig charge termination rules (charge_term.h)
+};
+
+const char* stepEndName(StepEnd e);
+
+struct Step {
+  StepType type = StepType::Rest;
+
+  // End conditions (0 = not used); the first one met ends the step, except
+  // for a charge with until_V and until_A: reaching until_V starts the CV
+  // phase and only |I| < until_A ends it.
+  uint32_t max_s = 0;          // rest: duration, otherwise time limit
+  float until_V = 0.0f;        // charge: V >= until_V, discharge / pulse: V <= until_V
+  float until_A = 0.0f;        // charge: |I| < until_A (CV taper, after until_V if set)
+  uint32_t hold_s = 0;         // until_V / until_A must hold this long
+  float max_Ah = 0.0f;
+  bool chargeRules = false;    // charge: also end by the CoreConfig rules
+
+  // Pulse
+  uint32_t on_s = 0;
+  uint32_t off_s = 0;
+
+  // Loop
+  uint8_t to = 0;
+  uint16_t count = 0;
+
+  uint32_t log_s = 0;          // log row interval in this step (0 = kLogStoreInterval_s)
+};
+
+struct StepProgram {
+  Step steps[kProgramMaxSteps];
+  uint8_t count = 0;
+};
+
+// Parse {"steps":[{"type":"charge","until_V":14.4,...},...]} and validate.
+// On failure a readable message is written to err.
+bool stepProgramFromJson(const char* json, StepProgram& out, char* err, size_t errLen);
+bool stepProgramValidate(const StepProgram& p, char* err, size_t errLen);
+void stepProgramPrintJson(Print& out, const StepProgram& p);
+
+class Sequencer {
+public:
+  // Replace the program (validated again). Not while running.
+  bool load(const StepProgram& p, char* err, size_t errLen);
+  void unload();
+
+  bool loaded() const { return program_.count > 0; }
+  const StepProgram& program() const { return program_; }
+
+  // Run control (Core)
+  void begin(uint64_t now_ms);          // enter step 0
+  void abort() { running_ = false; }
+  bool running() const { return running_; }
+
+  uint8_t stepIndex() const { return idx_; }
+  const Step& step() const { return program_.steps[idx_]; }
+  StepEnd lastEnd() const { return lastEnd_; }
+  uint16_t loopPass(uint8_t loopStep) const { return loopPass_[loopStep]; }
+
+  // Evaluate the current step with one sample.
+  // ah:         charged / discharged Ah in this step so far (absolute)
+  // rulesFired: Core's ChargeTerm fired (charge steps with chargeRules)
+  StepEnd update(uint64_t now_ms, float voltage_V, float current_A,
+                 float ah, bool rulesFired);
+
+  // Next executable step (loops resolved). False when the program is done.
+  bool advance(uint64_t now_ms);
+
+  // Pulse steps: load state wanted at now_ms.
+  bool pulseLoadOn(uint64_t now_ms) const;
+
+  // Time until the step could end or change outputs (adaptive sampling).
+  // UINT32_MAX if nothing is scheduled.
+  uint32_t msUntilNextEvent(uint64_t now_ms) const;
+
+private:
+  StepProgram program_;
+  uint16_t loopPass_[kProgramMaxSteps] = {};   // passes taken per loop step
+
+  bool running_ = false;
+  uint8_t idx_ = 0;
+  uint64_t stepStartMs_ = 0;
+  StepEnd lastEnd_ = StepEnd::None;
+
+  // Hold timers for until_V / until_A
+  bool vActive_ = false;
+  uint64_t vStartMs_ = 0;
+  bool aActive_ = false;
+  bool aArmed_ = false;           // until_A evaluated (current rose / until_V reached)
+  uint64_t aStartMs_ = 0;
+
+  void enter_(uint8_t idx, uint64_t now_ms);
+};
@@ -0,0 +1,156 @@
+#include "shadow.h"
+#include <math.h>
+#include "log.h"
+#include "metrics.h"
+
+[[maybe_unused]] static const char* TAG = "SHADOW"; // For BT_LOG*
+
+static bool isActivePhase(Phase p) {
+  return p == Phase::Charge || p == Phase::Discharge;
+}
+
+bool ShadowEvaluator::setVariant(uint8_t slot, const CoreConfig& cfg) {
+  if (slot >= kSlots) return false;
+
+  used_[slot] = true;
+  armed_[slot] = false;   // joins at the next phase start (comparable results)
+  cfg_[slot] = cfg;
+  dischargeStop_V_[slot] = cfg.dischargeStopVoltage_V;
+
+  cur_[slot] = ShadowResult();
+  lastCharge_[slot] = ShadowResult();
+  lastDischarge_[slot] = ShadowResult();
+  return true;
+}
+
+void ShadowEvaluator::clearVariant(uint8_t slot) {
+  if (slot >= kSlots) return;
+  used_[slot] = false;
+  armed_[slot] = false;
+  cur_[slot] = ShadowResult();
+  lastCharge_[slot] = ShadowResult();
+  lastDischarge_[slot] = ShadowResult();
+}
+
+void ShadowEvaluator::observe(const Core& core, bool wasRunning, Phase phaseBefore) {
+  ScopedTimer timer(MetricId::Shadow);
+
+  const uint64_t now_ms = core.lastSampleMs();
+  const float v = core.lastVoltage_V();
+  const float i = core.lastCurrent_A();
+  const float dvdt = core.voltageSlope_Vps();
+  const bool dvdtValid = core.voltageSlopeValid();
+
+  // Run stopped (user stop, program done, error): drop the open phase
+  if (core.runState() == RunState::Off) {
+    if (wasRunning) abortPhase_();
+    return;
+  }
+  if (core.runState() != RunState::Running) return;
+
+  const Phase now = core.phase();
+
+  // Real phase ended in this sample: evaluate it once more with the final
+  // values (Core has already reset its integrators), then close it.
+  if (wasRunning && inPhase_ && isActivePhase(phaseBefore) && now != phaseBefore) {
+    const bool charge = (phaseBefore == Phase::Charge);
+    const float wh = charge ? core.lastChargeEnergy_Wh() : core.lastDischargeEnergy_Wh();
+    const float ah = charge ? core.lastChargeCharge_Ah() : core.lastDischargeCharge_Ah();
+    evaluate_(now_ms, v, i, wh, ah, dvdt, dvdtValid);
+    endPhase_(now_ms, v, wh, ah);
+    return;
+  }
+
+  if (!isActivePhase(now)) return;
+
+  if (!wasRunning) {
+    // Run started: Core evaluates this very sample, so do we
+    beginPhase_(now, now_ms);
+  } else if (now != phaseBefore || !inPhase_) {
+    // Wait -> active: Core starts integrating with the next sample
+    beginPhase_(now, now_ms);
+    return;
+  }
+
+  evaluate_(now_ms, v, i, fabsf(core.phaseEnergy_Wh()), fabsf(core.phaseCharge_Ah()), dvdt, dvdtValid);
+}
+
+void ShadowEvaluator::beginPhase_(Phase p, uint64_t now_ms) {
+  inPhase_ = true;
+  phase_ = p;
+  phaseStartMs_ = now_ms;
+
+  for (uint8_t k = 0; k < kSlots; ++k) {
+    armed_[k] = used_[k];
+    if (!armed_[k]) continue;
+
+    cur_[k] = ShadowResult();
+    cur_[k].state = ShadowResult::State::Running;
+    cur_[k].phase = p;
+    if (p == Phase::Charge) term_[k].reset(now_ms);
+  }
+}
+
+void ShadowEvaluator::evaluate_(uint64_t now_ms, float v, float i,
+                                float wh, float ah, float dvdt, bool dvdtValid) {
+  if (!inPhase_) return;
+  evaluations_++;
+
+  const uint32_t elapsed_s = (uint32_t)((now_ms - phaseStartMs_) / 1000ULL);
+
+  for (uint8_t k = 0; k < kSlots; ++k) {
+    if (!armed_[k] || cur_[k].state != ShadowResult::State::Running) continue;
+
+    ChargeStopReason reason = ChargeStopReason::None;
+    bool fired;
+    if (phase_ == Phase::Discharge) {
+      fired = (v <= dischargeStop_V_[k]);
+    } else {
+      reason = term_[k].update(cfg_[k], now_ms, v, i, ah, dvdt, dvdtValid);
+      fired = (reason != ChargeStopReason::None);
+    }
+    if (!fired) continue;
+
+    ShadowResult& r = cur_[k];
+    r.state = ShadowResult::State::Stopped;
+    r.elapsed_s = elapsed_s;
+    r.voltage_V = v;
+    r.energy_Wh = wh;
+    r.charge_Ah = ah;
+    r.reason = reason;
+
+    BT_LOGI(TAG, "slot %u: %s stop after %lu s, %.3f Wh",
+            (unsigned)k, (phase_ == Phase::Charge) ? "charge" : "discharge",
+            (unsigned long)elapsed_s, wh);
+  }
+}
+
+void ShadowEvaluator::endPhase_(uint64_t now_ms, float v, float wh, float ah) {
+  const uint32_t elapsed_s = (uint32_t)((now_ms - phaseStartMs_) / 1000ULL);
+
+  for (uint8_t k = 0; k < kSlots; ++k) {
+    if (!armed_[k]) continue;
+
+    ShadowResult& r = cur_[k];
+    if (r.state == ShadowResult::State::Running) {
+      // Would have kept going: what we know is a lower bound
+      r.state = ShadowResult::State::NotReached;
+      r.elapsed_s = elapsed_s;
+      r.voltage_V = v;
+      r.energy_Wh = wh;
+      r.charge_Ah = ah;
+    }
+
+    if (phase_ == Phase::Charge) lastCharge_[k] = r;
+    else                         lastDischarge_[k] = r;
+    r = ShadowResult();
+  }
+  inPhase_ = false;
+}
+
+void ShadowEvaluator::abortPhase_() {
+  for (uint8_t k = 0; k < kSlots; ++k) {
+    if (armed_[k]) cur_[k] = ShadowResult();
+  }
+  inPhase_ = false;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <stdint.h>
+#include "config.h"
+#include "core.h"
+#include "charge_term.h"
+
+// Outcome of one shadow variant for one active phase.
+struct ShadowResult {
+  enum class State : uint8_t {
+    Idle = 0,        // no phase observed yet
+    Running = 1,     // phase active, rule not fired yet
+    Stopped = 2,     // rule fired (stop values valid)
+    NotReached = 3   // real phase ended first (values = lower bound at real stop)
+  };
+
+  State state = State::Idle;
+  Phase phase = Phase::Charge;
+  uint32_t elapsed_s = 0;       // phase time at stop (or at real stop)
+  float voltage_V = NAN;
+  float energy_Wh = 0.0f;
+  float charge_Ah = 0.0f;
+  ChargeStopReason reason = ChargeStopReason::None;   // charge phases only
+};
+
+// Evaluates alternative CoreConfig stop criteria ("what if") on the live
+// sample stream, next to the active Core:
+// - no hardware access, no SM notifications: shadows only record when they
+//   would have stopped and the Wh / Ah measured up to that point
+// - phases stay aligned with the real run (a shadow that fires early waits
+//   for the real phase end; one that would stop later is reported NotReached)
+// - energy, charge and slope come from the Core integrators, so a sample
+//   costs one compare (discharge) or one ChargeTerm::update (charge) per slot
+// Resolution is the core sample period chosen for the active config.
+class ShadowEvaluator {
+public:
+  static constexpr uint8_t kSlots = kShadowSlots;
+
+  // Install a variant; it starts with the next active phase.
+  bool setVariant(uint8_t slot, const CoreConfig& cfg);
+  void clearVariant(uint8_t slot);
+
+  bool used(uint8_t slot) const { return slot < kSlots && used_[slot]; }
+  const CoreConfig& config(uint8_t slot) const { return cfg_[slot]; }
+
+  const ShadowResult& current(uint8_t slot) const { return cur_[slot]; }
+  const ShadowResult& lastCharge(uint8_t slot) const { return lastCharge_[slot]; }
+  const ShadowResult& lastDischarge(uint8_t slot) const { return lastDischarge_[slot]; }
+
+  // Feed after every Core::tick() with the core state from before the tick.
+  void observe(const Core& core, bool wasRunning, Phase phaseBefore);
+
+  uint32_t evaluations() const { return evaluations_; }
+
+private:
+  // Structure of arrays: the per-sample loops touch only what they need
+  bool used_[kSlots] = {};
+  bool armed_[kSlots] = {};            // takes part in the current phase
+  float dischargeStop_V_[kSlots] = {};
+  CoreConfig cfg_[kSlots];
+  ChargeTerm term_[kSlots];
+
+  ShadowResult cur_[kSlots];
+  ShadowResult lastCharge_[kSlots];
+  ShadowResult lastDischarge_[kSlots];
+
+  bool inPhase_ = false;
+  Phase phase_ = Phase::Charge;
+  uint64_t phaseStartMs_ = 0;
+  uint32_t evaluations_ = 0;
+
+  void beginPhase_(Phase p, uint64_t now_ms);
+  void evaluate_(uint64_t now_ms, float v, float i, float wh, float ah, float dvdt, bool dvdtValid);
+  void endPhase_(uint64_t now_ms, float v, float wh, float ah);
+  void abortPhase_();
+};
@@ -0,0 +1,114 @@
+#include "sim_battery.h"
+#include <math.h>
+
+// Longest internal integration step (s). Keeps the CC/CV charger and the
+// RC pair stable when callers advance by minutes at once.
+static constexpr float kMaxSubStep_s = 1.0f;
+
+void SimBattery::begin(const SimBatteryParams& p) {
+  p_ = p;
+  if (p_.capacity_Ah <= 0.0f) p_.capacity_Ah = 1.0f;
+  rng_ = p_.seed ? p_.seed : 1;
+  reset(p_.startSoc);
+}
+
+void SimBattery::reset(float soc) {
+  soc_ = (soc < 0.0f) ? 0.0f : (soc > 1.0f ? 1.0f : soc);
+  v1_ = 0.0f;
+  iBatt_ = 0.0f;
+  vTerm_ = ocvAt_(soc_);
+}
+
+float SimBattery::ocvAt_(float soc) const {
+  // Piecewise linear interpolation, clamped to the table ends
+  if (!p_.ocv || p_.ocvPoints == 0) return 0.0f;
+  if (soc <= p_.ocv[0].soc) return p_.ocv[0].ocv_V;
+
+  for (size_t k = 1; k < p_.ocvPoints; ++k) {
+    const SimOcvPoint& a = p_.ocv[k - 1];
+    const SimOcvPoint& b = p_.ocv[k];
+    if (soc <= b.soc) {
+      const float span = b.soc - a.soc;
+      const float f = (span > 0.0f) ? (soc - a.soc) / span : 0.0f;
+      return a.ocv_V + f * (b.ocv_V - a.ocv_V);
+    }
+  }
+  return p_.ocv[p_.ocvPoints - 1].ocv_V;
+}
+
+float SimBattery::currentFor_(bool chargeOn, bool dischargeOn) const {
+  if (chargeOn && !dischargeOn) {
+    // CC/CV: limit current so R0 drop + OCV + V1 stays at the CV setpoint
+    const float headroom_V = p_.chargerCv_V - ocvAt_(soc_) - v1_;
+    float i = (p_.r0_Ohm > 0.0f) ? headroom_V / p_.r0_Ohm : p_.chargeCurrent_A;
+    if (i > p_.chargeCurrent_A) i = p_.chargeCurrent_A;
+    if (i < 0.0f) i = 0.0f;
+    return i;
+  }
+
+  if (dischargeOn && !chargeOn) {
+    // Constant current load, collapses when the cell is empty
+    return (soc_ > 0.0f) ? -p_.dischargeCurrent_A : 0.0f;
+  }
+
+  return (soc_ > 0.0f) ? -p_.idleCurrent_A : 0.0f;
+}
+
+void SimBattery::subStep_(float dt_s, bool chargeOn, bool dischargeOn) {
+  iBatt_ = currentFor_(chargeOn, dischargeOn);
+
+  // Coulomb counting
+  soc_ += iBatt_ * dt_s / (3600.0f * p_.capacity_Ah);
+  if (soc_ < 0.0f) soc_ = 0.0f;
+  if (soc_ > 1.0f) soc_ = 1.0f;
+
+  // RC pair, exact solution for constant current over dt
+  const float tau_s = p_.r1_Ohm * p_.c1_F;
+  if (tau_s > 0.0f) {
+    const float a = expf(-dt_s / tau_s);
+    v1_ = v1_ * a + iBatt_ * p_.r1_Ohm * (1.0f - a);
+  } else {
+    v1_ = iBatt_ * p_.r1_Ohm;
+  }
+
+  vTerm_ = ocvAt_(soc_) + v1_ + iBatt_ * p_.r0_Ohm;
+  if (vTerm_ < 0.0f) vTerm_ = 0.0f;
+}
+
+void SimBattery::step(float dt_s, bool chargeOn, bool dischargeOn) {
+  if (!(dt_s > 0.0f)) {
+    // No time passed, but outputs may have changed (instant R0 step)
+    iBatt_ = currentFor_(chargeOn, dischargeOn);
+    vTerm_ = ocvAt_(soc_) + v1_ + iBatt_ * p_.r0_Ohm;
+    if (vTerm_ < 0.0f) vTerm_ = 0.0f;
+    return;
+  }
+
+  while (dt_s > 0.0f) {
+    const float h = (dt_s > kMaxSubStep_s) ? kMaxSubStep_s : dt_s;
+    subStep_(h, chargeOn, dischargeOn);
+    dt_s -= h;
+  }
+}
+
+float SimBattery::noise_(float sigma) {
+  if (sigma <= 0.0f) return 0.0f;
+
+  // Sum of 4 uniforms (xorshift32) ~ gaussian, variance 4/12 -> scale by sqrt(3)
+  float sum = 0.0f;
+  for (int k = 0; k < 4; ++k) {
+    rng_ ^= rng_ << 13;
+    rng_ ^= rng_ >> 17;
+    rng_ ^= rng_ << 5;
+    sum += (float)rng_ / 4294967296.0f - 0.5f;
+  }
+  return sum * 1.7320508f * sigma;
+}
+
+float SimBattery::readVoltage_V() {
+  return vTerm_ + noise_(p_.noiseV_V);
+}
+
+float SimBattery::readCurrent_A() {
+  return fabsf(iBatt_) + noise_(p_.noiseI_A);
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// One point of the open-circuit-voltage curve.
+struct SimOcvPoint {
+  float soc;     // 0..1
+  float ocv_V;
+};
+
+// Parameters of the equivalent-circuit model (defaults come from config.h).
+struct SimBatteryParams {
+  const SimOcvPoint* ocv = nullptr;   // ascending soc
+  size_t ocvPoints = 0;
+
+  float capacity_Ah = 1.0f;
+  float startSoc = 0.5f;
+
+  float r0_Ohm = 0.05f;   // series resistance
+  float r1_Ohm = 0.03f;   // polarization resistance ...
+  float c1_F = 2000.0f;   // ... and capacitance (tau = R1 * C1)
+
+  float chargerCv_V = 14.6f;       // charger: CC up to this terminal voltage, then CV
+  float chargeCurrent_A = 1.5f;    // charger CC current
+  float dischargeCurrent_A = 1.0f; // electronic load (constant current)
+  float idleCurrent_A = 0.0f;      // standby drain with both outputs off
+
+  float noiseV_V = 0.0f;           // measurement noise (approx. gaussian, 1 sigma)
+  float noiseI_A = 0.0f;
+
+  uint32_t seed = 1;               // noise PRNG seed (deterministic runs)
+};
+
+// Thevenin battery model (R0 + one RC pair) driven by the output states.
+// - SoC integrates the battery current (coulomb counting).
+// - The charger works CC/CV: current is limited so the terminal voltage
+//   does not exceed chargerCv_V, which produces a realistic taper.
+// - step() sub-steps long intervals so large time jumps stay stable.
+class SimBattery {
+public:
+  void begin(const SimBatteryParams& p);
+  void reset(float soc);
+
+  // Advance the model by dt_s with the given output states.
+  void step(float dt_s, bool chargeOn, bool dischargeOn);
+
+  // Sensor view (noise added per call). Current is reported as magnitude,
+  // like the INA219 wiring of the tester.
+  float readVoltage_V();
+  float readCurrent_A();
+
+  // Noise-free state (for host tools)
+  float soc() const { return soc_; }
+  float terminalVoltage_V() const { return vTerm_; }
+  float batteryCurrent_A() const { return iBatt_; }   // + = charging
+  float ocv_V() const { return ocvAt_(soc_); }
+
+private:
+  SimBatteryParams p_;
+
+  float soc_ = 0.5f;
+  float v1_ = 0.0f;      // RC pair voltage
+  float iBatt_ = 0.0f;   // + = charging, - = discharging
+  float vTerm_ = 0.0f;
+  uint32_t rng_ = 1;
+
+  float ocvAt_(float soc) const;
+  float currentFor_(bool chargeOn, bool dischargeOn) const;
+  void subStep_(float dt_s, bool chargeOn, bool dischargeOn);
+  float noise_(float sigma);
+};
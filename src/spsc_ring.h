@@ -0,0 +1,77 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <type_traits>
+
+// Lock-free single-producer / single-consumer ring (e.g. a sampling task
+// feeding loop()). N must be a power of two; indices run freely and wrap
+// at 2^32, so size() = head - tail also holds across the wrap.
+// - push() only from the producer, pop() / clear() only from the consumer
+// - a full ring rejects the new element (the producer counts the drop)
+// External: no inline buffer, the owner hands in N elements with setStorage()
+// (boot arena) before the first push(); until then push() fails.
+template <class T, size_t N, bool External = false>
+class SpscRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+  static constexpr size_t kCapacity = N;
+
+  // N elements, set once before the producer starts.
+  void setStorage(T* buf) {
+    static_assert(External, "SpscRing has inline storage");
+    buf_ = buf;
+  }
+
+  bool hasStorage() const {
+    if constexpr (External) return buf_ != nullptr;
+    return true;
+  }
+
+  bool push(const T& v) {
+    if constexpr (External) {
+      if (!buf_) return false;
+    }
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= N) return false;
+    buf_[head & (N - 1)] = v;
+    head_.store(head + 1, std::memory_order_release);   // publish after the write
+    return true;
+  }
+
+  bool pop(T& out) {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) return false;
+    out = buf_[tail & (N - 1)];
+    tail_.store(tail + 1, std::memory_order_release);   // slot free after the read
+    return true;
+  }
+
+  // Consumer: oldest element without removing it (nullptr if empty). Stays
+  // valid until drop(), so a send that fails can be retried in place.
+  const T* front() const {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) return nullptr;
+    return &buf_[tail & (N - 1)];
+  }
+
+  // Consumer: remove the element returned by front().
+  void drop() {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) return;
+    tail_.store(tail + 1, std::memory_order_release);
+  }
+
+  // Drop everything currently queued.
+  void clear() { tail_.store(head_.load(std::memory_order_acquire), std::memory_order_release); }
+
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+private:
+  typename std::conditional<External, T*, T[N]>::type buf_{};
+  std::atomic<uint32_t> head_{0};   // next write (producer)
+  std::atomic<uint32_t> tail_{0};   // next read (consumer)
+};
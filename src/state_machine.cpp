@@ -35,7 +35,8 @@ void StateMachine::command(CommandType c) {
       t_.phaseCount = 0;
       t_.completedCycles = 0;
       t_.idleReason = IdleReason::Ready;
-      enterMode(p_.startMode);
+      // Step tables: outputs stay off until Core enters the first step
+      enterMode(p_.stepTable ? Mode::Rest : p_.startMode);
       break;
 
     case CommandType::Stop:
@@ -71,6 +72,9 @@ void StateMachine::notifyPhaseDone() {
   t_.completedCycles = t_.phaseCount / 2;
   BT_LOGI(TAG, "phaseCount=%u completedCycles=%u", t_.phaseCount, t_.completedCycles);
 
+  // Step tables: Core picks the next step and switches the outputs
+  if (p_.stepTable) return;
+
   const Mode finishedMode = t_.mode;
 
   // Ensure current mode is safely stopped
@@ -91,6 +95,17 @@ void StateMachine::notifyPhaseDone() {
   enterMode(opposite(finishedMode));
 }
 
+void StateMachine::notifyStepMode(Mode mode) {
+  BT_LOGD(TAG, "step mode=%d", (int)mode);
+  t_.mode = mode;
+}
+
+void StateMachine::notifyProgramDone() {
+  BT_LOGI(TAG, "step program done");
+  hw_.allOff();
+  enterIdle(IdleReason::Done);
+}
+
 void StateMachine::enterIdle(IdleReason reason) {
   BT_LOGI(TAG, "enter Idle reason=%d", (int)reason);
   t_.mode = Mode::Idle;
@@ -103,6 +118,8 @@ void StateMachine::enterMode(Mode mode) {
   t_.mode = mode;
   t_.idleReason = IdleReason::Ready;
 
+  if (p_.stepTable) return;   // Core drives the outputs per step
+
   if (mode == Mode::Charge) {
     hw_.startCharge();
   } else if (mode == Mode::Discharge) {
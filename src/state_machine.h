@@ -7,7 +7,8 @@ class Hw; // Forward declaration (implemented in hw.*)
 enum class Mode : uint8_t {
   Idle,
   Charge,
-  Discharge
+  Discharge,
+  Rest        // step table programs: running, outputs off
 };
 
 // Program configuration coming from UI
@@ -15,6 +16,7 @@ struct Program {
   uint16_t cycles = 1;          // Number of full cycles (>= 1)
   Mode startMode = Mode::Charge;
   Mode stopMode  = Mode::Discharge;
+  bool stepTable = false;       // run the uploaded step table (sequencer.h) instead
 };
 
 // Reason why the system is in Idle
@@ -61,6 +63,10 @@ public:
   void notifyPhaseDone();   // Current charge/discharge phase finished
   void notifyError();       // Safety or hardware error detected
 
+  // Step table programs: Core drives the outputs and only reports here
+  void notifyStepMode(Mode mode);   // step entered (Charge / Discharge / Rest)
+  void notifyProgramDone();         // last step finished
+
 private:
   Hw& hw_;
   Program p_;
@@ -7,10 +7,88 @@
 #include "hw.h"
 #include "log_buffer.h"
 #include "core.h"
+#include "metrics.h"
+#include "shadow.h"
+#include "cycle_table.h"
+#include "sequencer.h"
+#include "safety.h"
+#include "acquisition.h"
+#include "config_store.h"
+#include "mqtt_publisher.h"
+#include "phase_index.h"
+#include "clock.h"
 
 
 static const char* TAG = "HTTP"; // For BT_LOG*
 
+// JSON number with fixed decimals ("null" for NaN, which JSON cannot encode).
+static String jsonFloat(float v, unsigned decimals) {
+  return isnan(v) ? String("null") : String(v, decimals);
+}
+
+// Query argument as a plain decimal 0..max (no sign, no garbage); toInt()
+// would turn "abc" into 0 and "-5" into a wrapped uint32_t.
+static bool parseUint(const String& s, uint32_t max, uint32_t& out) {
+  if (s.length() == 0 || s.length() > 10) return false;
+  uint64_t v = 0;
+  for (size_t k = 0; k < s.length(); ++k) {
+    const char c = s[k];
+    if (c < '0' || c > '9') return false;
+    v = v * 10 + (uint64_t)(c - '0');
+  }
+  if (v > max) return false;
+  out = (uint32_t)v;
+  return true;
+}
+
+// 64-bit unsigned as decimal (String has no uint64_t constructor on IDF 4.4).
+static String u64String(uint64_t v) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%llu", (unsigned long long)v);
+  return String(buf);
+}
+
+// Print sink that only counts bytes (used to send an exact Content-Length).
+struct CountingPrint : public Print {
+  size_t n = 0;
+  size_t write(uint8_t) override { n++; return 1; }
+  size_t write(const uint8_t* /*buf*/, size_t len) override { n += len; return len; }
+};
+
+// Print sink that sends through WebServer::sendContent() in chunks of
+// kBytes (chunked transfer encoding after CONTENT_LENGTH_UNKNOWN).
+class ChunkPrint : public Print {
+public:
+  explicit ChunkPrint(WebServer& server) : server_(server) {}
+  size_t write(uint8_t c) override {
+    buf_[n_++] = (char)c;
+    if (n_ == kBytes) flush();
+    return 1;
+  }
+  size_t write(const uint8_t* buf, size_t len) override {
+    for (size_t k = 0; k < len; ++k) write(buf[k]);
+    return len;
+  }
+  void flush() {
+    if (n_ > 0) server_.sendContent(buf_, n_);
+    n_ = 0;
+  }
+
+private:
+  static constexpr size_t kBytes = 1024;
+  WebServer& server_;
+  char buf_[kBytes];
+  size_t n_ = 0;
+};
+
+// Print sink that appends to a String.
+struct StringPrint : public Print {
+  String& s;
+  explicit StringPrint(String& dst) : s(dst) {}
+  size_t write(uint8_t c) override { s += (char)c; return 1; }
+  size_t write(const uint8_t* buf, size_t len) override { s.concat((const char*)buf, len); return len; }
+};
+
 static const char* kHtml = R"HTML(
 <!doctype html><html><head>
 <meta charset="utf-8"/>
@@ -36,6 +114,7 @@ pre{background:#f5f5f5;padding:10px;overflow:auto}
 <button onclick="ctrl('pause')">Pause</button>
 <button onclick="ctrl('resume')">Resume</button>
 <button onclick="ctrl('stop')">Stop</button>
+<button onclick="ctrl('reset')">Reset fault</button>
 <button onclick="location.href='/download'">Download</button>
 </fieldset>
 
@@ -78,6 +157,41 @@ pre{background:#f5f5f5;padding:10px;overflow:auto}
     </label>
   </div>
 
+  <div class="card">
+    <b>Charge termination</b>
+    <label><input id="tHold" type="checkbox" checked/> Hold above stop voltage</label>
+    <label><input id="tTaper" type="checkbox"/> Current taper I &lt; C/n</label>
+    <label>Capacity (Ah)
+      <input id="capAh" type="number" step="0.1" value="10"/>
+    </label>
+    <label>Taper divisor n
+      <input id="taperDiv" type="number" step="1" value="20"/>
+    </label>
+    <label>Taper hold (min)
+      <input id="taperMin" type="number" step="1" value="10"/>
+    </label>
+    <label>Arm voltage (V)
+      <input id="armV" type="number" step="0.1" value="13.8"/>
+    </label>
+    <label><input id="tPlat" type="checkbox"/> dV/dt plateau</label>
+    <label>Plateau slope (mV/min)
+      <input id="platSlope" type="number" step="0.1" value="1"/>
+    </label>
+    <label>Plateau hold (min)
+      <input id="platMin" type="number" step="1" value="15"/>
+    </label>
+    <label><input id="tNegDv" type="checkbox"/> -&Delta;V peak</label>
+    <label>-&Delta;V (mV)
+      <input id="negDvMv" type="number" step="1" value="10"/>
+    </label>
+    <label><input id="tMaxT" type="checkbox" checked/> Max time (h)
+      <input id="maxTH" type="number" step="0.5" value="24"/>
+    </label>
+    <label><input id="tMaxAh" type="checkbox"/> Max charge (Ah)
+      <input id="maxAh" type="number" step="0.1" value="12"/>
+    </label>
+  </div>
+
   <div class="card">
     <b>Wait charge → discharge</b>
     <label>Time (s)
@@ -98,9 +212,40 @@ pre{background:#f5f5f5;padding:10px;overflow:auto}
       <input id="wDC" type="number" value="10"/>
     </label>
   </div>
+
+  <div class="card">
+    <b>Internal resistance</b>
+    <label><input id="irEn" type="checkbox"/> Pulse measurement</label>
+    <label>Interval (min)
+      <input id="irMin" type="number" min="1" value="30"/>
+    </label>
+  </div>
+
+  <div class="card">
+    <b>Sampling (adaptive)</b>
+    <label>Min period (s)
+      <input id="smpMin" type="number" min="1" value="1"/>
+    </label>
+    <label>Max period (s)
+      <input id="smpMax" type="number" min="1" value="60"/>
+    </label>
+    <label>Near band (V)
+      <input id="smpBand" type="number" step="0.05" value="0.5"/>
+    </label>
+  </div>
 </div>
 
 <button onclick="saveConfig()">Save config</button>
+<div class="row" style="margin-top:8px">
+  <label>Profile
+    <select id="profSlot"></select>
+  </label>
+  <label>Name
+    <input id="profName" maxlength="15"/>
+  </label>
+  <button onclick="profile('load')">Load</button>
+  <button onclick="profile('save')">Save as</button>
+</div>
 <div id="cfgStatus" style="margin-top:8px"></div>
 </fieldset>
 
@@ -120,6 +265,22 @@ function modeVal(id){
   return document.getElementById(id).value;
 }
 
+function num(id){
+  return Number(document.getElementById(id).value);
+}
+
+function chk(id){
+  return document.getElementById(id).checked ? 1 : 0;
+}
+
+function setVal(id, v){
+  if (v != null) document.getElementById(id).value = v;
+}
+
+function setChk(id, v){
+  if (v != null) document.getElementById(id).checked = Number(v) != 0;
+}
+
 function esc(x){
   return String(x)
     .replaceAll("&","&amp;")
@@ -144,6 +305,29 @@ function applyConfigToForm(c){
 
   if (c.dischargeStopVoltage_V != null) document.getElementById('dsgV').value = c.dischargeStopVoltage_V;
   if (c.waitDischargeToCharge_s != null) document.getElementById('wDC').value = c.waitDischargeToCharge_s;
+
+  if (c.sampleMin_s != null) document.getElementById('smpMin').value = c.sampleMin_s;
+  if (c.sampleMax_s != null) document.getElementById('smpMax').value = c.sampleMax_s;
+  if (c.sampleNearBand_V != null) document.getElementById('smpBand').value = c.sampleNearBand_V;
+
+  setChk('tHold', c.termHold);
+  setChk('tTaper', c.termTaper);
+  setVal('capAh', c.capacityNominal_Ah);
+  setVal('taperDiv', c.taperDivisor);
+  if (c.taperHold_s != null) setVal('taperMin', Number(c.taperHold_s) / 60);
+  setVal('armV', c.termArmVoltage_V);
+  setChk('tPlat', c.termPlateau);
+  setVal('platSlope', c.plateauSlope_mVpm);
+  if (c.plateauHold_s != null) setVal('platMin', Number(c.plateauHold_s) / 60);
+  setChk('tNegDv', c.termNegDv);
+  if (c.negDv_V != null) setVal('negDvMv', Math.round(Number(c.negDv_V) * 1000));
+  setChk('tMaxT', c.termMaxTime);
+  if (c.maxChargeTime_s != null) setVal('maxTH', Number(c.maxChargeTime_s) / 3600);
+  setChk('tMaxAh', c.termMaxAh);
+  setVal('maxAh', c.maxChargeAh);
+
+  setChk('irEn', c.irEnabled);
+  if (c.irInterval_s != null) setVal('irMin', Number(c.irInterval_s) / 60);
 }
 
 async function loadConfig(){
@@ -162,6 +346,37 @@ async function loadConfig(){
   }
 }
 
+async function loadProfiles(){
+  try{
+    const r = await fetch('/api/profiles');
+    if (!r.ok) return;
+    const d = await r.json();
+    const sel = document.getElementById('profSlot');
+    const cur = sel.value;
+    sel.innerHTML = d.profiles.map(p =>
+      `<option value="${p.slot}">${p.slot}: ${p.name == null ? '(empty)' : esc(p.name)}</option>`).join('');
+    if (cur !== '') sel.value = cur;
+  } catch(e){}
+}
+
+async function profile(op){
+  const slot = Number(document.getElementById('profSlot').value);
+  try{
+    if (op === 'save') {
+      const name = document.getElementById('profName').value.trim();
+      await api('/api/profiles', {save: slot, name: name});
+      setCfgStatus(`Profile ${slot} saved`);
+    } else {
+      await api('/api/profiles', {load: slot});
+      await loadConfig();
+      setCfgStatus(`Profile ${slot} loaded`);
+    }
+    loadProfiles();
+  } catch(e){
+    setCfgStatus("Profile error: " + e);
+  }
+}
+
 async function saveConfig(){
   const cfg = {
     cycles: Number(document.getElementById('cycles').value),
@@ -171,7 +386,27 @@ async function saveConfig(){
     chargeStopHold_s: Math.round(Number(document.getElementById('chgHoldH').value) * 3600),
     waitChargeToDischarge_s: Number(document.getElementById('wCD').value),
     dischargeStopVoltage_V: Number(document.getElementById('dsgV').value),
-    waitDischargeToCharge_s: Number(document.getElementById('wDC').value)
+    waitDischargeToCharge_s: Number(document.getElementById('wDC').value),
+    sampleMin_s: Number(document.getElementById('smpMin').value),
+    sampleMax_s: Number(document.getElementById('smpMax').value),
+    sampleNearBand_V: Number(document.getElementById('smpBand').value),
+    termHold: chk('tHold'),
+    termTaper: chk('tTaper'),
+    capacityNominal_Ah: num('capAh'),
+    taperDivisor: num('taperDiv'),
+    taperHold_s: Math.round(num('taperMin') * 60),
+    termArmVoltage_V: num('armV'),
+    termPlateau: chk('tPlat'),
+    plateauSlope_mVpm: num('platSlope'),
+    plateauHold_s: Math.round(num('platMin') * 60),
+    termNegDv: chk('tNegDv'),
+    negDv_V: num('negDvMv') / 1000,
+    termMaxTime: chk('tMaxT'),
+    maxChargeTime_s: Math.round(num('maxTH') * 3600),
+    termMaxAh: chk('tMaxAh'),
+    maxChargeAh: num('maxAh'),
+    irEnabled: chk('irEn'),
+    irInterval_s: Math.round(num('irMin') * 60)
   };
 
   setCfgStatus("Saving...");
@@ -206,6 +441,14 @@ function fmtWh(v){
   return Number(v).toFixed(2) + " Wh";
 }
 
+function fmtOhm(v){
+  return (v == null) ? "–" : Number(v).toFixed(1) + " mΩ";
+}
+
+function fmtV(v){
+  return (v == null) ? "–" : Number(v).toFixed(3) + " V";
+}
+
 function pad2(n){
   return String(n).padStart(2,'0');
 }
@@ -221,9 +464,18 @@ function fmtUptime(ms){
   return `${days}d, ${pad2(h)}:${pad2(m)}:${pad2(s)}`;
 }
 
+let statusVersion = 0;
+
 async function refresh(){
   try{
-    const r = await fetch('/api/status');
+    const r = await fetch(`/api/status?since_version=${statusVersion}`);
+    // The snapshot only changes with its content; the clock comes in a header
+    const up = r.headers.get('X-Uptime-Ms');
+    if (r.status === 304) {   // nothing new since the last snapshot
+      const el = document.getElementById('uptime');
+      if (el && up !== null) el.textContent = fmtUptime(Number(up));
+      return;
+    }
     if (!r.ok) {
       const t = await r.text();
       throw new Error(`HTTP ${r.status}: ${t}`);
@@ -236,10 +488,13 @@ async function refresh(){
     } catch(e) {
       throw new Error(`Invalid JSON: ${txt}`);
     }
+    statusVersion = s.version;
 
-    const modeTxt = ["Idle","Charge","Discharge"][s.mode] ?? s.mode;
+    const modeTxt = ["Idle","Charge","Discharge","Rest"][s.mode] ?? s.mode;
     const idleTxt = ["Ready","Done","Error","Stopped"][s.idleReason] ?? s.idleReason;
-    const uptimeTxt = fmtUptime(s.uptime_ms);
+    const uptimeTxt = fmtUptime(up !== null ? Number(up) : s.uptime_ms);
+    const w = s.window || {};
+    const wu = w.U_V || {};
 
     document.getElementById('status').innerHTML = `
       <div class="row">
@@ -251,11 +506,26 @@ async function refresh(){
         <div class="card"><b>Phase C.</b><div>${esc(s.phaseCount)}</div></div>
         <div class="card"><b>Current</b><div>${Number(s.current_A).toFixed(2)} A</div></div>
 
-        <div class="card"><b>Uptime</b><div>${uptimeTxt}</div></div>
+        <div class="card"><b>Uptime</b><div id="uptime">${uptimeTxt}</div></div>
 
         <div class="card"><b>Energy (Last Charge)</b><div>${fmtWh(s.energy_last_charge_Wh)}</div></div>
         <div class="card"><b>Energy (Last Discharge)</b><div>${fmtWh(s.energy_last_discharge_Wh)}</div></div>
         <div class="card"><b>Energy (Current)</b><div>${fmtWh(s.energy_current_Wh)}</div></div>
+
+        <div class="card"><b>Charge (Last Charge)</b><div>${Number(s.charge_last_charge_Ah).toFixed(3)} Ah</div></div>
+        <div class="card"><b>Charge (Last Discharge)</b><div>${Number(s.charge_last_discharge_Ah).toFixed(3)} Ah</div></div>
+        <div class="card"><b>Last charge stop</b><div>${esc(s.charge_stop_reason)}</div></div>
+
+        <div class="card"><b>R internal (last)</b><div>${fmtOhm(s.ir_last_mOhm)}</div></div>
+        <div class="card"><b>R internal (cycle)</b><div>${fmtOhm(s.ir_cycle_mOhm)}</div></div>
+        <div class="card"><b>R internal (last cycle)</b><div>${fmtOhm(s.ir_last_cycle_mOhm)}</div></div>
+        <div class="card"><b>Safety</b><div>${esc(s.fault)}</div></div>
+
+        <div class="card"><b>Log window</b><div>${esc(w.rows)} rows, ${fmtUptime((w.span_s || 0) * 1000)}</div></div>
+        ${wu.min == null
+          ? `<div class="card"><b>Voltage (window mean)</b><div>${fmtV(wu.mean)}</div></div>`
+          : `<div class="card"><b>Voltage (window min / mean / max)</b><div>${fmtV(wu.min)} / ${fmtV(wu.mean)} / ${fmtV(wu.max)}</div></div>`}
+        <div class="card"><b>Energy (window, charge / discharge)</b><div>${fmtWh(w.charge_Wh)} / ${fmtWh(w.discharge_Wh)}</div></div>
       </div>
     `;
   } catch(e){
@@ -265,6 +535,9 @@ async function refresh(){
 }
 
 loadConfig();
+loadProfiles();
+fetch('/api/time', {method:'POST', headers:{'Content-Type':'application/json'},
+  body: JSON.stringify({epoch_ms: Date.now()})}).catch(()=>{});
 setInterval(refresh, 1000);
 refresh();
 </script>
@@ -274,11 +547,20 @@ refresh();
 )HTML";
 
 
-UiHttp::UiHttp(WebServer& server, StateMachine& sm, Core& core, Hw& hw, LogBuffer& log)
-  : server_(server), sm_(sm), core_(core), hw_(hw), log_(log) {}
+UiHttp::UiHttp(WebServer& server, StateMachine& sm, Core& core, Hw& hw, LogBuffer& log,
+               ShadowEvaluator& shadows, CycleTable& cycles, Sequencer& seq,
+               SafetyMonitor& safety, Acquisition& acq, ConfigStore& store,
+               MqttPublisher& mqtt, PhaseIndex& index)
+  : server_(server), sm_(sm), core_(core), hw_(hw), log_(log), shadows_(shadows),
+    cycles_(cycles), seq_(seq), safety_(safety), acq_(acq), store_(store), mqtt_(mqtt),
+    index_(index) {}
 
 
 void UiHttp::begin() {
+  // Request headers WebServer keeps (all others are dropped)
+  static const char* kHeaders[] = {"If-None-Match"};
+  server_.collectHeaders(kHeaders, 1);
+
   setupRoutes();
   server_.begin();
 }
@@ -296,6 +578,21 @@ void UiHttp::setupRoutes() {
   server_.on("/api/config",  HTTP_GET,  [this](){ handleGetConfig(); });
 
   server_.on("/download", HTTP_GET, [this](){ handleDownload(); });
+  server_.on("/api/metrics", HTTP_GET, [this](){ handleMetrics(); });
+  server_.on("/api/shadows", HTTP_GET,  [this](){ handleGetShadows(); });
+  server_.on("/api/shadows", HTTP_POST, [this](){ handleShadows(); });
+  server_.on("/api/cycles",  HTTP_GET,  [this](){ handleCycles(); });
+  server_.on("/api/time",    HTTP_POST, [this](){ handleTime(); });
+  server_.on("/api/program", HTTP_GET,  [this](){ handleGetProgram(); });
+  server_.on("/api/program", HTTP_POST, [this](){ handleProgram(); });
+  server_.on("/api/safety",  HTTP_GET,  [this](){ handleGetSafety(); });
+  server_.on("/api/safety",  HTTP_POST, [this](){ handleSafety(); });
+  server_.on("/api/capture", HTTP_GET,  [this](){ handleGetCapture(); });
+  server_.on("/api/capture", HTTP_POST, [this](){ handleCapture(); });
+  server_.on("/api/profiles", HTTP_GET,  [this](){ handleGetProfiles(); });
+  server_.on("/api/profiles", HTTP_POST, [this](){ handleProfiles(); });
+  server_.on("/api/mqtt",    HTTP_GET,  [this](){ handleGetMqtt(); });
+  server_.on("/api/logindex", HTTP_GET, [this](){ handleLogIndex(); });
 
   server_.onNotFound([this]() {
   // Common browser requests (avoid noisy error logs)
@@ -317,34 +614,155 @@ void UiHttp::handleRoot() {
   server_.send(200, "text/html; charset=utf-8", kHtml);
 }
 
-void UiHttp::handleStatus() {
-  // Keep this endpoint dumb: just serialize current telemetry.
+// Everything in the status JSON that can change without a core sample.
+uint32_t UiHttp::stateSignature_() const {
+  const auto t = sm_.getTelemetry();
+  uint32_t sig = (uint32_t)t.mode
+               | ((uint32_t)t.idleReason << 4)
+               | ((uint32_t)safety_.fault() << 8)
+               | ((uint32_t)clockEpochValid() << 15)
+               | ((uint32_t)t.phaseCount << 16);
+  if (core_.stepRun()) sig ^= 0x80000000u | ((uint32_t)seq_.stepIndex() << 24);
+  return sig;
+}
+
+void UiHttp::updateStatus(uint64_t now_ms, bool newSample) {
+  const uint32_t sig = stateSignature_();
+  if (!newSample && statusVersion_ != 0 && sig == statusSig_ &&
+      now_ms - statusRenderMs_ < kHttpStatusMaxAge_ms) {
+    return;
+  }
+  renderStatus_(now_ms);
+}
+
+void UiHttp::renderStatus_(uint64_t now_ms) {
   const auto t = sm_.getTelemetry();
 
-  // If you want live voltage/current here, you can also read hw_ directly,
-  // but ideally telemetry already contains those values.
-  const float v = hw_.readVoltage_V();
-  const float i = hw_.readCurrent_A();
-  const uint32_t up_ms = millis();
+  // While running the core has just read V/I; otherwise read them here
+  // (once per snapshot, not per request)
+  const bool running = (core_.runState() == RunState::Running);
+  const float v = running ? core_.lastVoltage_V() : hw_.readVoltage_V();
+  const float i = running ? core_.lastCurrent_A() : hw_.readCurrent_A();
 
   const float e_last_charge_Wh    = core_.lastChargeEnergy_Wh();
   const float e_last_discharge_Wh = core_.lastDischargeEnergy_Wh();
   const float e_current_Wh        = core_.currentEnergy_Wh();
 
-  String json = "{";
+  // Content first; version and clock go in front of it once it changed
+  String json;
   json += "\"mode\":" + String((int)t.mode) + ",";
   json += "\"idleReason\":" + String((int)t.idleReason) + ",";
   json += "\"phaseCount\":" + String(t.phaseCount) + ",";
   json += "\"completedCycles\":" + String(t.completedCycles) + ",";
   json += "\"voltage_V\":" + String(v, 3) + ",";
   json += "\"current_A\":" + String(i, 3) + ",";
-  json += "\"uptime_ms\":" + String(up_ms) + ",";
+  json += "\"epoch_valid\":" + String(clockEpochValid() ? "true" : "false") + ",";
+  json += "\"boot_first_sample_ms\":" + String((long)metricsBootMark_ms(BootMark::FirstSample)) + ",";
   json += "\"energy_last_charge_Wh\":" + String(e_last_charge_Wh, 3) + ",";
   json += "\"energy_last_discharge_Wh\":" + String(e_last_discharge_Wh, 3) + ",";
-  json += "\"energy_current_Wh\":" + String(e_current_Wh, 3);
+  json += "\"energy_current_Wh\":" + String(e_current_Wh, 3) + ",";
+  json += "\"charge_last_charge_Ah\":" + String(core_.lastChargeCharge_Ah(), 3) + ",";
+  json += "\"charge_last_discharge_Ah\":" + String(core_.lastDischargeCharge_Ah(), 3) + ",";
+  json += "\"charge_current_Ah\":" + String(core_.phaseCharge_Ah(), 3) + ",";
+  json += "\"charge_stop_reason\":\"" + String(chargeStopReasonName(core_.lastChargeStopReason())) + "\",";
+  json += "\"ir_last_mOhm\":" + jsonFloat(core_.lastInternalResistance_mOhm(), 1) + ",";
+  json += "\"ir_cycle_mOhm\":" + jsonFloat(core_.cycleInternalResistance_mOhm(), 1) + ",";
+  json += "\"ir_last_cycle_mOhm\":" + jsonFloat(core_.lastCycleInternalResistance_mOhm(), 1) + ",";
+  // Statistics of the held log rows (kept by LogBuffer, no scan here)
+  json += "\"window\":{\"rows\":" + String((unsigned long)log_.size());
+  json += ",\"span_s\":" + String((unsigned long)log_.windowSpan_s());
+  json += ",\"charge_Wh\":" + String(log_.windowChargeEnergy_Wh(), 3);
+  json += ",\"discharge_Wh\":" + String(log_.windowDischargeEnergy_Wh(), 3);
+  for (size_t c = 0; c < log_.colCount(); ++c) {
+    ColStats st;
+    if (!log_.colStats(c, st)) continue;
+    json += ",\"" + String(log_.colName(c)) + "\":{\"mean\":" + jsonFloat(st.mean, 3);
+    if (!isnan(st.min)) json += ",\"min\":" + jsonFloat(st.min, 3) + ",\"max\":" + jsonFloat(st.max, 3);
+    json += "}";
+  }
+  json += "},";
+  json += "\"step\":" + (core_.stepRun() ? String((int)seq_.stepIndex()) : String("null")) + ",";
+  json += "\"fault\":\"" + String(safetyFaultName(safety_.fault())) + "\"";
   json += "}";
 
-  server_.send(200, "application/json; charset=utf-8", json);
+  statusSig_ = stateSignature_();
+  statusRenderMs_ = now_ms;
+
+  // Same content as the front snapshot: keep it and its version, so polls
+  // with its ETag keep getting 304 (the clock alone is no change)
+  const uint8_t front = statusFront_;
+  if (statusVersion_ != 0 && json.length() == statusLen_[front] - statusBodyOff_[front] &&
+      memcmp(statusBuf_[front] + statusBodyOff_[front], json.c_str(), json.length()) == 0) {
+    return;
+  }
+
+  const uint32_t version = statusVersion_ + 1;
+  String head = "{\"version\":" + String((unsigned long)version) + ",";
+  head += "\"uptime_ms\":" + u64String(now_ms) + ",";
+  head += "\"epoch_ms\":" + (clockEpochValid() ? u64String(clockToEpoch_ms(now_ms)) : String("null")) + ",";
+
+  const size_t len = head.length() + json.length();
+  if (len >= kHttpStatusBytes) {
+    BT_LOGE(TAG, "status JSON too long (%u bytes), snapshot not updated", (unsigned)len);
+    return;
+  }
+
+  // Render into the back buffer, then flip
+  const uint8_t back = front ^ 1;
+  memcpy(statusBuf_[back], head.c_str(), head.length());
+  memcpy(statusBuf_[back] + head.length(), json.c_str(), json.length() + 1);
+  statusLen_[back] = len;
+  statusBodyOff_[back] = head.length();
+  statusFront_ = back;
+  statusVersion_ = version;
+}
+
+// If-None-Match: one entity tag or a comma-separated list, weak ("W/")
+// tags compare equal for this purpose, "*" matches any.
+static bool etagListMatches(const String& header, const char* etag) {
+  const char* p = header.c_str();
+  const size_t n = strlen(etag);
+  while (*p) {
+    while (*p == ' ' || *p == ',') p++;
+    if (!*p) break;
+    if (p[0] == '*') return true;
+    if (p[0] == 'W' && p[1] == '/') p += 2;
+    const char* end = p;
+    while (*end && *end != ',') end++;
+    const char* last = end;
+    while (last > p && last[-1] == ' ') last--;
+    if ((size_t)(last - p) == n && strncmp(p, etag, n) == 0) return true;
+    p = end;
+  }
+  return false;
+}
+
+void UiHttp::handleStatus() {
+  ScopedTimer timer(MetricId::HttpStatus);
+
+  // Before the first updateStatus() (requests during setup)
+  if (statusVersion_ == 0) renderStatus_(clockNow_ms());
+
+  char etag[16];
+  snprintf(etag, sizeof(etag), "\"%lu\"", (unsigned long)statusVersion_);
+
+  // Unchanged since the client's copy: If-None-Match or ?since_version=
+  bool unchanged = server_.hasHeader("If-None-Match") &&
+                   etagListMatches(server_.header("If-None-Match"), etag);
+  if (!unchanged && server_.hasArg("since_version")) {
+    unchanged = (uint32_t)server_.arg("since_version").toInt() == statusVersion_;
+  }
+
+  server_.sendHeader("ETag", etag);
+  server_.sendHeader("Cache-Control", "no-cache");
+  server_.sendHeader("X-Uptime-Ms", u64String(clockNow_ms()));   // also with 304
+  if (unchanged) {
+    server_.send(304);
+    return;
+  }
+
+  const uint8_t f = statusFront_;
+  server_.send_P(200, "application/json; charset=utf-8", statusBuf_[f], statusLen_[f]);
 }
 
 void UiHttp::handleControl() {
@@ -358,7 +776,17 @@ void UiHttp::handleControl() {
 
   BT_LOGI(TAG, "POST /api/control body=%s", body.c_str());
   if (body.indexOf("\"cmd\":\"start\"") >= 0) {
+    if (safety_.faulted()) {
+      server_.send(409, "text/plain", "Safety fault latched, reset first");
+      return;
+    }
     sm_.command(CommandType::Start);
+  } else if (body.indexOf("\"cmd\":\"reset\"") >= 0) {
+    // Clears a latched safety fault; a running program is left alone
+    safety_.clearFault();
+    if (sm_.getTelemetry().idleReason == IdleReason::Error) {
+      sm_.command(CommandType::ResetError);
+    }
   } else if (body.indexOf("\"cmd\":\"stop\"") >= 0) {
     sm_.command(CommandType::Stop);
   } else if (body.indexOf("\"cmd\":\"pause\"") >= 0) {
@@ -413,38 +841,44 @@ bool UiHttp::extractNumber(const String& body, const char* key, float& out) {
   return true;
 }
 
-void UiHttp::handleConfig() {
-  String body;
-  if (!readJsonBody(server_, body)) {
-    BT_LOGW(TAG, "POST /api/config missing body");
-    server_.send(400, "text/plain", "Missing body");
-    return;
-  }
-
-  BT_LOGI(TAG, "POST /api/config body=%s", body.c_str());
+bool UiHttp::extractNumber(const String& body, const char* key, uint64_t& out) {
+  String pat = String("\"") + key + "\":";
+  int idx = body.indexOf(pat);
+  if (idx < 0) return false;
+  idx += pat.length();
 
-  // --- Program (StateMachine) ------------------------------------------------
-  Program p = sm_.getProgram();
+  while (idx < (int)body.length() && body[idx] == ' ') idx++;
+  if (idx >= (int)body.length() || body[idx] < '0' || body[idx] > '9') return false;
 
-  long ltmp;
-  if (extractNumber(body, "cycles", ltmp)) {
-    if (ltmp < 1) ltmp = 1;
-    if (ltmp > 65535) ltmp = 65535;
-    p.cycles = (uint16_t)ltmp;
-  }
+  // Integer digits only (toInt() is 32-bit, Unix ms is not)
+  out = strtoull(body.c_str() + idx, nullptr, 10);
+  return true;
+}
 
-  if (body.indexOf("\"startMode\":\"discharge\"") >= 0) p.startMode = Mode::Discharge;
-  if (body.indexOf("\"startMode\":\"charge\"") >= 0)    p.startMode = Mode::Charge;
+bool UiHttp::extractFlag(const String& body, const char* key, bool& out) {
+  long v;
+  if (!extractNumber(body, key, v)) return false;
+  out = (v != 0);
+  return true;
+}
 
-  if (body.indexOf("\"stopMode\":\"discharge\"") >= 0) p.stopMode = Mode::Discharge;
-  if (body.indexOf("\"stopMode\":\"charge\"") >= 0)    p.stopMode = Mode::Charge;
+bool UiHttp::extractString(const String& body, const char* key, String& out) {
+  String pat = String("\"") + key + "\":\"";
+  int idx = body.indexOf(pat);
+  if (idx < 0) return false;
 
-  sm_.setProgram(p);
+  const int start = idx + pat.length();
+  const int end = body.indexOf('"', start);
+  if (end < 0) return false;
 
-  // --- CoreConfig (thresholds + waits) --------------------------------------
-  CoreConfig cfg = core_.getConfig();
+  out = body.substring(start, end);
+  return true;
+}
 
+void UiHttp::applyCoreConfig(const String& body, CoreConfig& cfg) {
+  long ltmp;
   float ftmp;
+
   if (extractNumber(body, "chargeStopVoltage_V", ftmp)) {
     cfg.chargeStopVoltage_V = ftmp;
   }
@@ -468,11 +902,119 @@ void UiHttp::handleConfig() {
     cfg.waitDischargeToCharge_s = (uint32_t)ltmp;
   }
 
+  if (extractNumber(body, "sampleMin_s", ltmp)) {
+    if (ltmp < 1) ltmp = 1;
+    cfg.sampleMin_s = (uint32_t)ltmp;
+  }
+
+  if (extractNumber(body, "sampleMax_s", ltmp)) {
+    if (ltmp < 1) ltmp = 1;
+    cfg.sampleMax_s = (uint32_t)ltmp;
+  }
+  if (cfg.sampleMax_s < cfg.sampleMin_s) cfg.sampleMax_s = cfg.sampleMin_s;
+
+  if (extractNumber(body, "sampleNearBand_V", ftmp)) {
+    if (ftmp < 0.0f) ftmp = 0.0f;
+    cfg.sampleNearBand_V = ftmp;
+  }
+
+  // Charge termination rules
+  extractFlag(body, "termHold", cfg.termHoldEnabled);
+  extractFlag(body, "termTaper", cfg.termTaperEnabled);
+  extractFlag(body, "termPlateau", cfg.termPlateauEnabled);
+  extractFlag(body, "termNegDv", cfg.termNegDvEnabled);
+  extractFlag(body, "termMaxTime", cfg.termMaxTimeEnabled);
+  extractFlag(body, "termMaxAh", cfg.termMaxAhEnabled);
+
+  if (extractNumber(body, "capacityNominal_Ah", ftmp) && ftmp >= 0.0f) cfg.capacityNominal_Ah = ftmp;
+  if (extractNumber(body, "taperDivisor", ftmp) && ftmp > 0.0f)        cfg.taperDivisor = ftmp;
+  if (extractNumber(body, "termArmVoltage_V", ftmp))                   cfg.termArmVoltage_V = ftmp;
+  if (extractNumber(body, "plateauSlope_mVpm", ftmp))                  cfg.plateauSlope_mVpm = ftmp;
+  if (extractNumber(body, "negDv_V", ftmp) && ftmp > 0.0f)             cfg.negDv_V = ftmp;
+  if (extractNumber(body, "maxChargeAh", ftmp) && ftmp > 0.0f)         cfg.maxChargeAh = ftmp;
+
+  if (extractNumber(body, "taperHold_s", ltmp) && ltmp >= 0)     cfg.taperHold_s = (uint32_t)ltmp;
+  if (extractNumber(body, "plateauHold_s", ltmp) && ltmp >= 0)   cfg.plateauHold_s = (uint32_t)ltmp;
+  if (extractNumber(body, "maxChargeTime_s", ltmp) && ltmp >= 0) cfg.maxChargeTime_s = (uint32_t)ltmp;
+
+  // Internal resistance pulses
+  extractFlag(body, "irEnabled", cfg.irEnabled);
+  if (extractNumber(body, "irInterval_s", ltmp) && ltmp >= 1) cfg.irInterval_s = (uint32_t)ltmp;
+}
+
+void UiHttp::handleConfig() {
+  String body;
+  if (!readJsonBody(server_, body)) {
+    BT_LOGW(TAG, "POST /api/config missing body");
+    server_.send(400, "text/plain", "Missing body");
+    return;
+  }
+
+  BT_LOGI(TAG, "POST /api/config body=%s", body.c_str());
+
+  // --- Program (StateMachine) ------------------------------------------------
+  Program p = sm_.getProgram();
+
+  long ltmp;
+  if (extractNumber(body, "cycles", ltmp)) {
+    if (ltmp < 1) ltmp = 1;
+    if (ltmp > 65535) ltmp = 65535;
+    p.cycles = (uint16_t)ltmp;
+  }
+
+  if (body.indexOf("\"startMode\":\"discharge\"") >= 0) p.startMode = Mode::Discharge;
+  if (body.indexOf("\"startMode\":\"charge\"") >= 0)    p.startMode = Mode::Charge;
+
+  if (body.indexOf("\"stopMode\":\"discharge\"") >= 0) p.stopMode = Mode::Discharge;
+  if (body.indexOf("\"stopMode\":\"charge\"") >= 0)    p.stopMode = Mode::Charge;
+
+  sm_.setProgram(p);
+
+  // --- CoreConfig (thresholds + waits) --------------------------------------
+  CoreConfig cfg = core_.getConfig();
+  applyCoreConfig(body, cfg);
   core_.setConfig(cfg);
 
+  // Persist (no flash write if nothing changed)
+  const StoredSettings stored{cfg, p};
+  if (!store_.save(stored)) {
+    server_.send(500, "text/plain", "Applied, but not stored in NVS");
+    return;
+  }
+
   server_.send(200, "text/plain", "OK");
 }
 
+// Appends the CoreConfig keys (no braces, no trailing comma).
+void UiHttp::appendCoreConfig(String& json, const CoreConfig& cfg) {
+  json += "\"chargeStopVoltage_V\":" + String(cfg.chargeStopVoltage_V, 3) + ",";
+  json += "\"chargeStopHold_s\":" + String((uint32_t)cfg.chargeHoldAbove_s) + ",";
+  json += "\"waitChargeToDischarge_s\":" + String((uint32_t)cfg.waitChargeToDischarge_s) + ",";
+  json += "\"dischargeStopVoltage_V\":" + String(cfg.dischargeStopVoltage_V, 3) + ",";
+  json += "\"waitDischargeToCharge_s\":" + String((uint32_t)cfg.waitDischargeToCharge_s) + ",";
+  json += "\"sampleMin_s\":" + String((uint32_t)cfg.sampleMin_s) + ",";
+  json += "\"sampleMax_s\":" + String((uint32_t)cfg.sampleMax_s) + ",";
+  json += "\"sampleNearBand_V\":" + String(cfg.sampleNearBand_V, 3) + ",";
+
+  json += "\"termHold\":" + String(cfg.termHoldEnabled ? 1 : 0) + ",";
+  json += "\"termTaper\":" + String(cfg.termTaperEnabled ? 1 : 0) + ",";
+  json += "\"capacityNominal_Ah\":" + String(cfg.capacityNominal_Ah, 3) + ",";
+  json += "\"taperDivisor\":" + String(cfg.taperDivisor, 1) + ",";
+  json += "\"taperHold_s\":" + String((uint32_t)cfg.taperHold_s) + ",";
+  json += "\"termArmVoltage_V\":" + String(cfg.termArmVoltage_V, 3) + ",";
+  json += "\"termPlateau\":" + String(cfg.termPlateauEnabled ? 1 : 0) + ",";
+  json += "\"plateauSlope_mVpm\":" + String(cfg.plateauSlope_mVpm, 3) + ",";
+  json += "\"plateauHold_s\":" + String((uint32_t)cfg.plateauHold_s) + ",";
+  json += "\"termNegDv\":" + String(cfg.termNegDvEnabled ? 1 : 0) + ",";
+  json += "\"negDv_V\":" + String(cfg.negDv_V, 3) + ",";
+  json += "\"termMaxTime\":" + String(cfg.termMaxTimeEnabled ? 1 : 0) + ",";
+  json += "\"maxChargeTime_s\":" + String((uint32_t)cfg.maxChargeTime_s) + ",";
+  json += "\"termMaxAh\":" + String(cfg.termMaxAhEnabled ? 1 : 0) + ",";
+  json += "\"maxChargeAh\":" + String(cfg.maxChargeAh, 3) + ",";
+  json += "\"irEnabled\":" + String(cfg.irEnabled ? 1 : 0) + ",";
+  json += "\"irInterval_s\":" + String((uint32_t)cfg.irInterval_s);
+}
+
 void UiHttp::handleGetConfig() {
   Program p = sm_.getProgram();
   CoreConfig cfg = core_.getConfig();
@@ -485,11 +1027,7 @@ void UiHttp::handleGetConfig() {
   json += "\"startMode\":\"" + String(sm) + "\",";
   json += "\"stopMode\":\""  + String(em) + "\",";
 
-  json += "\"chargeStopVoltage_V\":" + String(cfg.chargeStopVoltage_V, 3) + ",";
-  json += "\"chargeStopHold_s\":" + String((uint32_t)cfg.chargeHoldAbove_s) + ",";
-  json += "\"waitChargeToDischarge_s\":" + String((uint32_t)cfg.waitChargeToDischarge_s) + ",";
-  json += "\"dischargeStopVoltage_V\":" + String(cfg.dischargeStopVoltage_V, 3) + ",";
-  json += "\"waitDischargeToCharge_s\":" + String((uint32_t)cfg.waitDischargeToCharge_s);
+  appendCoreConfig(json, cfg);
 
   json += "}";
 
@@ -498,33 +1036,540 @@ void UiHttp::handleGetConfig() {
 
 
 void UiHttp::handleDownload() {
+  ScopedTimer timer(MetricId::HttpDownload);
   BT_LOGI(TAG, "Download log requested");
 
-  // ---- Pass 1: count exact CSV byte length -------------------------------
-  struct CountingPrint : public Print {
-    size_t n = 0;
-    size_t write(uint8_t) override { n++; return 1; }
-    size_t write(const uint8_t* /*buf*/, size_t len) override { n += len; return len; }
+  // Optional selection: ?cols=Time_s,U_V&cycle=3&phase=2&from=0&to=3600&every=4
+  LogQuery q;
+  String err;
+  if (!parseLogQuery(q, err)) {
+    server_.send(400, "text/plain", err);
+    return;
+  }
+
+  // Both passes read the rows held now; rows logged meanwhile are not part
+  // of this download (consistent cut without stopping the logging)
+  q.pin(log_.snapshot());
+
+  // One pass, chunked: rows the ring overwrites while they are sent are
+  // left out, the body never disagrees with a length announced up front
+  server_.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server_.sendHeader("Content-Disposition", "attachment; filename=\"battery_log.csv\"");
+  server_.send(200, "text/csv; charset=utf-8", "");
+
+  ChunkPrint out(server_);
+  const uint32_t lost = log_.printCsv(out, q);
+  out.flush();
+  server_.sendContent("");   // last chunk
+  if (lost > 0) {
+    BT_LOGW(TAG, "download: %lu rows overwritten before they were sent", (unsigned long)lost);
+  }
+}
+
+bool UiHttp::parseLogQuery(LogQuery& q, String& err) {
+  // cols: comma-separated schema names
+  if (server_.hasArg("cols")) {
+    const String list = server_.arg("cols");
+    int start = 0;
+    while (start <= (int)list.length()) {
+      int end = list.indexOf(',', start);
+      if (end < 0) end = list.length();
+      const String name = list.substring(start, end);
+      if (name.length() > 0) {
+        const int col = log_.colIndex(name.c_str());
+        if (col < 0) {
+          err = "Unknown column: " + name;
+          return false;
+        }
+        q.cols |= (1u << col);
+      }
+      start = end + 1;
+    }
+  }
+
+  // Filters on the integer columns Cycle, Phase and Time_s; a cycle (and
+  // phase) also limits the scan to its rows via the phase index
+  auto range = [&](const char* colName, uint32_t lo, uint32_t hi) {
+    const int col = log_.colIndex(colName);
+    if (col < 0 || log_.colType(col) == ColType::F32) {
+      err = String("No filterable column ") + colName;
+      return false;
+    }
+    return q.addRange((uint8_t)col, lo, hi);
   };
 
+  // phase also selects the phase index entry (-1 = whole cycle)
+  int phase = -1;
+  if (server_.hasArg("phase")) {
+    uint32_t p;
+    if (!parseUint(server_.arg("phase"), 255, p)) {
+      err = "phase must be 0..255";
+      return false;
+    }
+    if (!range("Phase", p, p)) return false;
+    phase = (int)p;
+  }
+  if (server_.hasArg("cycle")) {
+    uint32_t c;
+    if (!parseUint(server_.arg("cycle"), 0xFFFF, c)) {
+      err = "cycle must be 0..65535";
+      return false;
+    }
+    if (!range("Cycle", c, c)) return false;
+
+    q.seqRange = true;
+    if (!index_.find((uint16_t)c, phase, log_.oldestSeq(), log_.nextSeq(),
+                     q.seqFirst, q.seqEnd)) {
+      q.seqFirst = q.seqEnd = log_.nextSeq();   // no such rows held: header only
+    }
+  }
+  if (server_.hasArg("from") || server_.hasArg("to")) {
+    uint32_t from = 0, to = UINT32_MAX;
+    if ((server_.hasArg("from") && !parseUint(server_.arg("from"), UINT32_MAX, from)) ||
+        (server_.hasArg("to") && !parseUint(server_.arg("to"), UINT32_MAX, to))) {
+      err = "from / to must be seconds >= 0";
+      return false;
+    }
+    if (!range("Time_s", from, to)) return false;
+  }
+
+  if (server_.hasArg("every")) {
+    uint32_t every;
+    if (!parseUint(server_.arg("every"), 65535, every) || every < 1) {
+      err = "every must be 1..65535";
+      return false;
+    }
+    q.every = (uint16_t)every;
+  }
+  return true;
+}
+
+void UiHttp::handleLogIndex() {
+  // Cycle / phase boundaries of the held log rows (small, rendered at once)
+  String body;
+  StringPrint sp(body);
+  index_.printJson(sp, log_.oldestSeq(), log_.nextSeq());
+  server_.send(200, "application/json; charset=utf-8", body);
+}
+
+void UiHttp::handleCycles() {
+  // JSON by default, ?format=csv for a spreadsheet-friendly table.
+  // Same two-pass scheme as /download (the table only changes in loop()).
+  const bool csv = server_.hasArg("format") && server_.arg("format") == "csv";
+
   CountingPrint counter;
-  log_.printCsv(counter);
-  const size_t totalBytes = counter.n;
+  if (csv) cycles_.printCsv(counter);
+  else     cycles_.printJson(counter);
 
-  // ---- HTTP headers (known Content-Length, no chunked) --------------------
-  server_.setContentLength(totalBytes);
-  server_.sendHeader("Content-Disposition", "attachment; filename=\"battery_log.csv\"");
+  server_.setContentLength(counter.n);
+  if (csv) server_.sendHeader("Content-Disposition", "attachment; filename=\"battery_cycles.csv\"");
   server_.sendHeader("Connection", "close");
-  server_.send(200, "text/csv; charset=utf-8", "");
+  server_.send(200, csv ? "text/csv; charset=utf-8" : "application/json; charset=utf-8", "");
 
-  // ---- Pass 2: stream actual CSV -----------------------------------------
   WiFiClient c = server_.client();
-  log_.printCsv(c);
+  if (csv) cycles_.printCsv(c);
+  else     cycles_.printJson(c);
+  c.stop();
+}
+
+void UiHttp::handleMetrics() {
+  // Values change while rendering, so render once into RAM (a few KB)
+  // instead of the two-pass Content-Length scheme used for the CSV.
+  String body;
+  body.reserve(8192);
+  StringPrint sp(body);
+  metricsPrintPrometheus(sp);
+
+  // Log storage (sized from free heap at boot) and how long it lasts
+  const float hours = (float)log_.capacity() * (float)core_.logInterval_s() / 3600.0f;
+  metricsPrintGauge(sp, "bt_log_storage_bytes", "RAM given to the log buffer.", (int64_t)log_.storageBytes());
+  metricsPrintGauge(sp, "bt_log_capacity_rows", "Rows the log buffer holds before it wraps.", (int64_t)log_.capacity());
+  metricsPrintGauge(sp, "bt_log_rows", "Rows currently held.", (int64_t)log_.size());
+  metricsPrintGauge(sp, "bt_log_capacity_hours", "History the log holds at the current row interval.", hours, 1);
+
+  server_.send(200, "text/plain; version=0.0.4; charset=utf-8", body);
+}
+
+// One ShadowResult as a JSON object.
+static String shadowResultJson(const ShadowResult& r) {
+  static const char* kStates[] = {"idle", "running", "stopped", "not_reached"};
+
+  String json = "{";
+  json += "\"state\":\"" + String(kStates[(uint8_t)r.state]) + "\",";
+  json += "\"phase\":\"" + String(r.phase == Phase::Charge ? "charge" : "discharge") + "\",";
+  json += "\"elapsed_s\":" + String(r.elapsed_s) + ",";
+  json += "\"voltage_V\":" + jsonFloat(r.voltage_V, 3) + ",";
+  json += "\"energy_Wh\":" + String(r.energy_Wh, 3) + ",";
+  json += "\"charge_Ah\":" + String(r.charge_Ah, 3) + ",";
+  json += "\"reason\":\"" + String(chargeStopReasonName(r.reason)) + "\"";
+  json += "}";
+  return json;
+}
+
+void UiHttp::handleGetShadows() {
+  String json;
+  json.reserve(2048);
+  json = "{";
+  json += "\"slots\":" + String((int)ShadowEvaluator::kSlots) + ",";
+  json += "\"evaluations\":" + String(shadows_.evaluations()) + ",";
+  json += "\"variants\":[";
+
+  bool first = true;
+  for (uint8_t k = 0; k < ShadowEvaluator::kSlots; ++k) {
+    if (!shadows_.used(k)) continue;
+    if (!first) json += ",";
+    first = false;
+
+    json += "{\"slot\":" + String((int)k) + ",";
+    json += "\"config\":{";
+    appendCoreConfig(json, shadows_.config(k));
+    json += "},";
+    json += "\"current\":" + shadowResultJson(shadows_.current(k)) + ",";
+    json += "\"lastCharge\":" + shadowResultJson(shadows_.lastCharge(k)) + ",";
+    json += "\"lastDischarge\":" + shadowResultJson(shadows_.lastDischarge(k));
+    json += "}";
+  }
+  json += "]}";
+
+  server_.send(200, "application/json; charset=utf-8", json);
+}
+
+void UiHttp::handleShadows() {
+  // {"slot":n, <CoreConfig keys>} installs a variant (unset keys = active config),
+  // {"slot":n, "clear":1} removes it.
+  String body;
+  if (!readJsonBody(server_, body)) {
+    BT_LOGW(TAG, "POST /api/shadows missing body");
+    server_.send(400, "text/plain", "Missing body");
+    return;
+  }
+
+  BT_LOGI(TAG, "POST /api/shadows body=%s", body.c_str());
+
+  long slot;
+  if (!extractNumber(body, "slot", slot) || slot < 0 || slot >= ShadowEvaluator::kSlots) {
+    server_.send(400, "text/plain", "Invalid slot");
+    return;
+  }
+
+  bool clear = false;
+  extractFlag(body, "clear", clear);
+  if (clear) {
+    shadows_.clearVariant((uint8_t)slot);
+  } else {
+    CoreConfig cfg = core_.getConfig();
+    applyCoreConfig(body, cfg);
+    shadows_.setVariant((uint8_t)slot, cfg);
+  }
+
+  server_.send(200, "text/plain", "OK");
+}
+
+
+void UiHttp::handleTime() {
+  // {"epoch_ms":<Unix ms>} anchors the monotonic clock to wall time (the page
+  // posts Date.now() on load). Timing itself never depends on it.
+  String body;
+  if (!readJsonBody(server_, body)) {
+    server_.send(400, "text/plain", "Missing body");
+    return;
+  }
+
+  uint64_t epoch_ms;
+  if (!extractNumber(body, "epoch_ms", epoch_ms)) {
+    server_.send(400, "text/plain", "Missing epoch_ms");
+    return;
+  }
+
+  clockSetEpoch_ms(epoch_ms);
+  BT_LOGI(TAG, "Wall clock anchored, offset=%llu ms",
+          (unsigned long long)clockEpochOffset_ms());
+  server_.send(200, "text/plain", "OK");
+}
+
+
+void UiHttp::handleGetProgram() {
+  String json = "{";
+  json += "\"active\":" + String(sm_.getProgram().stepTable ? "true" : "false") + ",";
+  json += "\"running\":" + String(core_.stepRun() ? "true" : "false") + ",";
+  if (core_.stepRun()) {
+    json += "\"step\":" + String((int)seq_.stepIndex()) + ",";
+    json += "\"type\":\"" + String(stepTypeName(seq_.step().type)) + "\",";
+  }
+  json += "\"last_end\":\"" + String(stepEndName(seq_.lastEnd())) + "\",";
+  json += "\"max_steps\":" + String((int)kProgramMaxSteps) + ",";
+  json += "\"steps\":";
+  StringPrint sp(json);
+  stepProgramPrintJson(sp, seq_.program());
+  json += "}";
+
+  server_.send(200, "application/json; charset=utf-8", json);
+}
+
+void UiHttp::handleProgram() {
+  // {"steps":[...]} loads and activates a step table, {"clear":1} returns
+  // to the classic charge/discharge loop. Checked completely before use.
+  String body;
+  if (!readJsonBody(server_, body)) {
+    BT_LOGW(TAG, "POST /api/program missing body");
+    server_.send(400, "text/plain", "Missing body");
+    return;
+  }
+
+  BT_LOGI(TAG, "POST /api/program body=%s", body.c_str());
+
+  if (core_.runState() != RunState::Off) {
+    server_.send(409, "text/plain", "Stop the running program first");
+    return;
+  }
+
+  Program p = sm_.getProgram();
 
-  // Optional: explicitly close after sending
+  bool clear = false;
+  extractFlag(body, "clear", clear);
+  if (clear) {
+    seq_.unload();
+    p.stepTable = false;
+    sm_.setProgram(p);
+    server_.send(200, "text/plain", "OK");
+    return;
+  }
+
+  // Parsed into a scratch program, so a rejected upload keeps the old one
+  static StepProgram parsed;
+  char err[96];
+  if (!stepProgramFromJson(body.c_str(), parsed, err, sizeof(err)) ||
+      !seq_.load(parsed, err, sizeof(err))) {
+    BT_LOGW(TAG, "step program rejected: %s", err);
+    server_.send(400, "text/plain", err);
+    return;
+  }
+
+  p.stepTable = true;
+  sm_.setProgram(p);
+  server_.send(200, "text/plain", "OK");
+}
+
+
+void UiHttp::handleGetSafety() {
+  const SafetyLimits l = safety_.limits();
+  const bool faulted = safety_.faulted();
+
+  String json = "{";
+  json += "\"max_voltage_V\":" + String(l.maxVoltage_V, 3) + ",";
+  json += "\"min_voltage_V\":" + String(l.minVoltage_V, 3) + ",";
+  json += "\"max_current_A\":" + String(l.maxCurrent_A, 3) + ",";
+  json += "\"debounce\":" + String((int)l.debounce) + ",";
+  json += "\"period_ms\":" + String((unsigned long)kSafetyPeriod_ms) + ",";
+  json += "\"fault\":\"" + String(safetyFaultName(safety_.fault())) + "\",";
+  json += "\"value\":" + (faulted ? jsonFloat(safety_.faultValue(), 3) : String("null")) + ",";
+  json += "\"fault_time_ms\":" + (faulted ? u64String(safety_.faultTime_ms()) : String("null")) + ",";
+  json += "\"latency_us\":" + (faulted ? String((unsigned long)safety_.faultLatency_us()) : String("null")) + ",";
+  json += "\"interlocked\":" + String(hw_.interlocked() ? "true" : "false") + ",";
+  json += "\"checks\":" + String((unsigned long)safety_.checks());
+  json += "}";
+
+  server_.send(200, "application/json; charset=utf-8", json);
+}
+
+void UiHttp::handleSafety() {
+  // Partial update of the hard limits; missing keys keep their value.
+  String body;
+  if (!readJsonBody(server_, body)) {
+    BT_LOGW(TAG, "POST /api/safety missing body");
+    server_.send(400, "text/plain", "Missing body");
+    return;
+  }
+
+  BT_LOGI(TAG, "POST /api/safety body=%s", body.c_str());
+
+  SafetyLimits l = safety_.limits();
+  long debounce = l.debounce;
+  extractNumber(body, "max_voltage_V", l.maxVoltage_V);
+  extractNumber(body, "min_voltage_V", l.minVoltage_V);
+  extractNumber(body, "max_current_A", l.maxCurrent_A);
+  extractNumber(body, "debounce", debounce);
+
+  if (!(l.maxVoltage_V > l.minVoltage_V) || !(l.maxCurrent_A > 0.0f) ||
+      debounce < 1 || debounce > 100) {
+    server_.send(400, "text/plain", "Invalid safety limits");
+    return;
+  }
+  l.debounce = (uint8_t)debounce;
+
+  safety_.setLimits(l);
+  server_.send(200, "text/plain", "OK");
+}
+
+
+void UiHttp::handleGetCapture() {
+  // JSON state by default, ?format=csv for the samples of the last burst.
+  // The buffer only changes in loop() (drain()), so the two passes agree.
+  const bool csv = server_.hasArg("format") && server_.arg("format") == "csv";
+
+  if (!csv) {
+    const LatencyHistogram& jitter = metricsHistogram(MetricId::AcqJitter);
+    String json = "{";
+    json += "\"active\":" + String(acq_.active() ? "true" : "false") + ",";
+    json += "\"period_us\":" + String((unsigned long)acq_.period_us()) + ",";
+    json += "\"requested\":" + String((unsigned long)acq_.requested()) + ",";
+    json += "\"samples\":" + String((unsigned long)acq_.size()) + ",";
+    json += "\"missed\":" + String((unsigned long)acq_.missed()) + ",";
+    json += "\"dropped\":" + String((unsigned long)acq_.dropped()) + ",";
+    json += "\"jitter_p99_us\":" + String((unsigned long)jitter.percentile_us(0.99f)) + ",";
+    json += "\"jitter_max_us\":" + String((unsigned long)jitter.max_us()) + ",";
+    json += "\"max_samples\":" + String((unsigned long)acq_.capacity()) + ",";
+    json += "\"min_period_us\":" + String((unsigned long)kAcqMinPeriod_us);
+    json += "}";
+    server_.send(200, "application/json; charset=utf-8", json);
+    return;
+  }
+
+  CountingPrint counter;
+  acq_.printCsv(counter);
+
+  server_.setContentLength(counter.n);
+  server_.sendHeader("Content-Disposition", "attachment; filename=\"battery_capture.csv\"");
+  server_.sendHeader("Connection", "close");
+  server_.send(200, "text/csv; charset=utf-8", "");
+
+  WiFiClient c = server_.client();
+  acq_.printCsv(c);
   c.stop();
 }
 
+void UiHttp::handleCapture() {
+  // {"period_us":1000,"samples":1000} starts a burst, {"stop":1} ends it early.
+  String body;
+  if (!readJsonBody(server_, body)) {
+    BT_LOGW(TAG, "POST /api/capture missing body");
+    server_.send(400, "text/plain", "Missing body");
+    return;
+  }
+
+  BT_LOGI(TAG, "POST /api/capture body=%s", body.c_str());
+
+  bool stop = false;
+  extractFlag(body, "stop", stop);
+  if (stop) {
+    acq_.stop();
+    server_.send(200, "text/plain", "OK");
+    return;
+  }
+
+  long period_us = kAcqDefaultPeriod_us;
+  long samples = (long)acq_.capacity();
+  extractNumber(body, "period_us", period_us);
+  extractNumber(body, "samples", samples);
+
+  if (period_us <= 0 || samples <= 0) {
+    server_.send(400, "text/plain", "Invalid capture parameters");
+    return;
+  }
+
+  char err[64];
+  if (!acq_.start((uint32_t)period_us, (uint32_t)samples, err, sizeof(err))) {
+    server_.send(acq_.active() ? 409 : 400, "text/plain", err);
+    return;
+  }
+
+  server_.send(200, "text/plain", "OK");
+}
+
+
+void UiHttp::handleGetProfiles() {
+  String json = "{";
+  json += "\"active\":\"" + String(store_.activeName()) + "\",";
+  json += "\"writes\":" + String((unsigned long)store_.writes()) + ",";
+  json += "\"load_us\":" + String((unsigned long)store_.lastLoad_us()) + ",";
+  json += "\"profiles\":[";
+  for (uint8_t slot = 0; slot < kConfigProfiles; ++slot) {
+    char name[kConfigProfileNameLen];
+    const bool used = store_.profileName(slot, name, sizeof(name));
+    if (slot > 0) json += ",";
+    json += "{\"slot\":" + String((int)slot) + ",\"name\":";
+    json += used ? "\"" + String(name) + "\"" : String("null");
+    json += "}";
+  }
+  json += "]}";
+
+  server_.send(200, "application/json; charset=utf-8", json);
+}
+
+void UiHttp::handleProfiles() {
+  // {"save":0,"name":"LiFePO4 4S"} stores the current settings in a slot,
+  // {"load":0} makes a slot the active settings (only while stopped),
+  // {"erase":0} clears it.
+  String body;
+  if (!readJsonBody(server_, body)) {
+    BT_LOGW(TAG, "POST /api/profiles missing body");
+    server_.send(400, "text/plain", "Missing body");
+    return;
+  }
+
+  BT_LOGI(TAG, "POST /api/profiles body=%s", body.c_str());
+
+  long slot;
+  if (extractNumber(body, "save", slot)) {
+    String name;
+    if (!extractString(body, "name", name) || name.length() == 0) {
+      server_.send(400, "text/plain", "Missing profile name");
+      return;
+    }
+    // Names go back out as JSON strings: printable ASCII without backslash
+    for (unsigned k = 0; k < name.length(); ++k) {
+      const char c = name[k];
+      if (c < 0x20 || c > 0x7E || c == '\\') name.setCharAt(k, '_');
+    }
+
+    const StoredSettings s{core_.getConfig(), sm_.getProgram()};
+    if (slot < 0 || slot >= kConfigProfiles ||
+        !store_.saveProfile((uint8_t)slot, name.c_str(), s)) {
+      server_.send(400, "text/plain", "Profile not stored");
+      return;
+    }
+  } else if (extractNumber(body, "load", slot)) {
+    if (core_.runState() != RunState::Off) {
+      server_.send(409, "text/plain", "Stop the running program first");
+      return;
+    }
+
+    StoredSettings s;
+    if (slot < 0 || slot >= kConfigProfiles || !store_.loadProfile((uint8_t)slot, s)) {
+      server_.send(404, "text/plain", "Profile slot empty");
+      return;
+    }
+    s.program.stepTable = sm_.getProgram().stepTable;   // keep classic / step table choice
+    core_.setConfig(s.core);
+    sm_.setProgram(s.program);
+  } else if (extractNumber(body, "erase", slot)) {
+    if (slot < 0 || slot >= kConfigProfiles || !store_.eraseProfile((uint8_t)slot)) {
+      server_.send(400, "text/plain", "Invalid profile slot");
+      return;
+    }
+  } else {
+    server_.send(400, "text/plain", "Expected save, load or erase");
+    return;
+  }
+
+  server_.send(200, "text/plain", "OK");
+}
+
+void UiHttp::handleGetMqtt() {
+  String json = "{";
+  json += "\"state\":\"" + String(mqttStateName(mqtt_.state())) + "\",";
+  json += "\"broker\":\"" + String(kMqttBroker) + "\",";
+  json += "\"device\":\"" + String(mqtt_.deviceId()) + "\",";
+  json += "\"queued\":" + String((unsigned long)mqtt_.queued()) + ",";
+  json += "\"backlog_rows\":" + String((unsigned long)mqtt_.backlogRows()) + ",";
+  json += "\"sent\":" + String((unsigned long)mqtt_.sent()) + ",";
+  json += "\"lost\":" + String((unsigned long)mqtt_.lost()) + ",";
+  json += "\"connects\":" + String((unsigned long)mqtt_.connects());
+  json += "}";
+
+  server_.send(200, "application/json; charset=utf-8", json);
+}
+
 
 bool UiHttp::readJsonBody(WebServer& s, String& out) {
   if (!s.hasArg("plain")) return false;
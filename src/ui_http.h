@@ -1,17 +1,31 @@
 #pragma once
 #include <stdint.h>
 #include <WString.h>
+#include "config.h"
 
 class WebServer;
 class StateMachine;
 class Hw;
 class LogBuffer;
 class Core;
+class ShadowEvaluator;
+class CycleTable;
+class Sequencer;
+class SafetyMonitor;
+class Acquisition;
+class ConfigStore;
+class MqttPublisher;
+class PhaseIndex;
+struct CoreConfig;
+struct LogQuery;
 
 // Simple HTTP adapter: serves UI, accepts commands/config, exposes telemetry, provides download.
 class UiHttp {
 public:
-  UiHttp(WebServer& server, StateMachine& sm, Core& core, Hw& hw, LogBuffer& log);
+  UiHttp(WebServer& server, StateMachine& sm, Core& core, Hw& hw, LogBuffer& log,
+         ShadowEvaluator& shadows, CycleTable& cycles, Sequencer& seq,
+         SafetyMonitor& safety, Acquisition& acq, ConfigStore& store,
+         MqttPublisher& mqtt, PhaseIndex& index);
 
   // Call once from setup()
   void begin();
@@ -19,12 +33,39 @@ public:
   // Call regularly from loop()
   void tick();
 
+  // loop(), after the sampler: re-render the /api/status snapshot after a
+  // new core sample, a state change or once it is kHttpStatusMaxAge_ms old.
+  void updateStatus(uint64_t now_ms, bool newSample);
+
 private:
   WebServer& server_;
   StateMachine& sm_;
   Core& core_;
   Hw& hw_;
   LogBuffer& log_;
+  ShadowEvaluator& shadows_;
+  CycleTable& cycles_;
+  Sequencer& seq_;
+  SafetyMonitor& safety_;
+  Acquisition& acq_;
+  ConfigStore& store_;
+  MqttPublisher& mqtt_;
+  PhaseIndex& index_;
+
+  // /api/status snapshot: rendered into the back buffer, then flipped, so a
+  // failed render (too long) keeps the previous snapshot. The handler only
+  // copies the front buffer; version counts content changes (ETag), a
+  // render that only moves the clock keeps the front snapshot.
+  char statusBuf_[2][kHttpStatusBytes];
+  size_t statusLen_[2] = {0, 0};
+  size_t statusBodyOff_[2] = {0, 0};   // content after version / clock
+  uint8_t statusFront_ = 0;
+  uint32_t statusVersion_ = 0;
+  uint32_t statusSig_ = 0;        // state signature of the front snapshot
+  uint64_t statusRenderMs_ = 0;
+
+  uint32_t stateSignature_() const;
+  void renderStatus_(uint64_t now_ms);
 
   void setupRoutes();
 
@@ -35,14 +76,37 @@ private:
   void handleConfig();
   void handleDownload();
   void handleGetConfig();
+  void handleMetrics();
+  void handleGetShadows();
+  void handleShadows();
+  void handleCycles();
+  void handleTime();
+  void handleGetProgram();
+  void handleProgram();
+  void handleGetSafety();
+  void handleSafety();
+  void handleGetCapture();
+  void handleCapture();
+  void handleGetProfiles();
+  void handleProfiles();
+  void handleGetMqtt();
+  void handleLogIndex();
 
 
   // Helpers
   static bool readJsonBody(WebServer& s, String& out);
+  bool parseLogQuery(LogQuery& q, String& err);   // /download arguments
 
   // Tiny JSON-ish extractors (no ArduinoJson)
   static bool extractNumber(const String& body, const char* key, long& out);
   static bool extractNumber(const String& body, const char* key, float& out);
+  static bool extractNumber(const String& body, const char* key, uint64_t& out);
+  static bool extractFlag(const String& body, const char* key, bool& out);   // 0/1
+  static bool extractString(const String& body, const char* key, String& out); // no escapes
+
+  // CoreConfig <-> JSON keys (shared by /api/config and /api/shadows)
+  static void applyCoreConfig(const String& body, CoreConfig& cfg);
+  static void appendCoreConfig(String& json, const CoreConfig& cfg);
 };
 
 
@@ -0,0 +1,111 @@
+#include "wifi_manager.h"
+#include <Arduino.h>
+#include <WiFi.h>
+#include <ESPmDNS.h>
+#include "config.h"
+#include "log.h"
+#include "metrics.h"
+
+static const char* TAG = "WIFI"; // For BT_LOG*
+
+const char* wifiStateName(WifiState s) {
+  switch (s) {
+    case WifiState::Off:         return "off";
+    case WifiState::Connecting:  return "connecting";
+    case WifiState::Station:     return "station";
+    case WifiState::AccessPoint: return "ap";
+  }
+  return "?";
+}
+
+void WifiManager::begin(uint64_t now_ms) {
+  if (!kWifiEnabled) {
+    BT_LOGI(TAG, "WiFi disabled");
+    state_ = WifiState::Off;
+    return;
+  }
+
+  if (kWifiUseSta && kWifiStaSsid[0] != '\0') {
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(kWifiStaSsid, kWifiStaPass);   // returns at once, joins in the background
+
+    BT_LOGI(TAG, "Connecting to WiFi (STA)");
+    Serial.println("#Connecting to WiFi (STA)");
+    connectStartMs_ = now_ms;
+    state_ = WifiState::Connecting;
+    return;
+  }
+
+  startAp_();
+}
+
+void WifiManager::service(uint64_t now_ms) {
+  switch (state_) {
+    case WifiState::Connecting:
+      if (WiFi.status() == WL_CONNECTED) {
+        state_ = WifiState::Station;
+        linkUp_ = true;
+        metricsMarkBoot(BootMark::WifiUp);
+
+        BT_LOGI(TAG, "STA connected after %lu ms, IP: %s",
+                (unsigned long)(now_ms - connectStartMs_),
+                WiFi.localIP().toString().c_str());
+        Serial.print("#STA connected, IP: ");
+        Serial.println(WiFi.localIP().toString());
+        startMdns_();
+      } else if (now_ms - connectStartMs_ >= kWifiStaTimeoutMs) {
+        BT_LOGW(TAG, "STA failed");
+        Serial.println("#STA failed");
+        WiFi.disconnect(true);
+        startAp_();
+      }
+      break;
+
+    case WifiState::Station: {
+      // Only report; the WiFi driver reconnects by itself
+      const bool up = (WiFi.status() == WL_CONNECTED);
+      if (up != linkUp_) {
+        linkUp_ = up;
+        if (up) BT_LOGI(TAG, "STA reconnected, IP: %s", WiFi.localIP().toString().c_str());
+        else    BT_LOGW(TAG, "STA link lost, reconnecting");
+      }
+      break;
+    }
+
+    case WifiState::Off:
+    case WifiState::AccessPoint:
+      break;
+  }
+}
+
+void WifiManager::startAp_() {
+  WiFi.mode(WIFI_AP);
+
+  IPAddress ip(kWifiApIp[0], kWifiApIp[1], kWifiApIp[2], kWifiApIp[3]);
+  IPAddress gw(kWifiApGateway[0], kWifiApGateway[1],
+               kWifiApGateway[2], kWifiApGateway[3]);
+  IPAddress sn(kWifiApSubnet[0], kWifiApSubnet[1],
+               kWifiApSubnet[2], kWifiApSubnet[3]);
+
+  if (!WiFi.softAPConfig(ip, gw, sn)) {
+    BT_LOGE(TAG, "AP IP config failed");
+  }
+
+  WiFi.softAP(kWifiApSsid, kWifiApPass, kWifiApChannel);
+  state_ = WifiState::AccessPoint;
+  metricsMarkBoot(BootMark::WifiUp);
+
+  BT_LOGI(TAG, "AP started, IP: %s",
+          WiFi.softAPIP().toString().c_str());
+  startMdns_();
+}
+
+void WifiManager::startMdns_() {
+  if (MDNS.begin("batterytester")) {
+    BT_LOGI(TAG, "mDNS started: http://batterytester.local");
+    Serial.println("#mDNS started: http://batterytester.local");
+  } else {
+    BT_LOGE(TAG, "mDNS setup failed");
+    Serial.println("#mDNS setup failed");
+  }
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+
+// Connection state, see WifiManager.
+enum class WifiState : uint8_t {
+  Off = 0,          // kWifiEnabled = false
+  Connecting = 1,   // STA join in progress (up to kWifiStaTimeoutMs)
+  Station = 2,      // STA connected (the ESP reconnects on its own after a drop)
+  AccessPoint = 3   // AP fallback running
+};
+
+const char* wifiStateName(WifiState s);
+
+// Non-blocking WiFi bring-up: STA first, AP fallback after the timeout,
+// mDNS once an interface is up. begin() only starts the join, service() is
+// polled from loop(), so hardware and sampling run from the first
+// milliseconds after boot instead of after the STA timeout.
+class WifiManager {
+public:
+  void begin(uint64_t now_ms);
+  void service(uint64_t now_ms);
+
+  WifiState state() const { return state_; }
+
+private:
+  WifiState state_ = WifiState::Off;
+  uint64_t connectStartMs_ = 0;
+  bool linkUp_ = false;   // STA link state last seen (drop / reconnect logging)
+
+  void startAp_();
+  void startMdns_();
+};